@@ -1,11 +1,146 @@
 #include "Encoding.hh"
 
+#include <array>
 #include <stdexcept>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PHOSG_BSWAP_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define PHOSG_BSWAP_NEON
+#include <arm_neon.h>
+#endif
+
 using namespace std;
 
 namespace phosg {
 
+template <typename T>
+static void bswap_array_scalar(uint8_t* dest, const uint8_t* src, size_t count) {
+  for (size_t z = 0; z < count; z++) {
+    T v;
+    memcpy(&v, src + z * sizeof(T), sizeof(T));
+    v = bswap<T>(v);
+    memcpy(dest + z * sizeof(T), &v, sizeof(T));
+  }
+}
+
+#ifdef PHOSG_BSWAP_X86
+// pshufb mask that reverses the order of each sizeof(T)-byte group. The same
+// pattern is repeated in both 128-bit lanes, since vpshufb can't move bytes
+// between lanes (and doesn't need to here).
+template <typename T>
+alignas(32) static constexpr std::array<uint8_t, 32> bswap_shuffle_mask = []() {
+  std::array<uint8_t, 32> ret{};
+  for (size_t z = 0; z < 32; z++) {
+    ret[z] = ((z & 0x0F) - (z % sizeof(T))) + (sizeof(T) - 1 - (z % sizeof(T)));
+  }
+  return ret;
+}();
+
+// These return the number of values converted; the caller converts the rest
+// (fewer than one vector's worth) with the scalar implementation
+template <typename T>
+__attribute__((target("avx2"))) static size_t bswap_array_avx2(uint8_t* dest, const uint8_t* src, size_t count) {
+  __m256i mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(bswap_shuffle_mask<T>.data()));
+  size_t size = count * sizeof(T);
+  size_t offset = 0;
+  for (; offset + 64 <= size; offset += 64) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + offset));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + offset + 32));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + offset), _mm256_shuffle_epi8(a, mask));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + offset + 32), _mm256_shuffle_epi8(b, mask));
+  }
+  for (; offset + 32 <= size; offset += 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + offset));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + offset), _mm256_shuffle_epi8(a, mask));
+  }
+  return offset / sizeof(T);
+}
+
+template <typename T>
+__attribute__((target("ssse3"))) static size_t bswap_array_ssse3(uint8_t* dest, const uint8_t* src, size_t count) {
+  __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(bswap_shuffle_mask<T>.data()));
+  size_t size = count * sizeof(T);
+  size_t offset = 0;
+  for (; offset + 16 <= size; offset += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + offset));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + offset), _mm_shuffle_epi8(a, mask));
+  }
+  return offset / sizeof(T);
+}
+
+enum class BswapImplementation {
+  SCALAR = 0,
+  SSSE3,
+  AVX2,
+};
+
+static BswapImplementation bswap_implementation() {
+  static const BswapImplementation ret = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return BswapImplementation::AVX2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+      return BswapImplementation::SSSE3;
+    } else {
+      return BswapImplementation::SCALAR;
+    }
+  }();
+  return ret;
+}
+#endif
+
+#ifdef PHOSG_BSWAP_NEON
+template <typename T>
+static size_t bswap_array_neon(uint8_t* dest, const uint8_t* src, size_t count) {
+  size_t size = count * sizeof(T);
+  size_t offset = 0;
+  for (; offset + 16 <= size; offset += 16) {
+    uint8x16_t a = vld1q_u8(src + offset);
+    if constexpr (sizeof(T) == 2) {
+      a = vrev16q_u8(a);
+    } else if constexpr (sizeof(T) == 4) {
+      a = vrev32q_u8(a);
+    } else {
+      a = vrev64q_u8(a);
+    }
+    vst1q_u8(dest + offset, a);
+  }
+  return offset / sizeof(T);
+}
+#endif
+
+template <typename T>
+static void bswap_array_impl(void* vdest, const void* vsrc, size_t count) {
+  uint8_t* dest = reinterpret_cast<uint8_t*>(vdest);
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(vsrc);
+  size_t converted = 0;
+#if defined(PHOSG_BSWAP_X86)
+  BswapImplementation impl = bswap_implementation();
+  if (impl == BswapImplementation::AVX2) {
+    converted = bswap_array_avx2<T>(dest, src, count);
+  } else if (impl == BswapImplementation::SSSE3) {
+    converted = bswap_array_ssse3<T>(dest, src, count);
+  }
+#elif defined(PHOSG_BSWAP_NEON)
+  converted = bswap_array_neon<T>(dest, src, count);
+#endif
+  bswap_array_scalar<T>(dest + converted * sizeof(T), src + converted * sizeof(T), count - converted);
+}
+
+void bswap16_array(void* dest, const void* src, size_t count) {
+  bswap_array_impl<uint16_t>(dest, src, count);
+}
+
+void bswap32_array(void* dest, const void* src, size_t count) {
+  bswap_array_impl<uint32_t>(dest, src, count);
+}
+
+void bswap64_array(void* dest, const void* src, size_t count) {
+  bswap_array_impl<uint64_t>(dest, src, count);
+}
+
 const char* DEFAULT_ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 const char* URLSAFE_ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
 
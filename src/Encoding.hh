@@ -6,6 +6,7 @@
 
 #include <cinttypes>
 #include <cstdint>
+#include <cstring>
 
 #include <format>
 #include <string>
@@ -395,6 +396,114 @@ constexpr bool is_converted_endian_float_sc_v =
 template <typename T>
 constexpr bool is_converted_endian_sc_v = is_converted_endian_int_sc_v<T> || is_converted_endian_float_sc_v<T>;
 
+// The type that values of type T are converted to when they're loaded: the
+// exposed type for converted_endian types, or T itself for all other types
+template <typename T>
+struct loaded_type {
+  using type = T;
+  static constexpr bool is_converted = false;
+  static constexpr bool is_reversed = false;
+};
+template <typename ExposedT, typename StoredT, typename OnStoreSt, typename OnLoadSt>
+struct loaded_type<converted_endian<ExposedT, StoredT, OnStoreSt, OnLoadSt>> {
+  using type = ExposedT;
+  static constexpr bool is_converted = !std::is_same_v<OnLoadSt, ident_st<StoredT, ExposedT>>;
+  static constexpr bool is_reversed = std::is_same_v<OnLoadSt, bswap_st<StoredT, ExposedT>>;
+};
+template <typename T>
+using loaded_type_t = typename loaded_type<T>::type;
+
+// Reverses the byte order of count 16-bit, 32-bit, or 64-bit values from src
+// and writes the results to dest. Neither pointer needs to be aligned, and
+// dest may be the same as src, but the buffers must not otherwise overlap.
+// These use SIMD instructions when available (AVX2 or SSSE3 on x86-64, chosen
+// at runtime, or NEON on ARM).
+void bswap16_array(void* dest, const void* src, size_t count);
+void bswap32_array(void* dest, const void* src, size_t count);
+void bswap64_array(void* dest, const void* src, size_t count);
+
+// Calls the bswapN_array function for values of type T
+template <typename T>
+void bswap_array(void* dest, const void* src, size_t count) {
+  if constexpr (sizeof(T) == 1) {
+    if (dest != src) {
+      memcpy(dest, src, count);
+    }
+  } else if constexpr (sizeof(T) == 2) {
+    bswap16_array(dest, src, count);
+  } else if constexpr (sizeof(T) == 4) {
+    bswap32_array(dest, src, count);
+  } else if constexpr (sizeof(T) == 8) {
+    bswap64_array(dest, src, count);
+  } else {
+    static_assert(always_false<T>::v, "bswap_array can only be used with 1-, 2-, 4-, or 8-byte types");
+  }
+}
+
+// Loads or stores count values of type T (for example, uint32_t or float) in
+// big-endian or little-endian byte order. The pointer to the encoded data
+// doesn't need to be aligned.
+template <typename T>
+void load_be_array(T* dest, const void* src, size_t count) {
+#ifdef PHOSG_LITTLE_ENDIAN
+  bswap_array<T>(dest, src, count);
+#else
+  memcpy(dest, src, count * sizeof(T));
+#endif
+}
+template <typename T>
+void load_le_array(T* dest, const void* src, size_t count) {
+#ifdef PHOSG_LITTLE_ENDIAN
+  memcpy(dest, src, count * sizeof(T));
+#else
+  bswap_array<T>(dest, src, count);
+#endif
+}
+template <typename T>
+void store_be_array(void* dest, const T* src, size_t count) {
+  load_be_array<T>(reinterpret_cast<T*>(dest), src, count);
+}
+template <typename T>
+void store_le_array(void* dest, const T* src, size_t count) {
+  load_le_array<T>(reinterpret_cast<T*>(dest), src, count);
+}
+
+// Loads count values of type T (for example, be_uint32_t) from src, which
+// doesn't need to be aligned, into dest. If T doesn't need any conversion,
+// this is just a memcpy; if T is a reverse-endian type, this uses the bulk
+// bswap functions above.
+template <typename T>
+void load_array(loaded_type_t<T>* dest, const void* src, size_t count) {
+  static_assert(sizeof(T) == sizeof(loaded_type_t<T>), "loaded type must be the same size as the stored type");
+  if constexpr (!loaded_type<T>::is_converted) {
+    memcpy(dest, src, count * sizeof(T));
+  } else if constexpr (loaded_type<T>::is_reversed && (sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8)) {
+    bswap_array<T>(dest, src, count);
+  } else {
+    const T* typed_src = reinterpret_cast<const T*>(src);
+    for (size_t z = 0; z < count; z++) {
+      dest[z] = typed_src[z].load();
+    }
+  }
+}
+
+// The inverse of load_array: stores count values from src into dest (which
+// doesn't need to be aligned) as type T.
+template <typename T>
+void store_array(void* dest, const loaded_type_t<T>* src, size_t count) {
+  static_assert(sizeof(T) == sizeof(loaded_type_t<T>), "loaded type must be the same size as the stored type");
+  if constexpr (!loaded_type<T>::is_converted) {
+    memcpy(dest, src, count * sizeof(T));
+  } else if constexpr (loaded_type<T>::is_reversed && (sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8)) {
+    bswap_array<T>(dest, src, count);
+  } else {
+    T* typed_dest = reinterpret_cast<T*>(dest);
+    for (size_t z = 0; z < count; z++) {
+      typed_dest[z].store(src[z]);
+    }
+  }
+}
+
 extern const char* DEFAULT_ALPHABET;
 extern const char* URLSAFE_ALPHABET;
 
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "Encoding.hh"
+#include "Strings.hh"
+#include "Time.hh"
+
+using namespace std;
+using namespace phosg;
+
+// Each benchmark processes about this many bytes in total, so the results for
+// small and large buffers are comparable
+static constexpr size_t TOTAL_BYTES = 1ULL << 30;
+
+template <typename FnT>
+void run_benchmark(const char* name, size_t buffer_bytes, FnT&& fn) {
+  size_t iterations = (TOTAL_BYTES + buffer_bytes - 1) / buffer_bytes;
+  uint64_t start_time = now();
+  for (size_t z = 0; z < iterations; z++) {
+    fn();
+  }
+  uint64_t total_usecs = now() - start_time;
+
+  double gb_per_sec = total_usecs ? (static_cast<double>(iterations * buffer_bytes) / total_usecs / 1000.0) : 0.0;
+  fwrite_fmt(stdout, "{:<40} {:>10} {:>10} usecs  {:>8.3f} GB/s\n",
+      name, format_size(buffer_bytes), total_usecs, gb_per_sec);
+}
+
+// Converts one value at a time, as callers did before the bulk functions
+// existed. The compiler may still vectorize this loop on its own.
+template <typename T>
+__attribute__((noinline)) void load_array_per_value(loaded_type_t<T>* dest, const void* src, size_t count) {
+  const T* typed_src = reinterpret_cast<const T*>(src);
+  for (size_t z = 0; z < count; z++) {
+    dest[z] = typed_src[z].load();
+  }
+}
+
+template <typename T>
+void run_type_benchmarks(const char* type_name, size_t buffer_bytes) {
+  size_t count = buffer_bytes / sizeof(T);
+  string src(count * sizeof(T), '\0');
+  for (size_t z = 0; z < src.size(); z++) {
+    src[z] = z * 13;
+  }
+  vector<loaded_type_t<T>> dest(count);
+
+  string name = std::format("{} per value", type_name);
+  run_benchmark(name.c_str(), buffer_bytes, [&]() {
+    load_array_per_value<T>(dest.data(), src.data(), count);
+  });
+  name = std::format("{} load_array", type_name);
+  run_benchmark(name.c_str(), buffer_bytes, [&]() {
+    load_array<T>(dest.data(), src.data(), count);
+  });
+  name = std::format("{} StringReader::get (loop)", type_name);
+  run_benchmark(name.c_str(), buffer_bytes, [&]() {
+    StringReader r(src);
+    for (size_t z = 0; z < count; z++) {
+      dest[z] = r.get<T>();
+    }
+  });
+  name = std::format("{} StringReader::read_array", type_name);
+  run_benchmark(name.c_str(), buffer_bytes, [&]() {
+    StringReader r(src);
+    r.read_array<T>(dest.data(), count);
+  });
+  name = std::format("{} StringWriter::put (loop)", type_name);
+  run_benchmark(name.c_str(), buffer_bytes, [&]() {
+    StringWriter w;
+    for (size_t z = 0; z < count; z++) {
+      w.put<T>(dest[z]);
+    }
+  });
+  name = std::format("{} StringWriter::write_array", type_name);
+  run_benchmark(name.c_str(), buffer_bytes, [&]() {
+    StringWriter w;
+    w.write_array<T>(dest.data(), count);
+  });
+}
+
+int main(int argc, char** argv) {
+  vector<size_t> buffer_sizes;
+  for (int x = 1; x < argc; x++) {
+    buffer_sizes.emplace_back(stoull(argv[x], nullptr, 0));
+  }
+  if (buffer_sizes.empty()) {
+    buffer_sizes = {0x40, 0x1000, 0x40000, 0x1000000};
+  }
+
+  for (size_t buffer_size : buffer_sizes) {
+    fwrite_fmt(stdout, "-- {} buffers\n", format_size(buffer_size));
+    run_type_benchmarks<be_uint16_t>("be_uint16_t", buffer_size);
+    run_type_benchmarks<be_uint32_t>("be_uint32_t", buffer_size);
+    run_type_benchmarks<be_uint64_t>("be_uint64_t", buffer_size);
+    run_type_benchmarks<be_double>("be_double", buffer_size);
+  }
+
+  return 0;
+}
@@ -1,5 +1,6 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "Encoding.hh"
 #include "UnitTest.hh"
@@ -146,6 +147,65 @@ int main(int, char**) {
 
   expect_eq("The brick quown jox fumps over the dazy log", rot13("Gur oevpx dhbja wbk shzcf bire gur qnml ybt", 43));
 
+  // The bulk bswap functions should give the same results as the scalar ones
+  // for all sizes (so both the vectorized loop and the leftover values are
+  // tested), for unaligned pointers, and when converting in place
+  {
+    uint8_t src[257];
+    for (size_t z = 0; z < sizeof(src); z++) {
+      src[z] = z * 7 + 3;
+    }
+    for (size_t count = 0; count <= 31; count++) {
+      uint8_t dest[257];
+      bswap16_array(dest + 1, src + 1, count);
+      bswap32_array(dest + 65, src + 65, count / 2);
+      bswap64_array(dest + 129, src + 129, count / 4);
+      for (size_t z = 0; z < count; z++) {
+        uint16_t v, r;
+        memcpy(&v, src + 1 + z * 2, 2);
+        memcpy(&r, dest + 1 + z * 2, 2);
+        expect_eq(bswap16(v), r);
+      }
+      for (size_t z = 0; z < count / 2; z++) {
+        uint32_t v, r;
+        memcpy(&v, src + 65 + z * 4, 4);
+        memcpy(&r, dest + 65 + z * 4, 4);
+        expect_eq(bswap32(v), r);
+      }
+      for (size_t z = 0; z < count / 4; z++) {
+        uint64_t v, r;
+        memcpy(&v, src + 129 + z * 8, 8);
+        memcpy(&r, dest + 129 + z * 8, 8);
+        expect_eq(bswap64(v), r);
+      }
+    }
+
+    uint32_t values[40];
+    for (size_t z = 0; z < 40; z++) {
+      values[z] = 0x01020304 * z;
+    }
+    bswap32_array(values, values, 40);
+    expect_eq(values[39], bswap32(0x01020304 * 39));
+    bswap32_array(values, values, 40);
+    expect_eq(values[39], 0x01020304 * 39);
+
+    double doubles[20];
+    uint8_t encoded[sizeof(doubles)];
+    for (size_t z = 0; z < 20; z++) {
+      doubles[z] = z * 1.5;
+    }
+    store_be_array<double>(encoded, doubles, 20);
+    expect_eq(encoded[8], 0x3F);
+    expect_eq(encoded[9], 0xF8);
+    double decoded[20];
+    load_be_array<double>(decoded, encoded, 20);
+    expect_eq(memcmp(decoded, doubles, sizeof(doubles)), 0);
+    store_le_array<double>(encoded, doubles, 20);
+    expect_eq(encoded[15], 0x3F);
+    load_le_array<double>(decoded, encoded, 20);
+    expect_eq(memcmp(decoded, doubles, sizeof(doubles)), 0);
+  }
+
   fwrite_fmt(stdout, "EncodingTest: all tests passed\n");
   return 0;
 }
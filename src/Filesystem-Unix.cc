@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -352,4 +353,62 @@ unordered_map<int, short> Poll::poll(int timeout_ms) {
   return ret;
 }
 
+MappedFile::MappedFile(const string& filename, Access access)
+    : MappedFile(scoped_fd(filename, O_RDONLY), access) {}
+
+MappedFile::MappedFile(int fd, Access access) : addr(nullptr), length(fstat(fd).st_size) {
+  // mmap fails for zero-length mappings, so empty files aren't mapped at all
+  if (this->length == 0) {
+    return;
+  }
+  this->addr = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (this->addr == MAP_FAILED) {
+    this->addr = nullptr;
+    throw io_error(fd);
+  }
+  if (access != Access::NORMAL) {
+    this->advise(access);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (this->addr) {
+    munmap(this->addr, this->length);
+  }
+}
+
+void MappedFile::advise(Access access, size_t offset, size_t size) const {
+  switch (access) {
+    case Access::NORMAL:
+      this->madvise(MADV_NORMAL, offset, size);
+      break;
+    case Access::SEQUENTIAL:
+      this->madvise(MADV_SEQUENTIAL, offset, size);
+      break;
+    case Access::RANDOM:
+      this->madvise(MADV_RANDOM, offset, size);
+      break;
+    default:
+      throw invalid_argument("invalid access type");
+  }
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const {
+  this->madvise(MADV_WILLNEED, offset, size);
+}
+
+void MappedFile::madvise(int advice, size_t offset, size_t size) const {
+  if (offset >= this->length) {
+    return;
+  }
+  size = min<size_t>(size, this->length - offset);
+
+  // madvise requires a page-aligned address, so extend the range backward to
+  // the beginning of the page
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t aligned_offset = offset & ~(page_size - 1);
+  // The hints are only advisory, so we ignore failures
+  ::madvise(reinterpret_cast<uint8_t*>(this->addr) + aligned_offset, size + (offset - aligned_offset), advice);
+}
+
 } // namespace phosg
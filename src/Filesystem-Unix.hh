@@ -103,4 +103,46 @@ private:
   std::vector<struct pollfd> poll_fds;
 };
 
+// A read-only memory mapping of an entire file. The mapping remains valid if
+// the file descriptor is closed; it's unmapped when the MappedFile is
+// destroyed. To read the mapped data without copying it, construct a
+// StringReader from a shared_ptr to a MappedFile; the reader (and all
+// sub-readers created from it) keep the mapping alive.
+class MappedFile {
+public:
+  // These correspond to the madvise hints
+  enum class Access {
+    NORMAL = 0,
+    SEQUENTIAL, // Pages will be read mostly in order; read ahead aggressively
+    RANDOM, // Pages will be read in no particular order; don't read ahead
+  };
+
+  explicit MappedFile(const std::string& filename, Access access = Access::NORMAL);
+  explicit MappedFile(int fd, Access access = Access::NORMAL);
+  MappedFile(const MappedFile&) = delete;
+  MappedFile(MappedFile&&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile& operator=(MappedFile&&) = delete;
+  ~MappedFile();
+
+  inline const void* data() const {
+    return this->addr;
+  }
+  inline size_t size() const {
+    return this->length;
+  }
+
+  // Changes the access hint for part of the mapping (by default, all of it)
+  void advise(Access access, size_t offset = 0, size_t size = SIZE_MAX) const;
+  // Asks the kernel to start reading part of the file into memory, so later
+  // accesses to that range won't block
+  void prefetch(size_t offset, size_t size) const;
+
+private:
+  void* addr;
+  size_t length;
+
+  void madvise(int advice, size_t offset, size_t size) const;
+};
+
 } // namespace phosg
@@ -1,5 +1,9 @@
+#include <string.h>
 #include <unistd.h>
 
+#include <memory>
+#include <string>
+
 #include "Filesystem.hh"
 #include "Platform.hh"
 #include "Strings.hh"
@@ -72,6 +76,55 @@ int main(int, char**) {
   }
 #endif
 
+#ifndef PHOSG_WINDOWS
+  {
+    fwrite_fmt(stderr, "-- MappedFile\n");
+    string filename("FilesystemTest-mapped-data");
+    string data;
+    for (size_t z = 0; z < 0x3000; z++) {
+      data.push_back(z * 7);
+    }
+    save_file(filename, data);
+
+    StringReader sub;
+    {
+      auto file = make_shared<MappedFile>(filename, MappedFile::Access::SEQUENTIAL);
+      // The mapping remains valid after the file is deleted
+      remove(filename.c_str());
+      expect_eq(file->size(), data.size());
+      expect_eq(memcmp(file->data(), data.data(), data.size()), 0);
+      file->advise(MappedFile::Access::RANDOM, 0x1234, 0x100);
+      file->prefetch(0x2000, 0x10000);
+
+      StringReader r(file);
+      expect_eq(r.size(), data.size());
+      expect_eq(r.peek(0), file->data());
+      expect_eq(r.pget_u32b(0x1000), 0x00070E15);
+      r.go(0x2FFF);
+      expect_eq(r.get_u8(), static_cast<uint8_t>(0x2FFF * 7));
+      expect(r.eof());
+
+      // Sub-readers keep the mapping alive
+      sub = r.sub(0x2FF0);
+      expect_eq(file.use_count(), 3);
+    }
+    expect_eq(sub.size(), 0x10);
+    expect_eq(sub.all(), data.substr(0x2FF0));
+
+    save_file(filename, "");
+    {
+      auto file = make_shared<MappedFile>(filename);
+      remove(filename.c_str());
+      expect_eq(file->size(), 0);
+      StringReader r(file);
+      expect(r.eof());
+    }
+    expect_raises(cannot_open_file, [&]() {
+      MappedFile file(filename);
+    });
+  }
+#endif
+
   // TODO: test get_user_home_directory
 
   fwrite_fmt(stdout, "FilesystemTest: all tests passed\n");
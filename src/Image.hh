@@ -10,6 +10,7 @@
 #include <functional>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "Encoding.hh"
 #include "ImageTextFont.hh"
@@ -868,24 +869,27 @@ public:
       ret.owned_data = Image::make_owned_data(ret.w, ret.h);
       ret.data = ret.owned_data.get();
 
+      // Bounds are checked once per row rather than once per byte
+      size_t bytes_per_pixel = ((format == ImageFormat::GRAYSCALE_PPM) ? 1 : 3) + (file_has_alpha ? 1 : 0);
       for (size_t y = 0; y < ret.h; y++) {
+        auto row = r.get_span(ret.w * bytes_per_pixel);
         for (size_t x = 0; x < ret.w; x++) {
           if (format == ImageFormat::GRAYSCALE_PPM) {
             if (!file_has_alpha) {
-              uint8_t v = r.get_u8();
+              uint8_t v = row.get_u8();
               ret.write(x, y, rgba8888(v, v, v, 0xFF));
             } else {
-              uint8_t v = r.get_u8();
-              uint8_t a = r.get_u8();
+              uint8_t v = row.get_u8();
+              uint8_t a = row.get_u8();
               ret.write(x, y, rgba8888(v, v, v, a));
             }
           } else if (!file_has_alpha) {
-            uint8_t r_v = r.get_u8();
-            uint8_t g_v = r.get_u8();
-            uint8_t b_v = r.get_u8();
+            uint8_t r_v = row.get_u8();
+            uint8_t g_v = row.get_u8();
+            uint8_t b_v = row.get_u8();
             ret.write(x, y, rgba8888(r_v, g_v, b_v, 0xFF));
           } else {
-            ret.write(x, y, r.get_u32b());
+            ret.write(x, y, row.get_u32b());
           }
         }
       }
@@ -927,10 +931,11 @@ public:
 
         for (ssize_t y = static_cast<ssize_t>(ret.h) - 1; y >= 0; y--) {
           ssize_t target_y = reverse_row_order ? (ret.h - y - 1) : y;
+          auto row = r.get_span(ret.w * 3);
           for (size_t x = 0; x < ret.w; x++) {
-            uint8_t b_v = r.get_u8();
-            uint8_t g_v = r.get_u8();
-            uint8_t r_v = r.get_u8();
+            uint8_t b_v = row.get_u8();
+            uint8_t g_v = row.get_u8();
+            uint8_t r_v = row.get_u8();
             ret.write(x, target_y, rgba8888(r_v, g_v, b_v, 0xFF));
           }
           r.skip(row_padding_bytes);
@@ -954,10 +959,12 @@ public:
           throw std::runtime_error("channel bit field is not 1-byte mask");
         }
 
+        std::vector<uint32_t> row(ret.w);
         for (ssize_t y = static_cast<ssize_t>(ret.h) - 1; y >= 0; y--) {
           ssize_t target_y = reverse_row_order ? (ret.h - y - 1) : y;
+          r.read_array<le_uint32_t>(row.data(), ret.w);
           for (size_t x = 0; x < ret.w; x++) {
-            uint32_t color = r.get_u32l();
+            uint32_t color = row[x];
             uint8_t r_v = (color >> r_offset) & 0xFF;
             uint8_t g_v = (color >> g_offset) & 0xFF;
             uint8_t b_v = (color >> b_offset) & 0xFF;
@@ -100,6 +100,9 @@ void test_pixel_format(const char* format_name) {
     if (format != ImageFormat::PNG) {
       fwrite_fmt(stderr, "-- [Image:{}/{}] parse\n", format_name, ext);
       expect_eq(Image<Format>::from_file_data(serialized), img);
+      expect_raises(out_of_range, [&]() {
+        Image<Format>::from_file_data(serialized.substr(0, serialized.size() - 1));
+      });
     }
 
     string reference_filename = std::format("reference/ImageTestReference.{}.{}", format_name, ext);
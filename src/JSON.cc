@@ -4,11 +4,22 @@
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
 #include <format>
+#include <limits>
 #include <map>
+#include <mutex>
+#include <thread>
 
 #include "Filesystem.hh"
 #include "Strings.hh"
+#include "Tools.hh"
 
 using namespace std;
 
@@ -36,7 +47,236 @@ static void skip_whitespace_and_comments(StringReader& r, bool disable_extension
   }
 }
 
-JSON JSON::parse(StringReader& r, bool disable_extensions) {
+// The scalar parsing functions below operate on raw buffers so they can be
+// shared between the StringReader-based parser and the indexed parser. Each
+// takes the offset of the first character of the value, and on return the
+// offset points to the character immediately following the value.
+
+static inline char json_char_at(const char* data, size_t size, size_t offset) {
+  if (offset >= size) {
+    throw out_of_range("end of string");
+  }
+  return data[offset];
+}
+
+static string parse_json_string_value(const char* data, size_t size, size_t& offset) {
+  offset++; // Skip the opening quote
+
+  string ret;
+  for (;;) {
+    // Copy runs of unescaped characters all at once
+    size_t run_start = offset;
+    while ((offset < size) && (data[offset] != '\"') && (data[offset] != '\\')) {
+      offset++;
+    }
+    ret.append(data + run_start, offset - run_start);
+
+    char ch = json_char_at(data, size, offset++);
+    if (ch == '\"') {
+      return ret;
+    }
+
+    // ch must be a backslash here
+    ch = json_char_at(data, size, offset++);
+    if (ch == '\"') {
+      ret.push_back('\"');
+    } else if (ch == '\\') {
+      ret.push_back('\\');
+    } else if (ch == '/') {
+      ret.push_back('/');
+    } else if (ch == 'b') {
+      ret.push_back('\b');
+    } else if (ch == 'f') {
+      ret.push_back('\f');
+    } else if (ch == 'n') {
+      ret.push_back('\n');
+    } else if (ch == 'r') {
+      ret.push_back('\r');
+    } else if (ch == 't') {
+      ret.push_back('\t');
+    } else if (ch == 'x') {
+      uint8_t value;
+      try {
+        value = value_for_hex_char(json_char_at(data, size, offset++)) << 4;
+        value |= value_for_hex_char(json_char_at(data, size, offset++));
+      } catch (const out_of_range&) {
+        throw JSON::parse_error("incomplete hex escape sequence in string; pos=" + to_string(offset));
+      }
+      ret.push_back(value);
+    } else if (ch == 'u') {
+      uint16_t value;
+      try {
+        value = value_for_hex_char(json_char_at(data, size, offset++)) << 12;
+        value |= value_for_hex_char(json_char_at(data, size, offset++)) << 8;
+        value |= value_for_hex_char(json_char_at(data, size, offset++)) << 4;
+        value |= value_for_hex_char(json_char_at(data, size, offset++));
+      } catch (const out_of_range&) {
+        throw JSON::parse_error("incomplete unicode escape sequence in string; pos=" + to_string(offset));
+      }
+      // TODO: we should eventually be able to support this
+      if (value & 0xFF00) {
+        throw JSON::parse_error("non-ascii unicode character sequence in string; pos=" + to_string(offset));
+      }
+      ret.push_back(value);
+    } else {
+      throw JSON::parse_error("invalid escape sequence in string; pos=" + to_string(offset));
+    }
+  }
+}
+
+// If the string beginning at offset contains no escape sequences, sets ret to
+// its contents and returns true. Otherwise, returns false.
+static bool get_json_unescaped_string_contents(string_view& ret, const char* data, size_t size, size_t offset) {
+  size_t start_offset = offset + 1;
+  for (offset = start_offset; offset < size; offset++) {
+    if (data[offset] == '\"') {
+      ret = string_view(data + start_offset, offset - start_offset);
+      return true;
+    } else if (data[offset] == '\\') {
+      return false;
+    }
+  }
+  throw out_of_range("end of string");
+}
+
+// Decimal numbers are parsed with std::from_chars, which is exact (it returns
+// the closest double to the decimal value) and much faster than strtod, since
+// it doesn't depend on the locale or require a null-terminated input. Numbers
+// with a fractional part or an exponent are floats; integers that don't fit in
+// an int64_t are also parsed as floats.
+static JSON parse_json_number_value(const char* data, size_t size, size_t& offset, bool disable_extensions) {
+  size_t start_offset = offset;
+  bool negative = false;
+  if (data[offset] == '-') {
+    negative = true;
+    offset++;
+  }
+
+  if (!disable_extensions &&
+      ((offset + 2) < size) &&
+      (data[offset] == '0') &&
+      (data[offset + 1] == 'x')) { // hex
+    offset += 2;
+
+    int64_t int_data = 0;
+    while ((offset < size) && isxdigit(data[offset])) {
+      int_data = (int_data << 4) | value_for_hex_char(data[offset++]);
+    }
+    return negative ? -int_data : int_data;
+  }
+
+  // Find the end of the number first, so we can tell whether it's an int or a
+  // float before converting it
+  bool is_int = true;
+  bool negative_exponent = false;
+  while ((offset < size) && isdigit(data[offset])) {
+    offset++;
+  }
+  if ((offset < size) && (data[offset] == '.')) {
+    is_int = false;
+    offset++;
+    while ((offset < size) && isdigit(data[offset])) {
+      offset++;
+    }
+  }
+  char exp_specifier = (offset < size) ? data[offset] : '\0';
+  if (exp_specifier == 'e' || exp_specifier == 'E') {
+    is_int = false;
+    offset++;
+    char sign_char = json_char_at(data, size, offset);
+    negative_exponent = (sign_char == '-');
+    if (sign_char == '-' || sign_char == '+') {
+      offset++;
+    }
+    while ((offset < size) && isdigit(data[offset])) {
+      offset++;
+    }
+  }
+
+  const char* begin = data + start_offset;
+  const char* end = data + offset;
+  if (is_int) {
+    int64_t int_data = 0;
+    auto res = from_chars(begin, end, int_data);
+    if (res.ec != errc::result_out_of_range) {
+      // If there were no digits at all (e.g. "-"), the value is zero
+      return int_data;
+    }
+  }
+
+  double float_data = 0.0;
+  auto res = from_chars(begin, end, float_data);
+  if (res.ec == errc::result_out_of_range) {
+    // from_chars doesn't modify the value if the result is out of range, but
+    // we want the same result that strtod would produce
+    float_data = negative_exponent ? 0.0 : numeric_limits<double>::infinity();
+    return negative ? -float_data : float_data;
+  } else if (res.ec != errc()) {
+    // There are no digits before the exponent (e.g. "-.e5")
+    return negative ? -0.0 : 0.0;
+  }
+  return float_data;
+}
+
+static inline bool skip_json_literal(
+    const char* data, size_t size, size_t& offset, const char* literal, size_t literal_size) {
+  if ((size - offset >= literal_size) && !memcmp(data + offset, literal, literal_size)) {
+    offset += literal_size;
+    return true;
+  }
+  return false;
+}
+
+// Parses null, true, or false (or their single-character abbreviations, if
+// extensions are enabled). Returns false if the data at offset isn't any of
+// these.
+static bool parse_json_constant_value(
+    JSON& ret, const char* data, size_t size, size_t& offset, bool disable_extensions) {
+  if (skip_json_literal(data, size, offset, "null", 4) ||
+      (!disable_extensions && skip_json_literal(data, size, offset, "n", 1))) {
+    ret = nullptr;
+  } else if (skip_json_literal(data, size, offset, "true", 4) ||
+      (!disable_extensions && skip_json_literal(data, size, offset, "t", 1))) {
+    ret = true;
+  } else if (skip_json_literal(data, size, offset, "false", 5) ||
+      (!disable_extensions && skip_json_literal(data, size, offset, "f", 1))) {
+    ret = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// The parsers use this to construct dict keys. With flat dicts, keys are
+// interned, so equal keys within the same parsed document share storage;
+// otherwise, this just moves the parsed key into the dict.
+class JSONDictKeyTable {
+public:
+#ifdef PHOSG_JSON_FLAT_DICT
+  inline JSON::dict_key_type get(string&& key) {
+    return this->table.get(std::move(key));
+  }
+  inline JSON::dict_key_type get(string_view key) {
+    return this->table.get(key);
+  }
+  inline void clear() {
+    this->table.clear();
+  }
+
+private:
+  SharedStringTable table;
+#else
+  inline JSON::dict_key_type get(string&& key) {
+    return std::move(key);
+  }
+  inline JSON::dict_key_type get(string_view key) {
+    return string(key);
+  }
+  inline void clear() {}
+#endif
+};
+
+static JSON parse_json_value(StringReader& r, bool disable_extensions, JSONDictKeyTable& keys) {
   skip_whitespace_and_comments(r, disable_extensions);
 
   JSON ret;
@@ -47,25 +287,27 @@ JSON JSON::parse(StringReader& r, bool disable_extensions) {
     char separator = r.get_s8();
     while (separator != '}') {
       if (separator != expected_separator) {
-        throw parse_error("string is not a dictionary; pos=" + to_string(r.where()));
+        throw JSON::parse_error("string is not a dictionary; pos=" + to_string(r.where()));
       }
-      expected_separator = ',';
 
+      // A closing brace is always allowed immediately after the opening brace
+      // (the dict is empty), and after a trailing comma if extensions are on
       skip_whitespace_and_comments(r, disable_extensions);
-      if (!disable_extensions && (r.get_s8(false) == '}')) {
+      if (((separator == '{') || !disable_extensions) && (r.get_s8(false) == '}')) {
         r.get_s8();
         break;
       }
+      expected_separator = ',';
 
-      JSON key = JSON::parse(r, disable_extensions);
+      JSON key = parse_json_value(r, disable_extensions, keys);
       skip_whitespace_and_comments(r, disable_extensions);
 
       if (r.get_s8() != ':') {
-        throw parse_error("dictionary does not contain key/value pairs; pos=" + to_string(r.where()));
+        throw JSON::parse_error("dictionary does not contain key/value pairs; pos=" + to_string(r.where()));
       }
       skip_whitespace_and_comments(r, disable_extensions);
 
-      ret.emplace(std::move(key.as_string()), JSON::parse(r, disable_extensions));
+      ret.as_dict().emplace(keys.get(std::move(key.as_string())), new JSON(parse_json_value(r, disable_extensions, keys)));
       skip_whitespace_and_comments(r, disable_extensions);
       separator = r.get_s8();
     }
@@ -76,174 +318,42 @@ JSON JSON::parse(StringReader& r, bool disable_extensions) {
     char separator = r.get_s8();
     while (separator != ']') {
       if (separator != expected_separator) {
-        throw parse_error("string is not a list; pos=" + to_string(r.where()));
+        throw JSON::parse_error("string is not a list; pos=" + to_string(r.where()));
       }
-      expected_separator = ',';
 
       skip_whitespace_and_comments(r, disable_extensions);
-      if (!disable_extensions && (r.get_s8(false) == ']')) {
+      if (((separator == '[') || !disable_extensions) && (r.get_s8(false) == ']')) {
         r.get_s8();
         break;
       }
+      expected_separator = ',';
 
-      ret.emplace_back(JSON::parse(r, disable_extensions));
+      ret.emplace_back(parse_json_value(r, disable_extensions, keys));
       skip_whitespace_and_comments(r, disable_extensions);
       separator = r.get_s8();
     }
 
-  } else if (root_type_ch == '-' || root_type_ch == '+' || isdigit(root_type_ch)) {
-    int64_t int_data;
-    double float_data;
-    bool is_int = true;
-
-    bool negative = false;
-    if (root_type_ch == '-') {
-      negative = true;
-      r.get_s8();
-    }
-
-    if (!disable_extensions &&
-        ((r.where() + 2) < r.size()) &&
-        (r.get_s8(false) == '0') &&
-        (r.pget_s8(r.where() + 1) == 'x')) { // hex
-      r.go(r.where() + 2);
-
-      int_data = 0;
-      while (!r.eof() && isxdigit(r.get_s8(false))) {
-        int_data = (int_data << 4) | value_for_hex_char(r.get_s8());
-      }
-
-    } else { // decimal
-      int_data = 0;
-      while (!r.eof() && isdigit(r.get_s8(false))) {
-        int_data = int_data * 10 + (r.get_s8() - '0');
-      }
-
-      double this_place = 0.1;
-      float_data = int_data;
-      if (!r.eof() && r.get_s8(false) == '.') {
-        is_int = false;
-        r.get_s8();
-        while (!r.eof() && isdigit(r.get_s8(false))) {
-          float_data += (r.get_s8() - '0') * this_place;
-          this_place *= 0.1;
-        }
-      }
-
-      char exp_specifier = r.eof() ? '\0' : r.get_s8(false);
-      if (exp_specifier == 'e' || exp_specifier == 'E') {
-        r.get_s8();
-        char sign_char = r.get_s8(false);
-        bool e_negative = sign_char == '-';
-        if (sign_char == '-' || sign_char == '+') {
-          r.get_s8();
-        }
-
-        int e = 0;
-        while (!r.eof() && isdigit(r.get_s8(false))) {
-          e = e * 10 + (r.get_s8() - '0');
-        }
-
-        if (e_negative) {
-          for (; e > 0; e--) {
-            int_data *= 0.1;
-            float_data *= 0.1;
-          }
-        } else {
-          for (; e > 0; e--) {
-            int_data *= 10;
-            float_data *= 10;
-          }
-        }
-      }
-    }
-
-    if (negative) {
-      int_data = -int_data;
-      float_data = -float_data;
-    }
-
-    if (is_int) {
-      ret = int_data;
-    } else {
-      ret = float_data;
-    }
-
-  } else if (root_type_ch == '\"') {
-    r.get_s8();
-
-    string data;
-    while (r.get_s8(false) != '\"') {
-      char ch = r.get_s8();
-      if (ch == '\\') {
-        ch = r.get_s8();
-        if (ch == '\"') {
-          data.push_back('\"');
-        } else if (ch == '\\') {
-          data.push_back('\\');
-        } else if (ch == '/') {
-          data.push_back('/');
-        } else if (ch == 'b') {
-          data.push_back('\b');
-        } else if (ch == 'f') {
-          data.push_back('\f');
-        } else if (ch == 'n') {
-          data.push_back('\n');
-        } else if (ch == 'r') {
-          data.push_back('\r');
-        } else if (ch == 't') {
-          data.push_back('\t');
-        } else if (ch == 'x') {
-          uint8_t value;
-          try {
-            value = value_for_hex_char(r.get_s8()) << 4;
-            value |= value_for_hex_char(r.get_s8());
-          } catch (const out_of_range&) {
-            throw parse_error("incomplete hex escape sequence in string; pos=" + to_string(r.where()));
-          }
-          data.push_back(value);
-        } else if (ch == 'u') {
-          uint16_t value;
-          try {
-            value = value_for_hex_char(r.get_s8()) << 12;
-            value |= value_for_hex_char(r.get_s8()) << 8;
-            value |= value_for_hex_char(r.get_s8()) << 4;
-            value |= value_for_hex_char(r.get_s8());
-          } catch (const out_of_range&) {
-            throw parse_error("incomplete unicode escape sequence in string; pos=" + to_string(r.where()));
-          }
-          // TODO: we should eventually be able to support this
-          if (value & 0xFF00) {
-            throw parse_error("non-ascii unicode character sequence in string; pos=" + to_string(r.where()));
-          }
-          data.push_back(value);
-        } else {
-          throw parse_error("invalid escape sequence in string; pos=" + to_string(r.where()));
-        }
-      } else { // not an escape sequence
-        data.push_back(ch);
-      }
-    }
-    r.get_s8();
-
-    ret = std::move(data);
-
-  } else if (r.skip_if("null", 4) || (!disable_extensions && r.skip_if("n", 1))) {
-    ret = nullptr;
-
-  } else if (r.skip_if("true", 4) || (!disable_extensions && r.skip_if("t", 1))) {
-    ret = true;
-
-  } else if (r.skip_if("false", 5) || (!disable_extensions && r.skip_if("f", 1))) {
-    ret = false;
-
   } else {
-    throw parse_error("unknown root sentinel; pos=" + to_string(r.where()));
+    const char* data = reinterpret_cast<const char*>(r.pgetv(0, r.size()));
+    size_t offset = r.where();
+    if (root_type_ch == '-' || root_type_ch == '+' || isdigit(root_type_ch)) {
+      ret = parse_json_number_value(data, r.size(), offset, disable_extensions);
+    } else if (root_type_ch == '\"') {
+      ret = parse_json_string_value(data, r.size(), offset);
+    } else if (!parse_json_constant_value(ret, data, r.size(), offset, disable_extensions)) {
+      throw JSON::parse_error("unknown root sentinel; pos=" + to_string(r.where()));
+    }
+    r.go(offset);
   }
 
   return ret;
 }
 
+JSON JSON::parse(StringReader& r, bool disable_extensions) {
+  JSONDictKeyTable keys;
+  return parse_json_value(r, disable_extensions, keys);
+}
+
 JSON JSON::parse(const char* s, size_t size, bool disable_extensions) {
   StringReader r(s, size);
   auto ret = JSON::parse(r, disable_extensions);
@@ -258,214 +368,1558 @@ JSON JSON::parse(const string& s, bool disable_extensions) {
   return JSON::parse(s.data(), s.size(), disable_extensions);
 }
 
-string JSON::escape_string(const string& s, StringEscapeMode mode) {
-  string ret;
-  for (auto ch : s) {
+// The fast parser works in two stages. First, it builds an index of the
+// offsets of all structural characters ({}[]:,) outside of strings, the
+// opening quote of each string, and the first character of each other scalar
+// value. Most of the work in this stage can be done 64 bytes at a time with
+// SIMD instructions. Then, it walks the index to build the JSON objects, which
+// avoids scanning over whitespace and string contents byte-by-byte.
+
+static inline bool is_json_whitespace(char ch) {
+  return (ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\n');
+}
+
+static inline bool is_json_structural(char ch) {
+  return (ch == '{') || (ch == '}') || (ch == '[') || (ch == ']') || (ch == ':') || (ch == ',');
+}
+
+// This version of the indexer is used when SIMD instructions aren't available,
+// and when the input contains comments (which are rare enough that there's no
+// need to handle them in the SIMD version)
+static void build_json_structural_index_sequential(
+    vector<uint32_t>& index, const char* data, size_t size, bool disable_extensions) {
+  index.clear();
+  bool prev_scalar = false;
+  size_t offset = 0;
+  while (offset < size) {
+    char ch = data[offset];
     if (ch == '\"') {
-      ret += "\\\"";
-    } else if (ch == '\\') {
-      ret += "\\\\";
-    } else if (ch == '\b') {
-      ret += "\\b";
-    } else if (ch == '\f') {
-      ret += "\\f";
-    } else if (ch == '\n') {
-      ret += "\\n";
-    } else if (ch == '\r') {
-      ret += "\\r";
-    } else if (ch == '\t') {
-      ret += "\\t";
-    } else if (static_cast<uint8_t>(ch) < 0x20) {
-      if (mode != StringEscapeMode::STANDARD) {
-        ret += std::format("\\x{:02X}", ch);
-      } else {
-        ret += std::format("\\u{:04X}", ch);
+      index.emplace_back(offset);
+      for (offset++; (offset < size) && (data[offset] != '\"'); offset++) {
+        if (data[offset] == '\\') {
+          offset++;
+        }
       }
-    } else if (static_cast<uint8_t>(ch) > 0x7E) {
-      if (mode == StringEscapeMode::CONTROL_ONLY) {
-        ret += ch;
-      } else if (mode == StringEscapeMode::HEX) {
-        ret += std::format("\\x{:02X}", ch);
-      } else {
-        ret += std::format("\\u{:04X}", ch);
+      offset++;
+      prev_scalar = false;
+    } else if (!disable_extensions && (ch == '/') && (offset + 1 < size) && (data[offset + 1] == '/')) {
+      for (offset += 2; (offset < size) && (data[offset] != '\n') && (data[offset] != '\r'); offset++) {
       }
+      prev_scalar = false;
+    } else if (is_json_structural(ch)) {
+      index.emplace_back(offset++);
+      prev_scalar = false;
+    } else if (is_json_whitespace(ch)) {
+      offset++;
+      prev_scalar = false;
     } else {
-      ret += ch;
+      if (!prev_scalar) {
+        index.emplace_back(offset);
+      }
+      offset++;
+      prev_scalar = true;
     }
   }
-  return ret;
 }
 
-string JSON::serialize(uint32_t options, size_t indent_level) const {
-  StringEscapeMode escape_mode;
-  if (options & SerializeOption::ESCAPE_CONTROLS_ONLY) {
-    escape_mode = StringEscapeMode::CONTROL_ONLY;
-  } else if (options & SerializeOption::HEX_ESCAPE_CODES) {
-    escape_mode = StringEscapeMode::HEX;
-  } else {
-    escape_mode = StringEscapeMode::STANDARD;
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#define PHOSG_JSON_SIMD_INDEXER
+
+#if defined(__AVX2__)
+typedef __m256i json_simd_chunk_t;
+static constexpr size_t JSON_SIMD_CHUNK_SIZE = 32;
+static inline json_simd_chunk_t json_simd_load(const char* data) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+}
+static inline json_simd_chunk_t json_simd_eq(json_simd_chunk_t v, char ch) {
+  return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(ch));
+}
+static inline json_simd_chunk_t json_simd_or(json_simd_chunk_t a, json_simd_chunk_t b) {
+  return _mm256_or_si256(a, b);
+}
+static inline uint64_t json_simd_mask(json_simd_chunk_t v) {
+  return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+}
+#else
+typedef __m128i json_simd_chunk_t;
+static constexpr size_t JSON_SIMD_CHUNK_SIZE = 16;
+static inline json_simd_chunk_t json_simd_load(const char* data) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+}
+static inline json_simd_chunk_t json_simd_eq(json_simd_chunk_t v, char ch) {
+  return _mm_cmpeq_epi8(v, _mm_set1_epi8(ch));
+}
+static inline json_simd_chunk_t json_simd_or(json_simd_chunk_t a, json_simd_chunk_t b) {
+  return _mm_or_si128(a, b);
+}
+static inline uint64_t json_simd_mask(json_simd_chunk_t v) {
+  return static_cast<uint16_t>(_mm_movemask_epi8(v));
+}
+#endif
+
+struct JSONBlockMasks {
+  uint64_t quote = 0;
+  uint64_t backslash = 0;
+  uint64_t slash = 0;
+  uint64_t whitespace = 0;
+  uint64_t structural = 0;
+};
+
+// Each bit in the returned masks corresponds to one byte of the 64-byte block
+static inline JSONBlockMasks compute_json_block_masks(const char* block) {
+  JSONBlockMasks ret;
+  for (size_t z = 0; z < 64; z += JSON_SIMD_CHUNK_SIZE) {
+    json_simd_chunk_t v = json_simd_load(block + z);
+    ret.quote |= json_simd_mask(json_simd_eq(v, '\"')) << z;
+    ret.backslash |= json_simd_mask(json_simd_eq(v, '\\')) << z;
+    ret.slash |= json_simd_mask(json_simd_eq(v, '/')) << z;
+    ret.whitespace |= json_simd_mask(json_simd_or(
+                          json_simd_or(json_simd_eq(v, ' '), json_simd_eq(v, '\t')),
+                          json_simd_or(json_simd_eq(v, '\r'), json_simd_eq(v, '\n'))))
+        << z;
+    ret.structural |= json_simd_mask(json_simd_or(
+                          json_simd_or(
+                              json_simd_or(json_simd_eq(v, '{'), json_simd_eq(v, '}')),
+                              json_simd_or(json_simd_eq(v, '['), json_simd_eq(v, ']'))),
+                          json_simd_or(json_simd_eq(v, ':'), json_simd_eq(v, ','))))
+        << z;
   }
+  return ret;
+}
 
-  size_t type_index = this->value.index();
-  switch (type_index) {
-    case 0: // nullptr_t
-      return (options & SerializeOption::ONE_CHARACTER_TRIVIAL_CONSTANTS) ? "n" : "null";
+// Returns a mask in which each bit is the XOR of all bits at or below the same
+// position in the input (so each bit between an opening quote and the next
+// closing quote is set)
+static inline uint64_t prefix_xor(uint64_t v) {
+  v ^= v << 1;
+  v ^= v << 2;
+  v ^= v << 4;
+  v ^= v << 8;
+  v ^= v << 16;
+  v ^= v << 32;
+  return v;
+}
 
-    case 1: // bool
-      if (options & SerializeOption::ONE_CHARACTER_TRIVIAL_CONSTANTS) {
-        return this->as_bool() ? "t" : "f";
-      } else {
-        return this->as_bool() ? "true" : "false";
-      }
+#endif
 
-    case 2: { // int64_t
-      int64_t v = this->as_int();
-      if (options & SerializeOption::HEX_INTEGERS) {
-        return v < 0 ? std::format("-0x{:X}", -v) : std::format("0x{:X}", v);
-      } else {
-        return to_string(this->as_int());
+static void build_json_structural_index(
+    vector<uint32_t>& index, const char* data, size_t size, bool disable_extensions) {
+#ifdef PHOSG_JSON_SIMD_INDEXER
+  index.clear();
+
+  // State carried over between blocks
+  uint64_t prev_escaped = 0; // 1 if the first byte of the block is escaped
+  uint64_t prev_in_string = 0; // All 1s if the previous block ended in a string
+  uint64_t prev_scalar = 0; // 1 if the previous block ended in a scalar
+
+  char padded_block[64];
+  for (size_t block_offset = 0; block_offset < size; block_offset += 64) {
+    const char* block;
+    if (size - block_offset >= 64) {
+      block = data + block_offset;
+    } else {
+      memset(padded_block, ' ', sizeof(padded_block));
+      memcpy(padded_block, data + block_offset, size - block_offset);
+      block = padded_block;
+    }
+    JSONBlockMasks masks = compute_json_block_masks(block);
+
+    // Find all escaped characters. Runs of backslashes are uncommon, so we
+    // just handle them one at a time.
+    uint64_t escaped = prev_escaped;
+    uint64_t backslash = masks.backslash & ~prev_escaped;
+    prev_escaped = 0;
+    while (backslash) {
+      int bit = countr_zero(backslash);
+      if (bit == 63) {
+        prev_escaped = 1;
+        break;
       }
+      escaped |= 2ULL << bit;
+      backslash &= ~(3ULL << bit);
     }
 
-    case 3: { // double
-      string ret = std::format("{:.17g}", this->as_float());
-      if (ret.find('.') == string::npos) {
-        ret += ".0";
-      }
-      return ret;
+    uint64_t quotes = masks.quote & ~escaped;
+    uint64_t in_string = prefix_xor(quotes) ^ prev_in_string;
+    prev_in_string = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+
+    // If there are any comments, start over with the sequential indexer
+    if (!disable_extensions && (masks.slash & ~in_string)) {
+      build_json_structural_index_sequential(index, data, size, disable_extensions);
+      return;
     }
 
-    case 4: // string
-      return "\"" + JSON::escape_string(this->as_string(), escape_mode) + "\"";
+    uint64_t scalar = ~(masks.whitespace | masks.structural | quotes | in_string);
+    uint64_t scalar_starts = scalar & ~((scalar << 1) | prev_scalar);
+    prev_scalar = scalar >> 63;
 
-    case 5: { // list_type
-      const auto& list = this->as_list();
-      if (list.empty()) {
-        return "[]";
-      }
+    uint64_t structurals = (masks.structural & ~in_string) | (quotes & in_string) | scalar_starts;
+    while (structurals) {
+      index.emplace_back(block_offset + countr_zero(structurals));
+      structurals &= structurals - 1;
+    }
+  }
 
-      bool format = options & SerializeOption::FORMAT;
-      bool render_multiline = options & SerializeOption::EXPAND_LEAF_CONTAINERS;
-      if (format && !render_multiline) {
-        for (const unique_ptr<JSON>& o : list) {
-          if ((o->is_list() || o->is_dict()) && !o->empty()) {
-            render_multiline = true;
-            break;
-          }
-        }
-      }
+#else
+  build_json_structural_index_sequential(index, data, size, disable_extensions);
+#endif
+}
 
-      string ret = "[";
-      for (const unique_ptr<JSON>& o : list) {
-        if (ret.size() > 1) {
-          ret += (format && !render_multiline) ? ", " : ",";
-        }
-        if (render_multiline) {
-          ret += '\n' + string(indent_level + 2, ' ') + o->serialize(options, indent_level + 2);
-        } else {
-          ret += o->serialize(options);
-        }
-      }
-      if (render_multiline) {
-        ret += '\n' + string(indent_level, ' ') + "]";
-      } else {
-        ret.push_back(']');
-      }
+// Parses the scalar value (string, number, or constant) that begins at offset.
+// Unlike JSON::parse, this checks that a number or constant ends where the
+// index says the next token begins; anything else (e.g. "1x" or "nulll") is an
+// error.
+static JSON parse_json_indexed_scalar_value(const char* data, size_t size, size_t offset, bool disable_extensions) {
+  char ch = data[offset];
+  if (ch == '\"') {
+    return parse_json_string_value(data, size, offset);
+  }
 
-      return ret;
+  JSON ret;
+  if (ch == '-' || ch == '+' || isdigit(ch)) {
+    ret = parse_json_number_value(data, size, offset, disable_extensions);
+  } else if (!parse_json_constant_value(ret, data, size, offset, disable_extensions)) {
+    throw JSON::parse_error("unknown root sentinel; pos=" + to_string(offset));
+  }
+
+  if (offset < size) {
+    ch = data[offset];
+    if (!is_json_whitespace(ch) && !is_json_structural(ch) && (ch != '\"') &&
+        (disable_extensions || (ch != '/') || (offset + 1 >= size) || (data[offset + 1] != '/'))) {
+      throw JSON::parse_error("invalid scalar value; pos=" + to_string(offset));
     }
+  }
+  return ret;
+}
 
-    case 6: { // dict_type
+class IndexedJSONParser {
+public:
+  IndexedJSONParser(
+      const char* data,
+      size_t size,
+      const vector<uint32_t>& index,
+      bool disable_extensions,
+      size_t index_pos = 0,
+      bool borrow_strings = false)
+      : data(data),
+        size(size),
+        index(index),
+        index_pos(index_pos),
+        disable_extensions(disable_extensions),
+        borrow_strings(borrow_strings) {}
+
+  JSON parse_root() {
+    JSON ret = this->parse_value();
+    if (this->index_pos != this->index.size()) {
+      throw JSON::parse_error("unparsed data remains after value");
+    }
+    return ret;
+  }
 
-      const auto& dict = this->as_dict();
-      if (dict.empty()) {
-        return "{}";
-      }
+  JSON parse_value() {
+    size_t offset = this->peek_offset();
+    this->index_pos++;
 
-      bool format = options & SerializeOption::FORMAT;
-      bool render_multiline = options & SerializeOption::EXPAND_LEAF_CONTAINERS;
-      bool sort_keys = options & SerializeOption::SORT_DICT_KEYS;
-      if (format && !render_multiline) {
-        for (const auto& [k, v] : dict) {
-          if ((v->is_list() || v->is_dict()) && !v->empty()) {
-            render_multiline = true;
-            break;
-          }
-        }
+    char ch = this->data[offset];
+    if (ch == '{') {
+      JSON ret = JSON::dict();
+      if (this->peek_char() == '}') {
+        this->index_pos++;
+        return ret;
       }
-
-      string ret = "{";
-      auto add_key = [&](const string& key, const JSON& value) -> void {
-        if (ret.size() > 1) {
-          ret += (format && !render_multiline) ? ", " : ",";
-        }
-        string escaped_key = JSON::escape_string(key, escape_mode);
-        if (render_multiline) {
-          ret += '\n' + string(indent_level + 2, ' ') + "\"" + escaped_key + "\": " + value.serialize(options, indent_level + 2);
-        } else if (format) {
-          ret += "\"" + escaped_key + "\": " + value.serialize(options);
-        } else {
-          ret += "\"" + escaped_key + "\":" + value.serialize(options);
+      for (;;) {
+        size_t key_offset = this->peek_offset();
+        if (this->data[key_offset] != '\"') {
+          throw JSON::parse_error("dictionary key is not a string; pos=" + to_string(key_offset));
         }
-      };
-
-      if (sort_keys) {
-        // Note: We're kind of breaking abstraction here (the values in sorted
-        // point to objects owned by unique_ptrs) but the lifetimes of these
-        // objects are assumed to span this entire function, so it's ok to do
-        // this temporarily.
-        map<string, JSON*> sorted;
-        for (const auto& o : dict) {
-          sorted.emplace(o.first, o.second.get());
+        this->index_pos++;
+        string_view unescaped_key;
+        JSON::dict_key_type key = get_json_unescaped_string_contents(unescaped_key, this->data, this->size, key_offset)
+            ? this->keys.get(unescaped_key)
+            : this->keys.get(parse_json_string_value(this->data, this->size, key_offset));
+        if (this->get_char() != ':') {
+          throw JSON::parse_error("dictionary does not contain key/value pairs");
         }
-        for (const auto& o : sorted) {
-          add_key(o.first, *o.second);
+        ret.as_dict().emplace(std::move(key), new JSON(this->parse_value()));
+        char separator = this->get_char();
+        if (separator == '}') {
+          break;
+        } else if (separator != ',') {
+          throw JSON::parse_error("string is not a dictionary");
+        } else if (!this->disable_extensions && (this->peek_char() == '}')) {
+          this->index_pos++;
+          break;
         }
-      } else {
-        for (const auto& o : dict) {
-          add_key(o.first, *o.second);
+      }
+      return ret;
+
+    } else if (ch == '[') {
+      JSON ret = JSON::list();
+      if (this->peek_char() == ']') {
+        this->index_pos++;
+        return ret;
+      }
+      for (;;) {
+        ret.emplace_back(this->parse_value());
+        char separator = this->get_char();
+        if (separator == ']') {
+          break;
+        } else if (separator != ',') {
+          throw JSON::parse_error("string is not a list");
+        } else if (!this->disable_extensions && (this->peek_char() == ']')) {
+          this->index_pos++;
+          break;
         }
       }
-      if (render_multiline) {
-        return ret + '\n' + string(indent_level, ' ') + "}";
-      } else {
-        return ret + "}";
+      return ret;
+
+    } else {
+      // Strings with no escape sequences can refer directly to the input if
+      // the caller guarantees that it outlives the returned value
+      string_view unescaped;
+      if (this->borrow_strings && (ch == '\"') &&
+          get_json_unescaped_string_contents(unescaped, this->data, this->size, offset)) {
+        return JSON::borrowed_string(unescaped);
       }
+      return parse_json_indexed_scalar_value(this->data, this->size, offset, this->disable_extensions);
     }
+  }
 
-    default:
-      throw parse_error("unknown object type");
+private:
+  const char* data;
+  size_t size;
+  const vector<uint32_t>& index;
+  size_t index_pos;
+  bool disable_extensions;
+  bool borrow_strings;
+  JSONDictKeyTable keys;
+
+  inline size_t peek_offset() const {
+    if (this->index_pos >= this->index.size()) {
+      throw JSON::parse_error("unexpected end of input");
+    }
+    return this->index[this->index_pos];
   }
-}
+  inline char peek_char() const {
+    return this->data[this->peek_offset()];
+  }
+  inline char get_char() {
+    char ret = this->peek_char();
+    this->index_pos++;
+    return ret;
+  }
+};
 
-JSON::JSON() : value(nullptr) {}
+static JSON parse_json_fast(const char* s, size_t size, bool disable_extensions, bool borrow_strings) {
+  // The index uses 32-bit offsets, so larger inputs use the standard parser
+  if (size > 0xFFFFFFFF) {
+    return JSON::parse(s, size, disable_extensions);
+  }
 
-JSON::JSON(nullptr_t) : value(nullptr) {}
+  try {
+    vector<uint32_t> index;
+    index.reserve(size / 4);
+    build_json_structural_index(index, s, size, disable_extensions);
+    return IndexedJSONParser(s, size, index, disable_extensions, 0, borrow_strings).parse_root();
+  } catch (const JSON::parse_error&) {
+  } catch (const JSON::type_error&) {
+  } catch (const out_of_range&) {
+  }
+  // The input is malformed. The fast parser doesn't track state in the same
+  // way as the standard parser does, so to generate the same exception that
+  // the standard parser would have (and to handle any edge cases the fast
+  // parser doesn't handle identically), we just run the standard parser.
+  return JSON::parse(s, size, disable_extensions);
+}
 
-JSON::JSON(bool x) : value(x) {}
+JSON JSON::parse_fast(const char* s, size_t size, bool disable_extensions) {
+  return parse_json_fast(s, size, disable_extensions, false);
+}
 
-JSON::JSON(const char* s) {
-  this->value = string(s);
+JSON JSON::parse_fast(const string& s, bool disable_extensions) {
+  return JSON::parse_fast(s.data(), s.size(), disable_extensions);
 }
 
-JSON::JSON(const char* s, size_t size) {
-  this->value = string(s, size);
+// JSON Lines input is split into chunks that end on line boundaries, which are
+// then parsed independently on multiple threads. There are several times as
+// many chunks as threads, so threads that finish early can pick up more work.
+struct JSONLinesChunk {
+  size_t start_offset;
+  size_t end_offset;
+  size_t start_line_num;
+};
+
+static vector<JSONLinesChunk> split_json_lines_chunks(const char* data, size_t size, size_t num_threads) {
+  static constexpr size_t MIN_CHUNK_SIZE = 0x10000;
+  // thread::hardware_concurrency() may return 0 if it can't tell how many
+  // threads the system supports
+  size_t target_chunk_size = max<size_t>(size / (max<size_t>(num_threads, 1) * 4), MIN_CHUNK_SIZE);
+
+  vector<JSONLinesChunk> ret;
+  size_t line_num = 0;
+  for (size_t offset = 0; offset < size;) {
+    size_t end_offset = size;
+    if (size - offset > target_chunk_size) {
+      const char* newline = reinterpret_cast<const char*>(memchr(
+          data + offset + target_chunk_size, '\n', size - offset - target_chunk_size));
+      if (newline) {
+        end_offset = newline - data + 1;
+      }
+    }
+    ret.emplace_back(JSONLinesChunk{offset, end_offset, line_num});
+    line_num += count(data + offset, data + end_offset, '\n');
+    offset = end_offset;
+  }
+  return ret;
 }
 
-JSON::JSON(const string& x) : value(x) {}
+static void parse_json_lines_chunk(
+    const char* data,
+    const JSONLinesChunk& chunk,
+    bool disable_extensions,
+    const function<void(size_t line_num, JSON&& value)>& fn) {
+  size_t line_num = chunk.start_line_num;
+  for (size_t offset = chunk.start_offset; offset < chunk.end_offset; line_num++) {
+    const char* newline = reinterpret_cast<const char*>(memchr(data + offset, '\n', chunk.end_offset - offset));
+    size_t end_offset = newline ? (newline - data) : chunk.end_offset;
+    while ((offset < end_offset) && is_json_whitespace(data[offset])) {
+      offset++;
+    }
+    if (offset < end_offset) {
+      JSON value;
+      try {
+        value = JSON::parse_fast(data + offset, end_offset - offset, disable_extensions);
+      } catch (const JSON::parse_error& e) {
+        throw JSON::parse_error(std::format("{}; line={}", e.what(), line_num + 1));
+      }
+      fn(line_num, std::move(value));
+    }
+    offset = end_offset + 1;
+  }
+}
 
-JSON::JSON(string&& x) : value(std::move(x)) {}
+// Calls fn for every chunk, on num_threads threads. If any call throws, the
+// remaining chunks are skipped and the exception is rethrown on the calling
+// thread.
+static void parse_json_lines_chunks(
+    const char* data,
+    const vector<JSONLinesChunk>& chunks,
+    size_t num_threads,
+    bool disable_extensions,
+    const function<void(size_t chunk_index, size_t line_num, JSON&& value)>& fn) {
+  if (num_threads > chunks.size()) {
+    num_threads = chunks.size();
+  }
+  if (num_threads <= 1) {
+    for (size_t z = 0; z < chunks.size(); z++) {
+      parse_json_lines_chunk(data, chunks[z], disable_extensions, [&](size_t line_num, JSON&& value) {
+        fn(z, line_num, std::move(value));
+      });
+    }
+    return;
+  }
 
-JSON::JSON(int64_t x) : value(x) {}
+  mutex exc_lock;
+  exception_ptr exc;
+  auto parse_chunk = [&](size_t chunk_index, size_t) -> bool {
+    try {
+      parse_json_lines_chunk(data, chunks[chunk_index], disable_extensions, [&](size_t line_num, JSON&& value) {
+        fn(chunk_index, line_num, std::move(value));
+      });
+      return false;
+    } catch (...) {
+      lock_guard g(exc_lock);
+      if (!exc) {
+        exc = current_exception();
+      }
+      return true;
+    }
+  };
+  parallel_range<size_t>(parse_chunk, 0, chunks.size(), num_threads, nullptr);
+  if (exc) {
+    rethrow_exception(exc);
+  }
+}
 
-JSON::JSON(double x) : value(x) {}
+vector<JSON> JSON::parse_lines(const char* data, size_t size, size_t num_threads, bool disable_extensions) {
+  if (num_threads == 0) {
+    num_threads = thread::hardware_concurrency();
+  }
+  auto chunks = split_json_lines_chunks(data, size, num_threads);
 
-JSON::JSON(list_type&& x) : value(std::move(x)) {}
+  vector<vector<JSON>> chunk_values(chunks.size());
+  parse_json_lines_chunks(data, chunks, num_threads, disable_extensions, [&](size_t chunk_index, size_t, JSON&& value) {
+    chunk_values[chunk_index].emplace_back(std::move(value));
+  });
 
-JSON::JSON(dict_type&& x) : value(std::move(x)) {}
+  size_t total_count = 0;
+  for (const auto& values : chunk_values) {
+    total_count += values.size();
+  }
+  vector<JSON> ret;
+  ret.reserve(total_count);
+  for (auto& values : chunk_values) {
+    for (auto& value : values) {
+      ret.emplace_back(std::move(value));
+    }
+  }
+  return ret;
+}
 
-JSON::JSON(const JSON& rhs) : value(nullptr) {
-  this->operator=(rhs);
+vector<JSON> JSON::parse_lines(const string& data, size_t num_threads, bool disable_extensions) {
+  return JSON::parse_lines(data.data(), data.size(), num_threads, disable_extensions);
+}
+
+void JSON::parse_lines_unordered(
+    const char* data,
+    size_t size,
+    const function<void(size_t line_num, JSON&& value)>& fn,
+    size_t num_threads,
+    bool disable_extensions) {
+  if (num_threads == 0) {
+    num_threads = thread::hardware_concurrency();
+  }
+  auto chunks = split_json_lines_chunks(data, size, num_threads);
+  parse_json_lines_chunks(data, chunks, num_threads, disable_extensions, [&](size_t, size_t line_num, JSON&& value) {
+    fn(line_num, std::move(value));
+  });
+}
+
+void JSON::parse_lines_unordered(
+    const string& data,
+    const function<void(size_t line_num, JSON&& value)>& fn,
+    size_t num_threads,
+    bool disable_extensions) {
+  JSON::parse_lines_unordered(data.data(), data.size(), fn, num_threads, disable_extensions);
+}
+
+struct JSONView::Index {
+  const char* data;
+  size_t size;
+  bool disable_extensions;
+  // Offsets of all structural characters, string opening quotes, and starts of
+  // other scalars (see build_json_structural_index)
+  vector<uint32_t> offsets;
+  // For each entry in offsets that opens a list or dict, the position in
+  // offsets of the corresponding closing bracket (unused for other entries)
+  vector<uint32_t> close_positions;
+};
+
+JSONView::JSONView(const char* data, size_t size, bool disable_extensions) : index_pos(0) {
+  if (size > 0xFFFFFFFF) {
+    throw JSON::parse_error("input is too large to index");
+  }
+
+  auto index = make_shared<Index>();
+  index->data = data;
+  index->size = size;
+  index->disable_extensions = disable_extensions;
+  build_json_structural_index(index->offsets, data, size, disable_extensions);
+  index->close_positions.resize(index->offsets.size(), 0);
+
+  // Check the structure of the input and find the closing bracket for each
+  // list and dict. This doesn't look at the contents of scalars at all.
+  const auto& offsets = index->offsets;
+  auto char_at = [&](size_t pos) -> char {
+    if (pos >= offsets.size()) {
+      throw JSON::parse_error("unexpected end of input");
+    }
+    return data[offsets[pos]];
+  };
+  auto check_key = [&](size_t pos) -> void {
+    if (char_at(pos) != '\"') {
+      throw JSON::parse_error("dictionary key is not a string; pos=" + to_string(offsets[pos]));
+    }
+    if (char_at(pos + 1) != ':') {
+      throw JSON::parse_error("dictionary does not contain key/value pairs; pos=" + to_string(offsets[pos + 1]));
+    }
+  };
+
+  vector<uint32_t> open_positions;
+  size_t pos = 0;
+  for (;;) {
+    // Expect a value at pos
+    char ch = char_at(pos);
+    if ((ch == '[') || (ch == '{')) {
+      char close_ch = (ch == '[') ? ']' : '}';
+      if (char_at(pos + 1) == close_ch) {
+        index->close_positions[pos] = pos + 1;
+        pos += 2;
+      } else {
+        open_positions.emplace_back(pos);
+        pos++;
+        if (ch == '{') {
+          check_key(pos);
+          pos += 2;
+        }
+        continue;
+      }
+    } else if (is_json_structural(ch)) {
+      throw JSON::parse_error("expected value; pos=" + to_string(offsets[pos]));
+    } else {
+      pos++;
+    }
+
+    // Consume separators and closing brackets until the next value
+    for (;;) {
+      if (open_positions.empty()) {
+        if (pos != offsets.size()) {
+          throw JSON::parse_error("unparsed data remains after value");
+        }
+        this->index = std::move(index);
+        return;
+      }
+
+      size_t open_pos = open_positions.back();
+      bool is_dict = (data[offsets[open_pos]] == '{');
+      char close_ch = is_dict ? '}' : ']';
+      char separator = char_at(pos);
+      if ((separator == close_ch) ||
+          ((separator == ',') && !disable_extensions && (char_at(pos + 1) == close_ch))) {
+        pos += (separator == ',') ? 1 : 0;
+        index->close_positions[open_pos] = pos;
+        open_positions.pop_back();
+        pos++;
+      } else if (separator == ',') {
+        pos++;
+        if (is_dict) {
+          check_key(pos);
+          pos += 2;
+        }
+        break;
+      } else {
+        throw JSON::parse_error(string(is_dict ? "string is not a dictionary" : "string is not a list") +
+            "; pos=" + to_string(offsets[pos]));
+      }
+    }
+  }
+}
+
+JSONView::JSONView(const string& data, bool disable_extensions)
+    : JSONView(data.data(), data.size(), disable_extensions) {}
+
+JSONView::JSONView(shared_ptr<const Index> index, size_t index_pos)
+    : index(std::move(index)),
+      index_pos(index_pos) {}
+
+char JSONView::first_char() const {
+  return this->index->data[this->index->offsets[this->index_pos]];
+}
+
+size_t JSONView::end_index_pos() const {
+  return this->index->close_positions[this->index_pos];
+}
+
+size_t JSONView::next_index_pos(size_t index_pos) const {
+  char ch = this->index->data[this->index->offsets[index_pos]];
+  return ((ch == '[') || (ch == '{')) ? (this->index->close_positions[index_pos] + 1) : (index_pos + 1);
+}
+
+JSON JSONView::decode_scalar() const {
+  return parse_json_indexed_scalar_value(this->index->data, this->index->size,
+      this->index->offsets[this->index_pos], this->index->disable_extensions);
+}
+
+bool JSONView::is_null() const {
+  char ch = this->first_char();
+  return ((ch == 'n') && this->decode_scalar().is_null());
+}
+
+bool JSONView::is_bool() const {
+  char ch = this->first_char();
+  return ((ch == 't') || (ch == 'f')) && this->decode_scalar().is_bool();
+}
+
+bool JSONView::is_int() const {
+  char ch = this->first_char();
+  return ((ch == '-') || (ch == '+') || isdigit(ch)) && this->decode_scalar().is_int();
+}
+
+bool JSONView::is_float() const {
+  char ch = this->first_char();
+  return ((ch == '-') || (ch == '+') || isdigit(ch)) && this->decode_scalar().is_float();
+}
+
+bool JSONView::is_string() const {
+  return this->first_char() == '\"';
+}
+
+bool JSONView::is_list() const {
+  return this->first_char() == '[';
+}
+
+bool JSONView::is_dict() const {
+  return this->first_char() == '{';
+}
+
+bool JSONView::as_bool() const {
+  if (this->is_list() || this->is_dict()) {
+    throw JSON::type_error("JSON value cannot be accessed as a bool");
+  }
+  return this->decode_scalar().as_bool();
+}
+
+int64_t JSONView::as_int() const {
+  if (this->is_list() || this->is_dict()) {
+    throw JSON::type_error("JSON value cannot be accessed as an int");
+  }
+  return this->decode_scalar().as_int();
+}
+
+double JSONView::as_float() const {
+  if (this->is_list() || this->is_dict()) {
+    throw JSON::type_error("JSON value cannot be accessed as a float");
+  }
+  return this->decode_scalar().as_float();
+}
+
+string JSONView::as_string() const {
+  if (!this->is_string()) {
+    throw JSON::type_error("JSON value cannot be accessed as a string");
+  }
+  return std::move(this->decode_scalar().as_string());
+}
+
+string_view JSONView::as_string_view() const {
+  if (!this->is_string()) {
+    throw JSON::type_error("JSON value cannot be accessed as a string");
+  }
+  string_view ret;
+  if (!get_json_unescaped_string_contents(
+          ret, this->index->data, this->index->size, this->index->offsets[this->index_pos])) {
+    throw JSON::type_error("JSON string contains escape sequences and cannot be accessed as a string view");
+  }
+  return ret;
+}
+
+JSON JSONView::to_json() const {
+  if (this->is_list() || this->is_dict()) {
+    return IndexedJSONParser(this->index->data, this->index->size, this->index->offsets,
+        this->index->disable_extensions, this->index_pos)
+        .parse_value();
+  }
+  return this->decode_scalar();
+}
+
+size_t JSONView::size() const {
+  if (!this->is_list() && !this->is_dict()) {
+    throw JSON::type_error("JSON value cannot be accessed as a container");
+  }
+  size_t values_index_offset = this->is_dict() ? 2 : 0;
+  size_t end_pos = this->end_index_pos();
+  size_t ret = 0;
+  for (size_t pos = this->index_pos + 1; pos < end_pos; ret++) {
+    pos = this->next_index_pos(pos + values_index_offset) + 1;
+  }
+  return ret;
+}
+
+bool JSONView::empty() const {
+  if (!this->is_list() && !this->is_dict()) {
+    throw JSON::type_error("JSON value cannot be accessed as a container");
+  }
+  return this->end_index_pos() == this->index_pos + 1;
+}
+
+optional<JSONView> JSONView::find(const string& key) const {
+  if (!this->is_dict()) {
+    throw JSON::type_error("JSON value cannot be accessed as a dict");
+  }
+  const char* data = this->index->data;
+  size_t size = this->index->size;
+  size_t end_pos = this->end_index_pos();
+  for (size_t pos = this->index_pos + 1; pos < end_pos;) {
+    size_t key_offset = this->index->offsets[pos];
+    string_view unescaped_key;
+    bool matches = get_json_unescaped_string_contents(unescaped_key, data, size, key_offset)
+        ? (unescaped_key == key)
+        : (parse_json_string_value(data, size, key_offset) == key);
+    if (matches) {
+      return JSONView(this->index, pos + 2);
+    }
+    pos = this->next_index_pos(pos + 2) + 1;
+  }
+  return nullopt;
+}
+
+bool JSONView::contains(const string& key) const {
+  return this->find(key).has_value();
+}
+
+JSONView JSONView::at(const string& key) const {
+  auto ret = this->find(key);
+  if (!ret.has_value()) {
+    throw out_of_range("JSON key not present: " + key);
+  }
+  return std::move(*ret);
+}
+
+optional<JSONView> JSONView::find(size_t index) const {
+  if (!this->is_list()) {
+    throw JSON::type_error("JSON value cannot be accessed as a list");
+  }
+  size_t end_pos = this->end_index_pos();
+  for (size_t pos = this->index_pos + 1; pos < end_pos; index--) {
+    if (index == 0) {
+      return JSONView(this->index, pos);
+    }
+    pos = this->next_index_pos(pos) + 1;
+  }
+  return nullopt;
+}
+
+JSONView JSONView::at(size_t index) const {
+  auto ret = this->find(index);
+  if (!ret.has_value()) {
+    throw out_of_range("JSON array index out of bounds");
+  }
+  return std::move(*ret);
+}
+
+vector<JSONView> JSONView::list_items() const {
+  if (!this->is_list()) {
+    throw JSON::type_error("JSON value cannot be accessed as a list");
+  }
+  vector<JSONView> ret;
+  size_t end_pos = this->end_index_pos();
+  for (size_t pos = this->index_pos + 1; pos < end_pos;) {
+    ret.emplace_back(JSONView(this->index, pos));
+    pos = this->next_index_pos(pos) + 1;
+  }
+  return ret;
+}
+
+vector<pair<string, JSONView>> JSONView::dict_items() const {
+  if (!this->is_dict()) {
+    throw JSON::type_error("JSON value cannot be accessed as a dict");
+  }
+  vector<pair<string, JSONView>> ret;
+  size_t end_pos = this->end_index_pos();
+  for (size_t pos = this->index_pos + 1; pos < end_pos;) {
+    size_t key_offset = this->index->offsets[pos];
+    ret.emplace_back(parse_json_string_value(this->index->data, this->index->size, key_offset), JSONView(this->index, pos + 2));
+    pos = this->next_index_pos(pos + 2) + 1;
+  }
+  return ret;
+}
+
+static void escape_json_string_into(string& out, string_view s, JSON::StringEscapeMode mode) {
+  const char* data = s.data();
+  size_t size = s.size();
+  size_t offset = 0;
+  while (offset < size) {
+    // Copy runs of characters that don't need escaping all at once
+    size_t run_start = offset;
+    while ((offset < size) && (data[offset] != '\"') && (data[offset] != '\\') &&
+        (static_cast<uint8_t>(data[offset]) >= 0x20) && (static_cast<uint8_t>(data[offset]) <= 0x7E)) {
+      offset++;
+    }
+    out.append(data + run_start, offset - run_start);
+    if (offset >= size) {
+      break;
+    }
+
+    char ch = data[offset++];
+    if (ch == '\"') {
+      out += "\\\"";
+    } else if (ch == '\\') {
+      out += "\\\\";
+    } else if (ch == '\b') {
+      out += "\\b";
+    } else if (ch == '\f') {
+      out += "\\f";
+    } else if (ch == '\n') {
+      out += "\\n";
+    } else if (ch == '\r') {
+      out += "\\r";
+    } else if (ch == '\t') {
+      out += "\\t";
+    } else if (static_cast<uint8_t>(ch) < 0x20) {
+      if (mode != JSON::StringEscapeMode::STANDARD) {
+        out += std::format("\\x{:02X}", ch);
+      } else {
+        out += std::format("\\u{:04X}", ch);
+      }
+    } else { // ch > 0x7E
+      if (mode == JSON::StringEscapeMode::CONTROL_ONLY) {
+        out += ch;
+      } else if (mode == JSON::StringEscapeMode::HEX) {
+        out += std::format("\\x{:02X}", ch);
+      } else {
+        out += std::format("\\u{:04X}", ch);
+      }
+    }
+  }
+}
+
+string JSON::escape_string(const string& s, StringEscapeMode mode) {
+  string ret;
+  escape_json_string_into(ret, s, mode);
+  return ret;
+}
+
+// Generates serialized JSON into a buffer. If write_data is given, the buffer
+// is passed to it and cleared whenever it grows beyond a fixed size, so the
+// memory used doesn't depend on the size of the output.
+class JSONSerializer {
+public:
+  static constexpr size_t FLUSH_THRESHOLD = 0x10000;
+
+  JSONSerializer(string& buffer, const function<void(const void*, size_t)>* write_data, uint32_t options)
+      : buffer(buffer),
+        write_data(write_data),
+        options(options),
+        format(options & JSON::SerializeOption::FORMAT),
+        expand_leaf_containers(options & JSON::SerializeOption::EXPAND_LEAF_CONTAINERS),
+        sort_keys(options & JSON::SerializeOption::SORT_DICT_KEYS),
+        hex_integers(options & JSON::SerializeOption::HEX_INTEGERS),
+        one_character_trivial_constants(options & JSON::SerializeOption::ONE_CHARACTER_TRIVIAL_CONSTANTS) {
+    if (options & JSON::SerializeOption::ESCAPE_CONTROLS_ONLY) {
+      this->escape_mode = JSON::StringEscapeMode::CONTROL_ONLY;
+    } else if (options & JSON::SerializeOption::HEX_ESCAPE_CODES) {
+      this->escape_mode = JSON::StringEscapeMode::HEX;
+    } else {
+      this->escape_mode = JSON::StringEscapeMode::STANDARD;
+    }
+    if (this->write_data) {
+      this->buffer.reserve(FLUSH_THRESHOLD + 0x1000);
+    }
+  }
+
+  void write(const JSON& v, size_t indent_level) {
+    if (v.is_null()) {
+      this->write_null();
+
+    } else if (v.is_bool()) {
+      this->write_bool(v.as_bool());
+
+    } else if (v.is_int()) {
+      this->write_int(v.as_int());
+
+    } else if (v.is_float()) {
+      this->write_float(v.as_float());
+
+    } else if (v.is_string()) {
+      this->write_string(v.as_string_view());
+
+    } else if (v.is_list()) {
+      const auto& list = v.as_list();
+      if (list.empty()) {
+        this->buffer += "[]";
+      } else {
+        bool render_multiline = this->should_render_multiline(list, [](const auto& it) -> const JSON& {
+          return *it;
+        });
+
+        this->buffer.push_back('[');
+        bool is_first = true;
+        for (const auto& o : list) {
+          this->write_item(nullptr, *o, is_first, render_multiline, indent_level);
+        }
+        this->write_end(']', render_multiline, indent_level);
+      }
+
+    } else if (v.is_dict()) {
+      const auto& dict = v.as_dict();
+      if (dict.empty()) {
+        this->buffer += "{}";
+      } else {
+        bool render_multiline = this->should_render_multiline(dict, [](const auto& it) -> const JSON& {
+          return *it.second;
+        });
+
+        this->buffer.push_back('{');
+        bool is_first = true;
+        auto write_item = [&](const string& key, const JSON& value) -> void {
+          this->write_item(&key, value, is_first, render_multiline, indent_level);
+        };
+        if (this->sort_keys) {
+          vector<const JSON::dict_type::value_type*> sorted;
+          sorted.reserve(dict.size());
+          for (const auto& it : dict) {
+            sorted.emplace_back(&it);
+          }
+          sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) -> bool {
+            return a->first < b->first;
+          });
+          for (const auto* it : sorted) {
+            write_item(it->first, *it->second);
+          }
+        } else {
+          for (const auto& it : dict) {
+            write_item(it.first, *it.second);
+          }
+        }
+        this->write_end('}', render_multiline, indent_level);
+      }
+
+    } else {
+      throw JSON::parse_error("unknown object type");
+    }
+
+    if (this->write_data && (this->buffer.size() >= FLUSH_THRESHOLD)) {
+      this->flush();
+    }
+  }
+
+  void write_null() {
+    this->buffer += this->one_character_trivial_constants ? "n" : "null";
+  }
+
+  void write_bool(bool v) {
+    if (this->one_character_trivial_constants) {
+      this->buffer += v ? "t" : "f";
+    } else {
+      this->buffer += v ? "true" : "false";
+    }
+  }
+
+  void write_int(int64_t v) {
+    if (this->hex_integers) {
+      if (v < 0) {
+        std::format_to(back_inserter(this->buffer), "-0x{:X}", -v);
+      } else {
+        std::format_to(back_inserter(this->buffer), "0x{:X}", v);
+      }
+    } else {
+      char buf[24];
+      auto res = to_chars(buf, buf + sizeof(buf), v);
+      this->buffer.append(buf, res.ptr - buf);
+    }
+  }
+
+  // to_chars without a precision produces the shortest representation that
+  // parses back to the same value. If that looks like an integer, we add ".0"
+  // so it will be parsed as a float; we don't need to do this if it has an
+  // exponent.
+  void write_float(double v) {
+    char buf[40];
+    auto res = to_chars(buf, buf + sizeof(buf), v);
+    this->buffer.append(buf, res.ptr - buf);
+    if (!any_of(buf, res.ptr, [](char ch) { return !isdigit(ch) && (ch != '-'); })) {
+      this->buffer += ".0";
+    }
+  }
+
+  void write_string(string_view s) {
+    this->buffer.push_back('\"');
+    escape_json_string_into(this->buffer, s, this->escape_mode);
+    this->buffer.push_back('\"');
+  }
+
+  void flush() {
+    if (this->write_data && !this->buffer.empty()) {
+      (*this->write_data)(this->buffer.data(), this->buffer.size());
+      this->buffer.clear();
+    }
+  }
+
+  // Like write(), but lists and dicts with many items are split into chunks,
+  // which are serialized into separate buffers on multiple threads. Each
+  // chunk (and the data written before it) becomes a block in blocks, so the
+  // output is only copied once, when the caller closes blocks. Containers that
+  // are too small to split are written here, but their items are checked for
+  // large containers too, so a large list inside a small dict is still split.
+  void write_parallel(const JSON& v, size_t indent_level, size_t num_threads, BlockStringWriter& blocks) {
+    if ((!v.is_list() && !v.is_dict()) || v.empty()) {
+      this->write(v, indent_level);
+      return;
+    }
+
+    // Dict keys are null for list items
+    vector<pair<const string*, const JSON*>> items;
+    items.reserve(v.size());
+    if (v.is_list()) {
+      for (const auto& it : v.as_list()) {
+        items.emplace_back(nullptr, it.get());
+      }
+    } else {
+      for (const auto& it : v.as_dict()) {
+        const string& key = it.first;
+        items.emplace_back(&key, it.second.get());
+      }
+      if (this->sort_keys) {
+        sort(items.begin(), items.end(), [](const auto& a, const auto& b) -> bool {
+          return *a.first < *b.first;
+        });
+      }
+    }
+    bool render_multiline = this->should_render_multiline(items, [](const auto& it) -> const JSON& {
+      return *it.second;
+    });
+    size_t child_indent_level = render_multiline ? (indent_level + 2) : 0;
+
+    this->buffer.push_back(v.is_list() ? '[' : '{');
+    bool is_first = true;
+    size_t num_chunks = min<size_t>(num_threads * 4, items.size() / PARALLEL_MIN_CHUNK_ITEMS);
+    if (num_chunks <= 1) {
+      for (const auto& [key, value] : items) {
+        this->write_item_header(key, is_first, render_multiline, indent_level);
+        this->write_parallel(*value, child_indent_level, num_threads, blocks);
+      }
+
+    } else {
+      vector<string> chunk_buffers(num_chunks);
+      mutex exc_lock;
+      exception_ptr exc;
+      auto write_chunk = [&](size_t chunk_index, size_t) -> bool {
+        try {
+          size_t start_index = (items.size() * chunk_index) / num_chunks;
+          size_t end_index = (items.size() * (chunk_index + 1)) / num_chunks;
+          JSONSerializer chunk_serializer(chunk_buffers[chunk_index], nullptr, this->options);
+          bool chunk_is_first = (start_index == 0);
+          for (size_t z = start_index; z < end_index; z++) {
+            chunk_serializer.write_item(items[z].first, *items[z].second, chunk_is_first, render_multiline, indent_level);
+          }
+          return false;
+        } catch (...) {
+          lock_guard g(exc_lock);
+          if (!exc) {
+            exc = current_exception();
+          }
+          return true;
+        }
+      };
+      parallel_range<size_t>(write_chunk, 0, num_chunks, num_threads, nullptr);
+      if (exc) {
+        rethrow_exception(exc);
+      }
+
+      blocks.write(std::move(this->buffer));
+      this->buffer.clear();
+      for (auto& chunk_buffer : chunk_buffers) {
+        blocks.write(std::move(chunk_buffer));
+      }
+    }
+    this->write_end(v.is_list() ? ']' : '}', render_multiline, indent_level);
+  }
+
+private:
+  // Containers are only split into chunks for parallel serialization if each
+  // chunk would have at least this many items
+  static constexpr size_t PARALLEL_MIN_CHUNK_ITEMS = 0x100;
+
+  string& buffer;
+  const function<void(const void*, size_t)>* write_data;
+  uint32_t options;
+  bool format;
+  bool expand_leaf_containers;
+  bool sort_keys;
+  bool hex_integers;
+  bool one_character_trivial_constants;
+  JSON::StringEscapeMode escape_mode;
+
+  // In FORMAT mode, containers are rendered on multiple lines if they contain
+  // any non-empty containers (or always, if EXPAND_LEAF_CONTAINERS is given)
+  template <typename ContainerT, typename GetValueT>
+  bool should_render_multiline(const ContainerT& container, GetValueT&& get_value) const {
+    if (this->expand_leaf_containers) {
+      return true;
+    }
+    if (this->format) {
+      for (const auto& it : container) {
+        const JSON& v = get_value(it);
+        if ((v.is_list() || v.is_dict()) && !v.empty()) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Writes the separator before a list or dict item, and its key if it's a
+  // dict item
+  void write_item_header(const string* key, bool& is_first, bool render_multiline, size_t indent_level) {
+    this->write_separator(is_first, render_multiline, indent_level);
+    if (key) {
+      this->write_string(*key);
+      this->buffer += (this->format || render_multiline) ? ": " : ":";
+    }
+  }
+
+  void write_item(const string* key, const JSON& value, bool& is_first, bool render_multiline, size_t indent_level) {
+    this->write_item_header(key, is_first, render_multiline, indent_level);
+    this->write(value, render_multiline ? (indent_level + 2) : 0);
+  }
+
+  void write_separator(bool& is_first, bool render_multiline, size_t indent_level) {
+    if (!is_first) {
+      this->buffer += (this->format && !render_multiline) ? ", " : ",";
+    }
+    is_first = false;
+    if (render_multiline) {
+      this->buffer.push_back('\n');
+      this->buffer.append(indent_level + 2, ' ');
+    }
+  }
+
+  void write_end(char end_ch, bool render_multiline, size_t indent_level) {
+    if (render_multiline) {
+      this->buffer.push_back('\n');
+      this->buffer.append(indent_level, ' ');
+    }
+    this->buffer.push_back(end_ch);
+  }
+};
+
+string JSON::serialize(uint32_t options, size_t indent_level) const {
+  string ret;
+  JSONSerializer(ret, nullptr, options).write(*this, indent_level);
+  return ret;
+}
+
+void JSON::serialize(const function<void(const void*, size_t)>& write_data, uint32_t options, size_t indent_level) const {
+  string buffer;
+  JSONSerializer serializer(buffer, &write_data, options);
+  serializer.write(*this, indent_level);
+  serializer.flush();
+}
+
+string JSON::serialize_parallel(uint32_t options, size_t num_threads, size_t indent_level) const {
+  if (num_threads == 0) {
+    num_threads = thread::hardware_concurrency();
+  }
+  if (num_threads <= 1) {
+    return this->serialize(options, indent_level);
+  }
+  BlockStringWriter blocks;
+  string buffer;
+  JSONSerializer(buffer, nullptr, options).write_parallel(*this, indent_level, num_threads, blocks);
+  blocks.write(std::move(buffer));
+  return blocks.close();
+}
+
+void JSON::serialize(StringWriter& w, uint32_t options, size_t indent_level) const {
+  JSONSerializer(w.str(), nullptr, options).write(*this, indent_level);
+}
+
+void JSON::print(FILE* stream, uint32_t options, size_t indent_level) const {
+  auto write_data = [stream](const void* data, size_t size) -> void {
+    fwritex(stream, data, size);
+  };
+  this->serialize(write_data, options, indent_level);
+}
+
+// Type bytes used in the binary format. Strings (including dict keys) are
+// encoded as a varint header, which is either (size << 1) followed by the
+// string's contents, or ((table_index << 1) | 1) if string deduplication is
+// enabled and the string appeared earlier in the data.
+enum class JSONBinaryType : uint8_t {
+  NULL_VALUE = 0x00,
+  FALSE_VALUE = 0x01,
+  TRUE_VALUE = 0x02,
+  INT_VALUE = 0x03, // Followed by zigzag-encoded varint
+  FLOAT_VALUE = 0x04, // Followed by le_double
+  STRING_VALUE = 0x05, // Followed by string header (and data, if any)
+  LIST_VALUE = 0x06, // Followed by varint item count, then items
+  DICT_VALUE = 0x07, // Followed by varint item count, then (key, value) pairs
+};
+
+// The first byte of the binary format specifies which options were used when
+// it was generated
+static constexpr uint8_t JSON_BINARY_FORMAT_BASIC = 0x00;
+static constexpr uint8_t JSON_BINARY_FORMAT_DEDUPLICATED_STRINGS = 0x01;
+static constexpr size_t JSON_BINARY_MAX_DEDUPLICATED_STRING_SIZE = 0x80;
+
+class JSONBinarySerializer {
+public:
+  JSONBinarySerializer(string& buffer, bool deduplicate_strings)
+      : buffer(buffer),
+        deduplicate_strings(deduplicate_strings) {}
+
+  void write_root(const JSON& v) {
+    this->buffer.push_back(this->deduplicate_strings ? JSON_BINARY_FORMAT_DEDUPLICATED_STRINGS : JSON_BINARY_FORMAT_BASIC);
+    this->write(v);
+  }
+
+private:
+  string& buffer;
+  bool deduplicate_strings;
+  // Keys point to strings within the JSON object being serialized
+  unordered_map<string_view, size_t> string_indexes;
+
+  void write_varint(uint64_t v) {
+    while (v >= 0x80) {
+      this->buffer.push_back(static_cast<char>((v & 0x7F) | 0x80));
+      v >>= 7;
+    }
+    this->buffer.push_back(static_cast<char>(v));
+  }
+
+  void write_string(string_view s) {
+    if (this->deduplicate_strings && (s.size() <= JSON_BINARY_MAX_DEDUPLICATED_STRING_SIZE)) {
+      auto it = this->string_indexes.find(s);
+      if (it != this->string_indexes.end()) {
+        this->write_varint((static_cast<uint64_t>(it->second) << 1) | 1);
+        return;
+      }
+      this->string_indexes.emplace(s, this->string_indexes.size());
+    }
+    this->write_varint(static_cast<uint64_t>(s.size()) << 1);
+    this->buffer += s;
+  }
+
+  void write(const JSON& v) {
+    if (v.is_null()) {
+      this->buffer.push_back(static_cast<char>(JSONBinaryType::NULL_VALUE));
+
+    } else if (v.is_bool()) {
+      this->buffer.push_back(static_cast<char>(v.as_bool() ? JSONBinaryType::TRUE_VALUE : JSONBinaryType::FALSE_VALUE));
+
+    } else if (v.is_int()) {
+      int64_t i = v.as_int();
+      this->buffer.push_back(static_cast<char>(JSONBinaryType::INT_VALUE));
+      this->write_varint((static_cast<uint64_t>(i) << 1) ^ static_cast<uint64_t>(i >> 63));
+
+    } else if (v.is_float()) {
+      le_double f = v.as_float();
+      this->buffer.push_back(static_cast<char>(JSONBinaryType::FLOAT_VALUE));
+      this->buffer.append(reinterpret_cast<const char*>(&f), sizeof(f));
+
+    } else if (v.is_string()) {
+      this->buffer.push_back(static_cast<char>(JSONBinaryType::STRING_VALUE));
+      this->write_string(v.as_string_view());
+
+    } else if (v.is_list()) {
+      const auto& list = v.as_list();
+      this->buffer.push_back(static_cast<char>(JSONBinaryType::LIST_VALUE));
+      this->write_varint(list.size());
+      for (const auto& item : list) {
+        this->write(*item);
+      }
+
+    } else if (v.is_dict()) {
+      const auto& dict = v.as_dict();
+      this->buffer.push_back(static_cast<char>(JSONBinaryType::DICT_VALUE));
+      this->write_varint(dict.size());
+      for (const auto& it : dict) {
+        const string& key = it.first;
+        this->write_string(key);
+        this->write(*it.second);
+      }
+
+    } else {
+      throw logic_error("unknown JSON type");
+    }
+  }
+};
+
+class JSONBinaryParser {
+public:
+  explicit JSONBinaryParser(StringReader& r) : r(r) {}
+
+  JSON parse_root() {
+    try {
+      uint8_t format = this->r.get_u8();
+      if (format == JSON_BINARY_FORMAT_DEDUPLICATED_STRINGS) {
+        this->deduplicate_strings = true;
+      } else if (format != JSON_BINARY_FORMAT_BASIC) {
+        throw JSON::parse_error(std::format("unknown binary JSON format {:02X}", format));
+      }
+      return this->parse_value();
+    } catch (const out_of_range&) {
+      throw JSON::parse_error("binary JSON data is truncated");
+    }
+  }
+
+private:
+  StringReader& r;
+  bool deduplicate_strings = false;
+  // Values point to strings within the input data
+  vector<string_view> strings;
+  JSONDictKeyTable keys;
+
+  uint64_t read_varint() {
+    uint64_t ret = 0;
+    for (size_t shift = 0; shift < 64; shift += 7) {
+      uint8_t b = this->r.get_u8();
+      ret |= static_cast<uint64_t>(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        return ret;
+      }
+    }
+    throw JSON::parse_error("varint is too long; pos=" + to_string(this->r.where()));
+  }
+
+  string read_string() {
+    uint64_t header = this->read_varint();
+    if (header & 1) {
+      uint64_t index = header >> 1;
+      if (index >= this->strings.size()) {
+        throw JSON::parse_error("invalid string reference; pos=" + to_string(this->r.where()));
+      }
+      return string(this->strings[index]);
+    }
+
+    size_t size = header >> 1;
+    if (size > this->r.remaining()) {
+      throw out_of_range("string extends beyond end of data");
+    }
+    const char* data = reinterpret_cast<const char*>(this->r.getv(size));
+    if (this->deduplicate_strings && (size <= JSON_BINARY_MAX_DEDUPLICATED_STRING_SIZE)) {
+      this->strings.emplace_back(data, size);
+    }
+    return string(data, size);
+  }
+
+  // Containers' item counts come from the input, so we can't trust them for
+  // preallocation; however, every item takes at least one byte, so the count
+  // can't be larger than the remaining data
+  size_t read_item_count() {
+    uint64_t count = this->read_varint();
+    if (count > this->r.remaining()) {
+      throw out_of_range("container extends beyond end of data");
+    }
+    return count;
+  }
+
+  JSON parse_value() {
+    uint8_t type = this->r.get_u8();
+    switch (static_cast<JSONBinaryType>(type)) {
+      case JSONBinaryType::NULL_VALUE:
+        return nullptr;
+      case JSONBinaryType::FALSE_VALUE:
+        return false;
+      case JSONBinaryType::TRUE_VALUE:
+        return true;
+      case JSONBinaryType::INT_VALUE: {
+        uint64_t v = this->read_varint();
+        return static_cast<int64_t>((v >> 1) ^ (~(v & 1) + 1));
+      }
+      case JSONBinaryType::FLOAT_VALUE:
+        return this->r.get_f64l();
+      case JSONBinaryType::STRING_VALUE:
+        return this->read_string();
+      case JSONBinaryType::LIST_VALUE: {
+        size_t count = this->read_item_count();
+        JSON ret = JSON::list();
+        ret.as_list().reserve(count);
+        for (size_t z = 0; z < count; z++) {
+          ret.emplace_back(this->parse_value());
+        }
+        return ret;
+      }
+      case JSONBinaryType::DICT_VALUE: {
+        size_t count = this->read_item_count();
+        JSON ret = JSON::dict();
+        ret.as_dict().reserve(count);
+        for (size_t z = 0; z < count; z++) {
+          JSON::dict_key_type key = this->keys.get(this->read_string());
+          ret.as_dict().emplace(std::move(key), new JSON(this->parse_value()));
+        }
+        return ret;
+      }
+      default:
+        throw JSON::parse_error(std::format("unknown binary JSON type {:02X}; pos={}", type, this->r.where() - 1));
+    }
+  }
+};
+
+string JSON::serialize_binary(bool deduplicate_strings) const {
+  string ret;
+  JSONBinarySerializer(ret, deduplicate_strings).write_root(*this);
+  return ret;
+}
+
+void JSON::serialize_binary(StringWriter& w, bool deduplicate_strings) const {
+  JSONBinarySerializer(w.str(), deduplicate_strings).write_root(*this);
+}
+
+JSON JSON::parse_binary(StringReader& r) {
+  return JSONBinaryParser(r).parse_root();
+}
+
+JSON JSON::parse_binary(const void* data, size_t size) {
+  StringReader r(data, size);
+  JSON ret = JSON::parse_binary(r);
+  if (!r.eof()) {
+    throw parse_error("extra data after end of binary JSON value");
+  }
+  return ret;
+}
+
+JSON JSON::parse_binary(const string& data) {
+  return JSON::parse_binary(data.data(), data.size());
+}
+
+JSON::JSON() : value(nullptr) {}
+
+JSON::JSON(nullptr_t) : value(nullptr) {}
+
+JSON::JSON(bool x) : value(x) {}
+
+JSON::JSON(const char* s) {
+  this->value = string(s);
+}
+
+JSON::JSON(const char* s, size_t size) {
+  this->value = string(s, size);
+}
+
+JSON::JSON(const string& x) : value(x) {}
+
+JSON::JSON(string&& x) : value(std::move(x)) {}
+
+JSON::JSON(int64_t x) : value(x) {}
+
+JSON::JSON(double x) : value(x) {}
+
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+JSON::JSON(list_type&& x) : value(make_shared_container(std::move(x))) {}
+
+JSON::JSON(dict_type&& x) : value(make_shared_container(std::move(x))) {}
+
+template <typename ContainerT>
+shared_ptr<JSON::SharedContainer<ContainerT>> JSON::make_shared_container(ContainerT&& items) {
+  // If an arena is active, the caller may be about to add arena-allocated
+  // items to the container
+  return make_shared<SharedContainer<ContainerT>>(std::move(items), (JSONArena::active() != nullptr));
+}
+
+template <typename ContainerT>
+ContainerT& JSON::unshare_container(shared_ptr<SharedContainer<ContainerT>>& storage) {
+  if (storage.use_count() > 1) {
+    storage = make_shared_container(copy_items(storage->items));
+    return storage->items;
+  }
+
+  // use_count is a relaxed load. If another thread just destroyed its copy of
+  // this container, its earlier reads of the container must happen before we
+  // modify it; the shared_ptr's release decrement synchronizes with this fence
+  atomic_thread_fence(memory_order_acquire);
+  if (JSONArena::active()) {
+    storage->may_contain_arena_items = true;
+  }
+  return storage->items;
+}
+
+#else
+JSON::JSON(list_type&& x) : value(std::move(x)) {}
+
+JSON::JSON(dict_type&& x) : value(std::move(x)) {}
+#endif
+
+JSON::list_type JSON::copy_items(const list_type& items) {
+  list_type ret;
+  ret.reserve(items.size());
+  for (const auto& item : items) {
+    ret.emplace_back(new JSON(*item));
+  }
+  return ret;
+}
+
+JSON::dict_type JSON::copy_items(const dict_type& items) {
+  dict_type ret;
+  ret.reserve(items.size());
+  for (const auto& it : items) {
+    ret.emplace(it.first, new JSON(*it.second));
+  }
+  return ret;
+}
+
+JSON::JSON(const JSON& rhs) : value(nullptr) {
+  this->operator=(rhs);
 }
 
 JSON& JSON::operator=(const JSON& rhs) {
@@ -482,293 +1936,1646 @@ JSON& JSON::operator=(const JSON& rhs) {
     case 3:
       this->value = ::get<3>(rhs.value);
       break;
-    case 4:
-      this->value = ::get<4>(rhs.value);
+    case 4:
+      this->value = ::get<4>(rhs.value);
+      break;
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+    // rhs may be contained in this, so we copy its storage pointer before
+    // assigning it
+    case 5: {
+      list_storage_type storage = ::get<5>(rhs.value);
+      if (storage->may_contain_arena_items) {
+        storage = make_shared_container(copy_items(storage->items));
+      }
+      this->value = std::move(storage);
+      break;
+    }
+    case 6: {
+      dict_storage_type storage = ::get<6>(rhs.value);
+      if (storage->may_contain_arena_items) {
+        storage = make_shared_container(copy_items(storage->items));
+      }
+      this->value = std::move(storage);
+      break;
+    }
+#else
+    case 5:
+      this->value = copy_items(::get<5>(rhs.value));
+      break;
+    case 6:
+      this->value = copy_items(::get<6>(rhs.value));
+      break;
+#endif
+    case 7:
+      // Copies of borrowed strings own their contents
+      this->value = string(::get<7>(rhs.value).data);
+      break;
+    default:
+      throw logic_error("invalid JSON value type");
+  }
+  return *this;
+}
+
+static inline partial_ordering partial_ordering_for_string_compare_result(int res) {
+  if (res < 0) {
+    return partial_ordering::less;
+  } else if (res > 0) {
+    return partial_ordering::greater;
+  } else {
+    return partial_ordering::equivalent;
+  }
+}
+
+partial_ordering JSON::operator<=>(const JSON& other) const {
+  size_t this_index = this->value.index();
+  size_t other_index = other.value.index();
+
+  // Allow cross-type int/float comparisons, and comparisons between owned and
+  // borrowed strings
+  if (this_index == 2 && other_index == 3) {
+    return ::get<2>(this->value) <=> ::get<3>(other.value);
+  } else if (this_index == 3 && other_index == 2) {
+    return ::get<3>(this->value) <=> ::get<2>(other.value);
+  } else if (this->is_string() && other.is_string()) {
+    return partial_ordering_for_string_compare_result(this->as_string_view().compare(other.as_string_view()));
+  }
+
+  if (this_index != other_index) {
+    return partial_ordering::unordered;
+  }
+  switch (this_index) {
+    case 0:
+      return partial_ordering::equivalent;
+    case 1: {
+      const bool* other_v = ::get_if<1>(&other.value);
+      return (other_v == nullptr ? partial_ordering::unordered : this->operator<=>(*other_v));
+    }
+    case 2:
+    case 3: {
+      const int64_t* other_vi = ::get_if<2>(&other.value);
+      if (other_vi) {
+        return this->operator<=>(*other_vi);
+      }
+      const double* other_vf = ::get_if<3>(&other.value);
+      return (other_vf == nullptr ? partial_ordering::unordered : this->operator<=>(*other_vf));
+    }
+    case 5:
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+      // Copies that share the same container are always equal
+      if ((other_index == 5) && (::get<5>(this->value) == ::get<5>(other.value))) {
+        return partial_ordering::equivalent;
+      }
+#endif
+      return (other_index != 5 ? partial_ordering::unordered : this->operator<=>(other.as_list()));
+    case 6:
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+      if ((other_index == 6) && (::get<6>(this->value) == ::get<6>(other.value))) {
+        return partial_ordering::equivalent;
+      }
+#endif
+      return (other_index != 6 ? partial_ordering::unordered : this->operator<=>(other.as_dict()));
+    default:
+      throw logic_error("invalid JSON value type");
+  }
+}
+
+partial_ordering JSON::operator<=>(nullptr_t) const {
+  const nullptr_t* stored_v = get_if<0>(&this->value);
+  return (stored_v == nullptr ? partial_ordering::unordered : partial_ordering::equivalent);
+}
+
+partial_ordering JSON::operator<=>(bool v) const {
+  const bool* stored_v = get_if<1>(&this->value);
+  return (stored_v == nullptr ? partial_ordering::unordered : (*stored_v <=> v));
+}
+
+partial_ordering JSON::operator<=>(const char* v) const {
+  return (!this->is_string()
+          ? partial_ordering::unordered
+          : partial_ordering_for_string_compare_result(this->as_string_view().compare(v)));
+}
+partial_ordering JSON::operator<=>(const string& v) const {
+  return (!this->is_string()
+          ? partial_ordering::unordered
+          : partial_ordering_for_string_compare_result(this->as_string_view().compare(v)));
+}
+
+partial_ordering JSON::operator<=>(const list_type& v) const {
+  if (!this->is_list()) {
+    return partial_ordering::unordered;
+  }
+  const list_type* stored_v = &this->as_list();
+  // Note: We don't use vector::operator<=> here because the items are pointers,
+  // and we want to compare the pointed-to objects instead.
+  size_t max_size = min<size_t>(stored_v->size(), v.size());
+  for (size_t z = 0; z < max_size; z++) {
+    partial_ordering item_ret = *(*stored_v)[z] <=> *v[z];
+    if (item_ret != 0) {
+      return item_ret;
+    }
+  }
+  // If we get here, then all possible items matched. If the sizes aren't equal
+  // and stored_v is longer, then stored_v is greater than v; if v is longer,
+  // then v is greater than stored_v.
+  return stored_v->size() <=> v.size();
+}
+
+partial_ordering JSON::operator<=>(const dict_type& v) const {
+  if (!this->is_dict()) {
+    return partial_ordering::unordered;
+  }
+  const dict_type* stored_v = &this->as_dict();
+  // If the dict sizes are equal and all key/value pairs match, then the overall
+  // result is equality; otherwise, it's inequality. There is no ordering for
+  // dictionary-typed values.
+  if (stored_v->size() != v.size()) {
+    return partial_ordering::unordered;
+  }
+  for (const auto& it : v) {
+    auto stored_it = stored_v->find(it.first);
+    if ((stored_it == stored_v->end()) || ((*stored_it->second <=> *it.second) != partial_ordering::equivalent)) {
+      return partial_ordering::unordered;
+    }
+  }
+  // If we get here, then there were the same number of keys in both maps, all
+  // keys in v were also in stored_v, and the corresponding values were all
+  // equal. Therefore, the overall maps are equivalent.
+  return partial_ordering::equivalent;
+}
+
+JSON& JSON::at(const string& key) {
+  JSON* ret = this->find(key);
+  if (!ret) {
+    throw out_of_range("JSON key not present: " + key);
+  }
+  return *ret;
+}
+
+const JSON& JSON::at(const string& key) const {
+  const JSON* ret = this->find(key);
+  if (!ret) {
+    throw out_of_range("JSON key not present: " + key);
+  }
+  return *ret;
+}
+
+JSON& JSON::at(size_t index) {
+  auto& list = this->as_list();
+  if (index >= list.size()) {
+    throw out_of_range("JSON array index out of bounds");
+  }
+  return *list[index];
+}
+
+const JSON& JSON::at(size_t index) const {
+  const auto& list = this->as_list();
+  if (index >= list.size()) {
+    throw out_of_range("JSON array index out of bounds");
+  }
+  return *list[index];
+}
+
+JSON* JSON::find(const string& key) {
+  auto& dict = this->as_dict();
+  auto it = dict.find(key);
+  return (it == dict.end()) ? nullptr : it->second.get();
+}
+
+const JSON* JSON::find(const string& key) const {
+  const auto& dict = this->as_dict();
+  auto it = dict.find(key);
+  return (it == dict.end()) ? nullptr : it->second.get();
+}
+
+JSON* JSON::find(size_t index) {
+  auto& list = this->as_list();
+  return (index < list.size()) ? list[index].get() : nullptr;
+}
+
+const JSON* JSON::find(size_t index) const {
+  const auto& list = this->as_list();
+  return (index < list.size()) ? list[index].get() : nullptr;
+}
+
+JSON::dict_type& JSON::as_dict() {
+  if (!this->is_dict()) {
+    throw type_error("JSON value cannot be accessed as a dict");
+  }
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+  return unshare_container(::get<dict_storage_type>(this->value));
+#else
+  return ::get<dict_type>(this->value);
+#endif
+}
+
+const JSON::dict_type& JSON::as_dict() const {
+  if (!this->is_dict()) {
+    throw type_error("JSON value cannot be accessed as a dict");
+  }
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+  return ::get<dict_storage_type>(this->value)->items;
+#else
+  return ::get<dict_type>(this->value);
+#endif
+}
+
+JSON::list_type& JSON::as_list() {
+  if (!this->is_list()) {
+    throw type_error("JSON value cannot be accessed as a list");
+  }
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+  return unshare_container(::get<list_storage_type>(this->value));
+#else
+  return ::get<list_type>(this->value);
+#endif
+}
+
+const JSON::list_type& JSON::as_list() const {
+  if (!this->is_list()) {
+    throw type_error("JSON value cannot be accessed as a list");
+  }
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+  return ::get<list_storage_type>(this->value)->items;
+#else
+  return ::get<list_type>(this->value);
+#endif
+}
+
+int64_t JSON::as_int() const {
+  if (this->is_int()) {
+    return ::get<int64_t>(this->value);
+  } else if (this->is_float()) {
+    return ::get<double>(this->value);
+  } else {
+    throw type_error("JSON value cannot be accessed as an int");
+  }
+}
+
+double JSON::as_float() const {
+  if (this->is_int()) {
+    return ::get<int64_t>(this->value);
+  } else if (this->is_float()) {
+    return ::get<double>(this->value);
+  } else {
+    throw type_error("JSON value cannot be accessed as a float");
+  }
+}
+
+string& JSON::as_string() {
+  if (!this->is_string()) {
+    throw type_error("JSON value cannot be accessed as a string");
+  }
+  if (holds_alternative<BorrowedString>(this->value)) {
+    this->value = string(::get<BorrowedString>(this->value).data);
+  }
+  return ::get<string>(this->value);
+}
+
+const string& JSON::as_string() const {
+  if (!this->is_string()) {
+    throw type_error("JSON value cannot be accessed as a string");
+  }
+  const BorrowedString* borrowed = ::get_if<BorrowedString>(&this->value);
+  if (!borrowed) {
+    return ::get<string>(this->value);
+  }
+
+  // If another thread makes a copy at the same time, the first one to finish
+  // wins, and the other thread's copy is discarded
+  const string* owned_copy = borrowed->owned_copy.load(memory_order_acquire);
+  if (!owned_copy) {
+    auto new_owned_copy = make_unique<const string>(borrowed->data);
+    if (borrowed->owned_copy.compare_exchange_strong(
+            owned_copy, new_owned_copy.get(), memory_order_acq_rel, memory_order_acquire)) {
+      owned_copy = new_owned_copy.release();
+    }
+  }
+  return *owned_copy;
+}
+
+string_view JSON::as_string_view() const {
+  if (holds_alternative<string>(this->value)) {
+    return ::get<string>(this->value);
+  } else if (holds_alternative<BorrowedString>(this->value)) {
+    return ::get<BorrowedString>(this->value).data;
+  } else {
+    throw type_error("JSON value cannot be accessed as a string");
+  }
+}
+
+JSON::BorrowedString::BorrowedString(string_view data)
+    : data(data),
+      owned_copy(nullptr) {}
+
+JSON::BorrowedString::BorrowedString(const BorrowedString& other)
+    : data(other.data),
+      owned_copy(nullptr) {}
+
+JSON::BorrowedString::BorrowedString(BorrowedString&& other)
+    : data(other.data),
+      owned_copy(other.owned_copy.exchange(nullptr)) {}
+
+JSON::BorrowedString& JSON::BorrowedString::operator=(const BorrowedString& other) {
+  this->data = other.data;
+  delete this->owned_copy.exchange(nullptr);
+  return *this;
+}
+
+JSON::BorrowedString& JSON::BorrowedString::operator=(BorrowedString&& other) {
+  this->data = other.data;
+  delete this->owned_copy.exchange(other.owned_copy.exchange(nullptr));
+  return *this;
+}
+
+JSON::BorrowedString::~BorrowedString() {
+  delete this->owned_copy.load();
+}
+
+JSON JSON::borrowed_string(string_view s) {
+  JSON ret;
+  ret.value.emplace<BorrowedString>(s);
+  return ret;
+}
+
+bool JSON::as_bool() const {
+  if (!this->is_bool()) {
+    throw type_error("JSON value cannot be accessed as a bool");
+  }
+  return ::get<bool>(this->value);
+}
+
+size_t JSON::size() const {
+  switch (this->value.index()) {
+    case 5:
+      return this->as_list().size();
+    case 6:
+      return this->as_dict().size();
+    default:
+      throw type_error("cannot get size of primitive JSON value");
+  }
+}
+
+bool JSON::empty() const {
+  switch (this->value.index()) {
+    case 5:
+      return this->as_list().empty();
+    case 6:
+      return this->as_dict().empty();
+    default:
+      throw type_error("cannot get empty property of primitive JSON value");
+  }
+}
+
+void JSON::clear() {
+  // With shared containers, we replace the container instead of clearing it,
+  // since there's no need to copy it if it's shared
+  switch (this->value.index()) {
+    case 5:
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+      this->value = make_shared_container(list_type());
+#else
+      ::get<5>(this->value).clear();
+#endif
+      break;
+    case 6:
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+      this->value = make_shared_container(dict_type());
+#else
+      ::get<6>(this->value).clear();
+#endif
       break;
-    case 5: {
-      this->value = vector<unique_ptr<JSON>>();
-      auto& v = ::get<5>(this->value);
-      v.reserve(rhs.size());
-      for (const auto& item : (::get<5>(rhs.value))) {
-        v.emplace_back(new JSON(*item));
+    default:
+      throw type_error("cannot clear primitive JSON value");
+  }
+}
+
+// Every heap-allocated JSON object is preceded by a header that says whether
+// it came from an arena or from the global heap, so operator delete knows
+// whether it needs to free anything. On most allocators this doesn't actually
+// increase the allocation size, since sizeof(JSON) + 8 falls in the same size
+// class as sizeof(JSON).
+static constexpr size_t JSON_ALLOCATION_HEADER_SIZE = sizeof(uint64_t);
+static constexpr uint64_t JSON_ALLOCATION_FROM_HEAP = 0x4845415048454150;
+static constexpr uint64_t JSON_ALLOCATION_FROM_ARENA = 0x4152454E41524541;
+static_assert(alignof(JSON) <= JSON_ALLOCATION_HEADER_SIZE);
+
+static thread_local JSONArena* active_json_arena = nullptr;
+
+void* JSON::operator new(size_t size) {
+  uint8_t* header;
+  if (active_json_arena) {
+    header = reinterpret_cast<uint8_t*>(active_json_arena->allocate(size + JSON_ALLOCATION_HEADER_SIZE));
+    *reinterpret_cast<uint64_t*>(header) = JSON_ALLOCATION_FROM_ARENA;
+  } else {
+    header = reinterpret_cast<uint8_t*>(::operator new(size + JSON_ALLOCATION_HEADER_SIZE));
+    *reinterpret_cast<uint64_t*>(header) = JSON_ALLOCATION_FROM_HEAP;
+  }
+  return header + JSON_ALLOCATION_HEADER_SIZE;
+}
+
+void JSON::operator delete(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  // If the object came from an arena, its memory is freed when the arena is
+  // destroyed, so there's nothing to do here
+  uint8_t* header = reinterpret_cast<uint8_t*>(ptr) - JSON_ALLOCATION_HEADER_SIZE;
+  if (*reinterpret_cast<const uint64_t*>(header) != JSON_ALLOCATION_FROM_ARENA) {
+    ::operator delete(header);
+  }
+}
+
+JSONArena::JSONArena(size_t block_size)
+    : block_size(block_size),
+      block_ptr(nullptr),
+      block_bytes_remaining(0),
+      total_bytes_allocated(0) {}
+
+void* JSONArena::allocate(size_t size) {
+  // All allocations are rounded up to 8 bytes, so every object in the arena is
+  // suitably aligned for JSON
+  size = (size + 7) & (~7);
+  if (size > this->block_bytes_remaining) {
+    size_t new_block_size = max<size_t>(size, this->block_size);
+    this->block_ptr = this->blocks.emplace_back(new uint8_t[new_block_size]).get();
+    this->block_bytes_remaining = new_block_size;
+  }
+  void* ret = this->block_ptr;
+  this->block_ptr += size;
+  this->block_bytes_remaining -= size;
+  this->total_bytes_allocated += size;
+  return ret;
+}
+
+JSONArena* JSONArena::active() {
+  return active_json_arena;
+}
+
+JSONArena::Scope::Scope(JSONArena& arena) : prev_arena(active_json_arena) {
+  active_json_arena = &arena;
+}
+
+JSONArena::Scope::~Scope() {
+  active_json_arena = this->prev_arena;
+}
+
+JSONDocument::JSONDocument() : arena_ptr(make_unique<JSONArena>()) {}
+
+JSONDocument::JSONDocument(StringReader& r, bool disable_extensions)
+    : arena_ptr(make_unique<JSONArena>()) {
+  JSONArena::Scope scope(*this->arena_ptr);
+  this->root_value = JSON::parse(r, disable_extensions);
+}
+
+JSONDocument::JSONDocument(const char* s, size_t size, bool disable_extensions)
+    : arena_ptr(make_unique<JSONArena>()) {
+  JSONArena::Scope scope(*this->arena_ptr);
+  this->root_value = JSON::parse_fast(s, size, disable_extensions);
+}
+
+JSONDocument::JSONDocument(const string& s, bool disable_extensions)
+    : JSONDocument(s.data(), s.size(), disable_extensions) {}
+
+JSONDocument::JSONDocument(shared_ptr<const string> source, bool disable_extensions)
+    : arena_ptr(make_unique<JSONArena>()),
+      source_data(std::move(source)) {
+  JSONArena::Scope scope(*this->arena_ptr);
+  this->root_value = parse_json_fast(this->source_data->data(), this->source_data->size(), disable_extensions, true);
+}
+
+JSONDocument& JSONDocument::operator=(JSONDocument&& other) {
+  // The default implementation would destroy our arena and source before our
+  // root, so we have to destroy the root explicitly first
+  this->root_value = nullptr;
+  this->arena_ptr = std::move(other.arena_ptr);
+  this->source_data = std::move(other.source_data);
+  this->root_value = std::move(other.root_value);
+  return *this;
+}
+
+JSONEventReader::JSONEventReader(StringReader& r, bool disable_extensions)
+    : r(r),
+      disable_extensions(disable_extensions),
+      root_started(false) {}
+
+JSONEventReader::Event JSONEventReader::start_value() {
+  char ch = this->r.get_s8(false);
+  if (ch == '[') {
+    this->r.get_s8();
+    this->stack.emplace_back(State::LIST_START);
+    return Event::START_LIST;
+  } else if (ch == '{') {
+    this->r.get_s8();
+    this->stack.emplace_back(State::DICT_START);
+    return Event::START_DICT;
+  } else {
+    this->current_value = JSON::parse(this->r, this->disable_extensions);
+    return Event::VALUE;
+  }
+}
+
+JSONEventReader::Event JSONEventReader::next() {
+  skip_whitespace_and_comments(this->r, this->disable_extensions);
+
+  if (this->stack.empty()) {
+    if (this->root_started) {
+      return Event::END;
+    }
+    this->root_started = true;
+    return this->start_value();
+  }
+
+  State& state = this->stack.back();
+  switch (state) {
+    case State::LIST_START:
+    case State::LIST_ITEM: {
+      if (state == State::LIST_ITEM) {
+        char separator = this->r.get_s8();
+        if (separator == ']') {
+          this->stack.pop_back();
+          return Event::END_LIST;
+        } else if (separator != ',') {
+          throw JSON::parse_error("string is not a list; pos=" + to_string(this->r.where()));
+        }
+        skip_whitespace_and_comments(this->r, this->disable_extensions);
       }
-      break;
+      // Like JSON::parse, a closing bracket is always allowed immediately after
+      // the opening bracket, and after a trailing comma if extensions are on
+      if (((state == State::LIST_START) || !this->disable_extensions) && (this->r.get_s8(false) == ']')) {
+        this->r.get_s8();
+        this->stack.pop_back();
+        return Event::END_LIST;
+      }
+      state = State::LIST_ITEM;
+      return this->start_value();
     }
-    case 6: {
-      this->value = unordered_map<string, unique_ptr<JSON>>();
-      auto& v = ::get<6>(this->value);
-      for (const auto& it : (::get<6>(rhs.value))) {
-        v.emplace(it.first, new JSON(*it.second));
+
+    case State::DICT_START:
+    case State::DICT_VALUE: {
+      if (state == State::DICT_VALUE) {
+        char separator = this->r.get_s8();
+        if (separator == '}') {
+          this->stack.pop_back();
+          return Event::END_DICT;
+        } else if (separator != ',') {
+          throw JSON::parse_error("string is not a dictionary; pos=" + to_string(this->r.where()));
+        }
+        skip_whitespace_and_comments(this->r, this->disable_extensions);
+      }
+      if (((state == State::DICT_START) || !this->disable_extensions) && (this->r.get_s8(false) == '}')) {
+        this->r.get_s8();
+        this->stack.pop_back();
+        return Event::END_DICT;
+      }
+      this->current_key = std::move(JSON::parse(this->r, this->disable_extensions).as_string());
+      state = State::DICT_KEY;
+      return Event::KEY;
+    }
+
+    case State::DICT_KEY:
+      if (this->r.get_s8() != ':') {
+        throw JSON::parse_error("dictionary does not contain key/value pairs; pos=" + to_string(this->r.where()));
+      }
+      skip_whitespace_and_comments(this->r, this->disable_extensions);
+      state = State::DICT_VALUE;
+      return this->start_value();
+
+    default:
+      throw logic_error("invalid JSON event reader state");
+  }
+}
+
+JSONPushParser::JSONPushParser(bool disable_extensions)
+    : disable_extensions(disable_extensions),
+      offset(0),
+      token_type(TokenType::NONE),
+      token_has_escapes(false),
+      token_escape_pending(false),
+      keys(make_unique<JSONDictKeyTable>()) {}
+
+JSONPushParser::JSONPushParser(JSONPushParser&&) = default;
+JSONPushParser& JSONPushParser::operator=(JSONPushParser&&) = default;
+JSONPushParser::~JSONPushParser() = default;
+
+void JSONPushParser::feed(const void* data, size_t size) {
+  const char* p = reinterpret_cast<const char*>(data);
+  const char* end = p + size;
+  while (p < end) {
+    // If a token was split across calls to feed(), continue it first. Each
+    // of these loops either consumes the rest of the input or ends the token.
+    if (this->token_type == TokenType::STRING) {
+      const char* token_begin = p;
+      for (; p < end; p++) {
+        if (this->token_escape_pending) {
+          this->token_escape_pending = false;
+        } else if (*p == '\\') {
+          this->token_escape_pending = true;
+          this->token_has_escapes = true;
+        } else if (*p == '\"') {
+          break;
+        }
+      }
+      this->token.append(token_begin, p - token_begin);
+      this->offset += p - token_begin;
+      if (p < end) {
+        p++;
+        this->offset++;
+        this->finish_string();
+      }
+      continue;
+
+    } else if ((this->token_type == TokenType::NUMBER) || (this->token_type == TokenType::CONSTANT)) {
+      const char* token_begin = p;
+      if (this->token_type == TokenType::NUMBER) {
+        for (; (p < end) && (isalnum(*p) || (*p == '.') || (*p == '+') || (*p == '-')); p++) {
+        }
+      } else {
+        for (; (p < end) && isalpha(*p); p++) {
+        }
+      }
+      this->token.append(token_begin, p - token_begin);
+      this->offset += p - token_begin;
+      if (p < end) {
+        this->finish_token();
+      }
+      continue;
+
+    } else if (this->token_type == TokenType::COMMENT) {
+      const char* token_begin = p;
+      for (; (p < end) && (*p != '\n') && (*p != '\r'); p++) {
+      }
+      this->offset += p - token_begin;
+      if (p < end) {
+        this->token_type = TokenType::NONE;
+      }
+      continue;
+
+    } else if (this->token_type == TokenType::SLASH) {
+      if (*p != '/') {
+        throw JSON::parse_error("invalid comment; pos=" + to_string(this->offset));
+      }
+      this->token_type = TokenType::COMMENT;
+      p++;
+      this->offset++;
+      continue;
+    }
+
+    char ch = *p;
+    if (is_json_whitespace(ch)) {
+      p++;
+      this->offset++;
+      continue;
+    }
+    if (!this->disable_extensions && (ch == '/')) {
+      this->token_type = TokenType::SLASH;
+      p++;
+      this->offset++;
+      continue;
+    }
+
+    if (this->stack.empty()) {
+      this->start_value(ch);
+    } else {
+      Frame& frame = this->stack.back();
+      switch (frame.state) {
+        case State::LIST_START:
+        case State::LIST_COMMA:
+          // Like JSON::parse, a closing bracket is always allowed immediately
+          // after the opening bracket, and after a trailing comma if
+          // extensions are on
+          if ((ch == ']') && ((frame.state == State::LIST_START) || !this->disable_extensions)) {
+            JSON list = std::move(frame.container);
+            this->stack.pop_back();
+            this->add_value(std::move(list));
+          } else {
+            this->start_value(ch);
+          }
+          break;
+        case State::LIST_ITEM:
+          if (ch == ',') {
+            frame.state = State::LIST_COMMA;
+          } else if (ch == ']') {
+            JSON list = std::move(frame.container);
+            this->stack.pop_back();
+            this->add_value(std::move(list));
+          } else {
+            throw JSON::parse_error("string is not a list; pos=" + to_string(this->offset));
+          }
+          break;
+        case State::DICT_START:
+        case State::DICT_COMMA:
+          if ((ch == '}') && ((frame.state == State::DICT_START) || !this->disable_extensions)) {
+            JSON dict = std::move(frame.container);
+            this->stack.pop_back();
+            this->add_value(std::move(dict));
+          } else if (ch == '\"') {
+            this->start_value(ch);
+          } else {
+            throw JSON::parse_error("dictionary key is not a string; pos=" + to_string(this->offset));
+          }
+          break;
+        case State::DICT_KEY:
+          if (ch != ':') {
+            throw JSON::parse_error("dictionary does not contain key/value pairs; pos=" + to_string(this->offset));
+          }
+          frame.state = State::DICT_COLON;
+          break;
+        case State::DICT_COLON:
+          this->start_value(ch);
+          break;
+        case State::DICT_VALUE:
+          if (ch == ',') {
+            frame.state = State::DICT_COMMA;
+          } else if (ch == '}') {
+            JSON dict = std::move(frame.container);
+            this->stack.pop_back();
+            this->add_value(std::move(dict));
+          } else {
+            throw JSON::parse_error("string is not a dictionary; pos=" + to_string(this->offset));
+          }
+          break;
+        default:
+          throw logic_error("invalid JSON push parser state");
+      }
+    }
+
+    // Numbers and constants are consumed by the token loops above, including
+    // their first characters
+    if ((this->token_type != TokenType::NUMBER) && (this->token_type != TokenType::CONSTANT)) {
+      p++;
+      this->offset++;
+    }
+  }
+}
+
+void JSONPushParser::finish() {
+  if ((this->token_type == TokenType::NUMBER) || (this->token_type == TokenType::CONSTANT)) {
+    this->finish_token();
+  } else if (this->token_type == TokenType::COMMENT) {
+    this->token_type = TokenType::NONE;
+  }
+  if (this->in_value()) {
+    throw JSON::parse_error("incomplete value at end of input; pos=" + to_string(this->offset));
+  }
+}
+
+void JSONPushParser::reset() {
+  this->offset = 0;
+  this->token_type = TokenType::NONE;
+  this->token_has_escapes = false;
+  this->token_escape_pending = false;
+  this->token.clear();
+  this->stack.clear();
+  this->completed_values.clear();
+  this->keys->clear();
+}
+
+JSON JSONPushParser::get_value() {
+  if (this->completed_values.empty()) {
+    throw out_of_range("no complete JSON values are available");
+  }
+  JSON ret = std::move(this->completed_values.front());
+  this->completed_values.pop_front();
+  return ret;
+}
+
+void JSONPushParser::start_value(char ch) {
+  if (ch == '{') {
+    this->stack.emplace_back(Frame{State::DICT_START, JSON::dict(), {}});
+  } else if (ch == '[') {
+    this->stack.emplace_back(Frame{State::LIST_START, JSON::list(), {}});
+  } else {
+    if (ch == '\"') {
+      this->token_type = TokenType::STRING;
+      this->token_has_escapes = false;
+      this->token_escape_pending = false;
+    } else if ((ch == '-') || (ch == '+') || isdigit(ch)) {
+      this->token_type = TokenType::NUMBER;
+    } else if (isalpha(ch)) {
+      this->token_type = TokenType::CONSTANT;
+    } else {
+      throw JSON::parse_error("unknown root sentinel; pos=" + to_string(this->offset));
+    }
+    this->token.clear();
+  }
+}
+
+void JSONPushParser::finish_token() {
+  size_t token_offset = 0;
+  JSON value;
+  try {
+    if (this->token_type == TokenType::NUMBER) {
+      value = parse_json_number_value(this->token.data(), this->token.size(), token_offset, this->disable_extensions);
+    } else if (!parse_json_constant_value(value, this->token.data(), this->token.size(), token_offset, this->disable_extensions)) {
+      token_offset = 0;
+    }
+  } catch (const out_of_range&) {
+    token_offset = 0;
+  }
+  if (token_offset != this->token.size()) {
+    throw JSON::parse_error("invalid scalar value; pos=" + to_string(this->offset - this->token.size()));
+  }
+  this->token_type = TokenType::NONE;
+  this->add_value(std::move(value));
+}
+
+void JSONPushParser::finish_string() {
+  string s;
+  if (this->token_has_escapes) {
+    // The string parser expects the surrounding quotes to be present
+    string quoted;
+    quoted.reserve(this->token.size() + 2);
+    quoted.push_back('\"');
+    quoted += this->token;
+    quoted.push_back('\"');
+    size_t token_offset = 0;
+    s = parse_json_string_value(quoted.data(), quoted.size(), token_offset);
+  } else {
+    s = std::move(this->token);
+  }
+  this->token.clear();
+  this->token_type = TokenType::NONE;
+
+  if (!this->stack.empty() &&
+      ((this->stack.back().state == State::DICT_START) || (this->stack.back().state == State::DICT_COMMA))) {
+    this->stack.back().key = this->keys->get(std::move(s));
+    this->stack.back().state = State::DICT_KEY;
+  } else {
+    this->add_value(std::move(s));
+  }
+}
+
+void JSONPushParser::add_value(JSON&& value) {
+  if (this->stack.empty()) {
+    this->completed_values.emplace_back(std::move(value));
+    // Interned keys are only shared within each top-level value, so the table
+    // doesn't grow without bound on long streams
+    this->keys->clear();
+    return;
+  }
+  Frame& frame = this->stack.back();
+  if (frame.container.is_list()) {
+    frame.container.emplace_back(std::move(value));
+    frame.state = State::LIST_ITEM;
+  } else {
+    frame.container.as_dict().emplace(std::move(frame.key), new JSON(std::move(value)));
+    frame.state = State::DICT_VALUE;
+  }
+}
+
+JSONPath::JSONPath(const string& path, bool enable_selectors) : path(path), contains_selectors(false) {
+  if (path.empty()) {
+    return;
+  }
+  if (path[0] != '/') {
+    throw invalid_argument("JSON path must be empty or begin with /");
+  }
+
+  for (size_t offset = 1; offset <= path.size();) {
+    size_t end_offset = path.find('/', offset);
+    if (end_offset == string::npos) {
+      end_offset = path.size();
+    }
+
+    string token;
+    token.reserve(end_offset - offset);
+    for (size_t z = offset; z < end_offset; z++) {
+      if (path[z] != '~') {
+        token.push_back(path[z]);
+      } else if ((z + 1 < end_offset) && (path[z + 1] == '0')) {
+        token.push_back('~');
+        z++;
+      } else if ((z + 1 < end_offset) && (path[z + 1] == '1')) {
+        token.push_back('/');
+        z++;
+      } else {
+        throw invalid_argument("invalid escape sequence in JSON path");
+      }
+    }
+
+    auto& c = this->components.emplace_back();
+    c.index = SIZE_MAX;
+    c.has_filter_value = false;
+    if (enable_selectors && (token == "*")) {
+      c.type = ComponentType::WILDCARD;
+      this->contains_selectors = true;
+    } else if (enable_selectors && !token.empty() && (token[0] == '?')) {
+      c.type = ComponentType::FILTER;
+      this->contains_selectors = true;
+      size_t equals_offset = token.find('=');
+      if (equals_offset == string::npos) {
+        c.key = token.substr(1);
+      } else {
+        c.key = token.substr(1, equals_offset - 1);
+        c.has_filter_value = true;
+        c.filter_value = JSON::parse(token.data() + equals_offset + 1, token.size() - equals_offset - 1);
+      }
+    } else {
+      c.type = ComponentType::KEY;
+      // List indexes must not have leading zeroes, and must fit in a size_t
+      if (!token.empty() && (token.size() <= 19) && ((token[0] != '0') || (token.size() == 1)) &&
+          all_of(token.begin(), token.end(), [](char ch) { return (ch >= '0') && (ch <= '9'); })) {
+        c.index = stoull(token);
+      }
+      c.key = std::move(token);
+    }
+    offset = end_offset + 1;
+  }
+}
+
+void JSONPath::check_no_selectors() const {
+  if (this->contains_selectors) {
+    throw logic_error("JSON path contains selectors and may match multiple values");
+  }
+}
+
+template <typename JSONT>
+JSONT* JSONPath::find(JSONT& root, size_t num_components) const {
+  this->check_no_selectors();
+  JSONT* v = &root;
+  for (size_t z = 0; z < num_components; z++) {
+    const auto& c = this->components[z];
+    if (v->is_dict()) {
+      v = v->find(c.key);
+    } else if (v->is_list() && (c.index != SIZE_MAX)) {
+      v = v->find(c.index);
+    } else {
+      return nullptr;
+    }
+    if (!v) {
+      return nullptr;
+    }
+  }
+  return v;
+}
+
+const JSON* JSONPath::find(const JSON& root) const {
+  return this->find(root, this->components.size());
+}
+
+JSON* JSONPath::find(JSON& root) const {
+  return this->find(root, this->components.size());
+}
+
+JSON* JSONPath::find_parent(JSON& root) const {
+  if (this->components.empty()) {
+    throw logic_error("empty JSON path has no parent");
+  }
+  return this->find(root, this->components.size() - 1);
+}
+
+const string& JSONPath::last_key() const {
+  if (this->components.empty()) {
+    throw logic_error("empty JSON path has no components");
+  }
+  return this->components.back().key;
+}
+
+size_t JSONPath::last_index() const {
+  if (this->components.empty()) {
+    throw logic_error("empty JSON path has no components");
+  }
+  return this->components.back().index;
+}
+
+optional<JSONView> JSONPath::find(const JSONView& root) const {
+  this->check_no_selectors();
+  optional<JSONView> v = root;
+  for (const auto& c : this->components) {
+    if (v->is_dict()) {
+      v = v->find(c.key);
+    } else if (v->is_list() && (c.index != SIZE_MAX)) {
+      v = v->find(c.index);
+    } else {
+      return nullopt;
+    }
+    if (!v.has_value()) {
+      return nullopt;
+    }
+  }
+  return v;
+}
+
+const JSON& JSONPath::at(const JSON& root) const {
+  const JSON* ret = this->find(root);
+  if (!ret) {
+    throw out_of_range("JSON path not present: " + this->path);
+  }
+  return *ret;
+}
+
+JSON& JSONPath::at(JSON& root) const {
+  JSON* ret = this->find(root);
+  if (!ret) {
+    throw out_of_range("JSON path not present: " + this->path);
+  }
+  return *ret;
+}
+
+JSONView JSONPath::at(const JSONView& root) const {
+  auto ret = this->find(root);
+  if (!ret.has_value()) {
+    throw out_of_range("JSON path not present: " + this->path);
+  }
+  return std::move(*ret);
+}
+
+bool JSONPath::filter_matches(const Component& c, const JSON& v) const {
+  if (!v.is_dict()) {
+    return false;
+  }
+  const JSON* item = v.find(c.key);
+  return item && (!c.has_filter_value || (*item == c.filter_value));
+}
+
+bool JSONPath::filter_matches(const Component& c, const JSONView& v) const {
+  if (!v.is_dict()) {
+    return false;
+  }
+  auto item = v.find(c.key);
+  return item.has_value() && (!c.has_filter_value || (item->to_json() == c.filter_value));
+}
+
+void JSONPath::find_all(vector<const JSON*>& ret, const JSON& v, size_t component_index) const {
+  if (component_index == this->components.size()) {
+    ret.emplace_back(&v);
+    return;
+  }
+
+  const auto& c = this->components[component_index];
+  if (c.type == ComponentType::KEY) {
+    const JSON* item = nullptr;
+    if (v.is_dict()) {
+      item = v.find(c.key);
+    } else if (v.is_list() && (c.index != SIZE_MAX)) {
+      item = v.find(c.index);
+    }
+    if (item) {
+      this->find_all(ret, *item, component_index + 1);
+    }
+
+  } else if (v.is_list()) {
+    for (const auto& item : v.as_list()) {
+      if ((c.type == ComponentType::WILDCARD) || this->filter_matches(c, *item)) {
+        this->find_all(ret, *item, component_index + 1);
+      }
+    }
+
+  } else if (v.is_dict()) {
+    for (const auto& it : v.as_dict()) {
+      if ((c.type == ComponentType::WILDCARD) || this->filter_matches(c, *it.second)) {
+        this->find_all(ret, *it.second, component_index + 1);
+      }
+    }
+  }
+}
+
+void JSONPath::find_all(vector<JSONView>& ret, const JSONView& v, size_t component_index) const {
+  if (component_index == this->components.size()) {
+    ret.emplace_back(v);
+    return;
+  }
+
+  const auto& c = this->components[component_index];
+  if (c.type == ComponentType::KEY) {
+    optional<JSONView> item;
+    if (v.is_dict()) {
+      item = v.find(c.key);
+    } else if (v.is_list() && (c.index != SIZE_MAX)) {
+      item = v.find(c.index);
+    }
+    if (item.has_value()) {
+      this->find_all(ret, *item, component_index + 1);
+    }
+
+  } else if (v.is_list()) {
+    for (const auto& item : v.list_items()) {
+      if ((c.type == ComponentType::WILDCARD) || this->filter_matches(c, item)) {
+        this->find_all(ret, item, component_index + 1);
+      }
+    }
+
+  } else if (v.is_dict()) {
+    for (const auto& [key, item] : v.dict_items()) {
+      if ((c.type == ComponentType::WILDCARD) || this->filter_matches(c, item)) {
+        this->find_all(ret, item, component_index + 1);
       }
-      break;
     }
-    default:
-      throw logic_error("invalid JSON value type");
   }
-  return *this;
 }
 
-partial_ordering JSON::operator<=>(const JSON& other) const {
-  size_t this_index = this->value.index();
-  size_t other_index = other.value.index();
+vector<const JSON*> JSONPath::find_all(const JSON& root) const {
+  vector<const JSON*> ret;
+  this->find_all(ret, root, 0);
+  return ret;
+}
 
-  // Allow cross-type int/float comparisons
-  if (this_index == 2 && other_index == 3) {
-    return ::get<2>(this->value) <=> ::get<3>(other.value);
-  } else if (this_index == 3 && other_index == 2) {
-    return ::get<3>(this->value) <=> ::get<2>(other.value);
+vector<JSONView> JSONPath::find_all(const JSONView& root) const {
+  vector<JSONView> ret;
+  this->find_all(ret, root, 0);
+  return ret;
+}
+
+static void append_json_path_component(string& path, string_view key) {
+  path.push_back('/');
+  for (char ch : key) {
+    if (ch == '~') {
+      path += "~0";
+    } else if (ch == '/') {
+      path += "~1";
+    } else {
+      path.push_back(ch);
+    }
   }
+}
 
-  if (this_index != other_index) {
-    return partial_ordering::unordered;
+// The == operator takes its argument by value, which would copy the entire
+// right-hand side, so we use <=> directly instead
+static inline bool json_values_equal(const JSON& a, const JSON& b) {
+  return (a <=> b) == partial_ordering::equivalent;
+}
+
+static void add_json_patch_op(JSON& patch, const char* op, const string& path, const JSON* value) {
+  JSON& item = patch.emplace_back(JSON::dict());
+  item.emplace("op", op);
+  item.emplace("path", path);
+  if (value) {
+    item.emplace("value", JSON(*value));
   }
-  switch (this_index) {
-    case 0:
-      return partial_ordering::equivalent;
-    case 1: {
-      const bool* other_v = ::get_if<1>(&other.value);
-      return (other_v == nullptr ? partial_ordering::unordered : this->operator<=>(*other_v));
+}
+
+// path is the path to from (and to); it's modified during the call but is
+// restored before returning, so the caller can reuse its buffer
+static void diff_json(JSON& patch, string& path, const JSON& from, const JSON& to) {
+  if (from.is_dict() && to.is_dict()) {
+    size_t path_size = path.size();
+    const auto& from_dict = from.as_dict();
+    const auto& to_dict = to.as_dict();
+    for (const auto& it : from_dict) {
+      const string& key = it.first;
+      append_json_path_component(path, key);
+      const JSON* to_value = to.find(key);
+      if (!to_value) {
+        add_json_patch_op(patch, "remove", path, nullptr);
+      } else {
+        diff_json(patch, path, *it.second, *to_value);
+      }
+      path.resize(path_size);
     }
-    case 2:
-    case 3: {
-      const int64_t* other_vi = ::get_if<2>(&other.value);
-      if (other_vi) {
-        return this->operator<=>(*other_vi);
+    for (const auto& it : to_dict) {
+      const string& key = it.first;
+      if (!from.find(key)) {
+        append_json_path_component(path, key);
+        add_json_patch_op(patch, "add", path, it.second.get());
+        path.resize(path_size);
       }
-      const double* other_vf = ::get_if<3>(&other.value);
-      return (other_vf == nullptr ? partial_ordering::unordered : this->operator<=>(*other_vf));
     }
-    case 4: {
-      const string* other_v = ::get_if<4>(&other.value);
-      return (other_v == nullptr ? partial_ordering::unordered : this->operator<=>(*other_v));
+
+  } else if (from.is_list() && to.is_list()) {
+    const auto& from_list = from.as_list();
+    const auto& to_list = to.as_list();
+    size_t prefix_size = 0;
+    size_t max_common_size = min(from_list.size(), to_list.size());
+    while ((prefix_size < max_common_size) && json_values_equal(*from_list[prefix_size], *to_list[prefix_size])) {
+      prefix_size++;
     }
-    case 5: {
-      const list_type* other_v = ::get_if<5>(&other.value);
-      return (other_v == nullptr ? partial_ordering::unordered : this->operator<=>(*other_v));
+    size_t suffix_size = 0;
+    while ((suffix_size < max_common_size - prefix_size) &&
+        json_values_equal(*from_list[from_list.size() - suffix_size - 1], *to_list[to_list.size() - suffix_size - 1])) {
+      suffix_size++;
     }
-    case 6: {
-      const dict_type* other_v = ::get_if<6>(&other.value);
-      return (other_v == nullptr ? partial_ordering::unordered : this->operator<=>(*other_v));
+
+    // Items in the middle at the same position are diffed recursively; then
+    // the remaining items are removed (from the end backward, so the indexes
+    // of the items not yet removed don't change) or added
+    size_t from_end = from_list.size() - suffix_size;
+    size_t to_end = to_list.size() - suffix_size;
+    size_t common_end = min(from_end, to_end);
+    size_t path_size = path.size();
+    for (size_t z = prefix_size; z < common_end; z++) {
+      append_json_path_component(path, to_string(z));
+      diff_json(patch, path, *from_list[z], *to_list[z]);
+      path.resize(path_size);
+    }
+    for (size_t z = from_end; z > common_end; z--) {
+      append_json_path_component(path, to_string(z - 1));
+      add_json_patch_op(patch, "remove", path, nullptr);
+      path.resize(path_size);
+    }
+    for (size_t z = common_end; z < to_end; z++) {
+      append_json_path_component(path, to_string(z));
+      add_json_patch_op(patch, "add", path, to_list[z].get());
+      path.resize(path_size);
     }
-    default:
-      throw logic_error("invalid JSON value type");
-  }
-}
 
-partial_ordering JSON::operator<=>(nullptr_t) const {
-  const nullptr_t* stored_v = get_if<0>(&this->value);
-  return (stored_v == nullptr ? partial_ordering::unordered : partial_ordering::equivalent);
+  } else if (!json_values_equal(from, to)) {
+    add_json_patch_op(patch, "replace", path, &to);
+  }
 }
 
-partial_ordering JSON::operator<=>(bool v) const {
-  const bool* stored_v = get_if<1>(&this->value);
-  return (stored_v == nullptr ? partial_ordering::unordered : (*stored_v <=> v));
+JSON JSON::diff(const JSON& other) const {
+  JSON patch = JSON::list();
+  string path;
+  diff_json(patch, path, *this, other);
+  return patch;
 }
 
-static inline partial_ordering partial_ordering_for_string_compare_result(int res) {
-  if (res < 0) {
-    return partial_ordering::less;
-  } else if (res > 0) {
-    return partial_ordering::greater;
+static void add_json_patch_value(JSON& root, const JSONPath& path, JSON&& value) {
+  if (path.size() == 0) {
+    root = std::move(value);
+    return;
+  }
+  JSON* parent = path.find_parent(root);
+  if (parent && parent->is_dict()) {
+    // Like RFC 6902 specifies, adding an existing key replaces its value
+    auto& dict = parent->as_dict();
+    auto it = dict.find(path.last_key());
+    if (it != dict.end()) {
+      *it->second = std::move(value);
+    } else {
+      dict.emplace(JSON::dict_key_type(path.last_key()), new JSON(std::move(value)));
+    }
+  } else if (parent && parent->is_list()) {
+    auto& list = parent->as_list();
+    size_t index = (path.last_key() == "-") ? list.size() : path.last_index();
+    if (index > list.size()) {
+      throw out_of_range("JSON path not present: " + path.str());
+    }
+    list.emplace(list.begin() + index, new JSON(std::move(value)));
   } else {
-    return partial_ordering::equivalent;
+    throw out_of_range("JSON path not present: " + path.str());
   }
 }
 
-partial_ordering JSON::operator<=>(const char* v) const {
-  const string* stored_v = get_if<4>(&this->value);
-  return (stored_v == nullptr
-          ? partial_ordering::unordered
-          : partial_ordering_for_string_compare_result(stored_v->compare(v)));
-}
-partial_ordering JSON::operator<=>(const string& v) const {
-  const string* stored_v = get_if<4>(&this->value);
-  return (stored_v == nullptr
-          ? partial_ordering::unordered
-          : partial_ordering_for_string_compare_result(stored_v->compare(v)));
-}
-
-partial_ordering JSON::operator<=>(const list_type& v) const {
-  const list_type* stored_v = get_if<5>(&this->value);
-  if (stored_v == nullptr) {
-    return partial_ordering::unordered;
+static JSON remove_json_patch_value(JSON& root, const JSONPath& path) {
+  JSON ret;
+  if (path.size() == 0) {
+    ret = std::move(root);
+    root = nullptr;
+    return ret;
   }
-  // Note: We don't use vector::operator<=> here because the items are pointers,
-  // and we want to compare the pointed-to objects instead.
-  size_t max_size = min<size_t>(stored_v->size(), v.size());
-  for (size_t z = 0; z < max_size; z++) {
-    partial_ordering item_ret = *(*stored_v)[z] <=> *v[z];
-    if (item_ret != 0) {
-      return item_ret;
+  JSON* parent = path.find_parent(root);
+  if (parent && parent->is_dict()) {
+    auto& dict = parent->as_dict();
+    auto it = dict.find(path.last_key());
+    if (it != dict.end()) {
+      ret = std::move(*it->second);
+      dict.erase(it);
+      return ret;
+    }
+  } else if (parent && parent->is_list()) {
+    auto& list = parent->as_list();
+    size_t index = path.last_index();
+    if (index < list.size()) {
+      ret = std::move(*list[index]);
+      list.erase(list.begin() + index);
+      return ret;
     }
   }
-  // If we get here, then all possible items matched. If the sizes aren't equal
-  // and stored_v is longer, then stored_v is greater than v; if v is longer,
-  // then v is greater than stored_v.
-  return stored_v->size() <=> v.size();
+  throw out_of_range("JSON path not present: " + path.str());
 }
 
-partial_ordering JSON::operator<=>(const dict_type& v) const {
-  const dict_type* stored_v = get_if<6>(&this->value);
-  if (stored_v == nullptr) {
-    return partial_ordering::unordered;
-  }
-  // If the dict sizes are equal and all key/value pairs match, then the overall
-  // result is equality; otherwise, it's inequality. There is no ordering for
-  // dictionary-typed values.
-  if (stored_v->size() != v.size()) {
-    return partial_ordering::unordered;
+template <typename PatchT>
+static void apply_json_patch(JSON& root, PatchT&& patch) {
+  constexpr bool move_values = !is_const_v<remove_reference_t<PatchT>>;
+  if (!patch.is_list()) {
+    throw invalid_argument("JSON patch must be a list");
   }
-  for (const auto& it : v) {
-    try {
-      const auto& item = stored_v->at(it.first);
-      if ((*item <=> *it.second) != partial_ordering::equivalent) {
-        return partial_ordering::unordered;
+  for (const auto& op_ptr : patch.as_list()) {
+    conditional_t<move_values, JSON&, const JSON&> op_item = *op_ptr;
+    if (!op_item.is_dict()) {
+      throw invalid_argument("JSON patch operation must be a dict");
+    }
+    const JSON* op_name = op_item.find("op");
+    const JSON* path_str = op_item.find("path");
+    if (!op_name || !op_name->is_string() || !path_str || !path_str->is_string()) {
+      throw invalid_argument("JSON patch operation must have op and path strings");
+    }
+    JSONPath path(string(path_str->as_string_view()));
+    string_view op = op_name->as_string_view();
+
+    auto get_value = [&]() -> JSON {
+      auto* value = op_item.find("value");
+      if (!value) {
+        throw invalid_argument("JSON patch operation must have a value");
       }
-    } catch (const out_of_range&) {
-      return partial_ordering::unordered;
+      if constexpr (move_values) {
+        return std::move(*value);
+      } else {
+        return *value;
+      }
+    };
+    auto get_from = [&]() -> JSONPath {
+      const JSON* from_str = op_item.find("from");
+      if (!from_str || !from_str->is_string()) {
+        throw invalid_argument("JSON patch operation must have a from string");
+      }
+      return JSONPath(string(from_str->as_string_view()));
+    };
+
+    if (op == "add") {
+      add_json_patch_value(root, path, get_value());
+    } else if (op == "remove") {
+      remove_json_patch_value(root, path);
+    } else if (op == "replace") {
+      path.at(root) = get_value();
+    } else if (op == "move") {
+      JSONPath from = get_from();
+      // A value can't be moved into one of its own children
+      const string& from_path_str = from.str();
+      const string& to_path_str = path.str();
+      if ((to_path_str.size() > from_path_str.size()) && to_path_str.starts_with(from_path_str) &&
+          (to_path_str[from_path_str.size()] == '/')) {
+        throw invalid_argument("JSON patch cannot move a value into one of its children");
+      }
+      add_json_patch_value(root, path, remove_json_patch_value(root, from));
+    } else if (op == "copy") {
+      add_json_patch_value(root, path, JSON(get_from().at(root)));
+    } else if (op == "test") {
+      const JSON* value = op_item.find("value");
+      if (!value) {
+        throw invalid_argument("JSON patch operation must have a value");
+      }
+      if (!json_values_equal(path.at(root), *value)) {
+        throw runtime_error("JSON patch test failed: " + path.str());
+      }
+    } else {
+      throw invalid_argument("unknown JSON patch operation: " + string(op));
     }
   }
-  // If we get here, then there were the same number of keys in both maps, all
-  // keys in v were also in stored_v, and the corresponding values were all
-  // equal. Therefore, the overall maps are equivalent.
-  return partial_ordering::equivalent;
 }
 
-JSON& JSON::at(const string& key) {
-  try {
-    return *this->as_dict().at(key);
-  } catch (const out_of_range& e) {
-    throw out_of_range("JSON key not present: " + key);
-  }
+void JSON::apply_patch(const JSON& patch) {
+  apply_json_patch(*this, patch);
 }
 
-const JSON& JSON::at(const string& key) const {
-  try {
-    return *this->as_dict().at(key);
-  } catch (const out_of_range& e) {
-    throw out_of_range("JSON key not present: " + key);
-  }
+void JSON::apply_patch(JSON&& patch) {
+  apply_json_patch(*this, patch);
 }
 
-JSON& JSON::at(size_t index) {
-  auto& list = this->as_list();
-  if (index >= list.size()) {
-    throw out_of_range("JSON array index out of bounds");
+JSONStructReader::JSONStructReader(const char* data, size_t size, bool disable_extensions)
+    : data(data),
+      size(size),
+      offset(0),
+      disable_extensions(disable_extensions) {}
+
+void JSONStructReader::skip_whitespace_and_comments() {
+  while (this->offset < this->size) {
+    char ch = this->data[this->offset];
+    if ((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\n')) {
+      this->offset++;
+    } else if (!this->disable_extensions && (ch == '/') && (json_char_at(this->data, this->size, this->offset + 1) == '/')) {
+      while ((this->offset < this->size) && (this->data[this->offset] != '\n') && (this->data[this->offset] != '\r')) {
+        this->offset++;
+      }
+    } else {
+      return;
+    }
   }
-  return *list[index];
 }
 
-const JSON& JSON::at(size_t index) const {
-  const auto& list = this->as_list();
-  if (index >= list.size()) {
-    throw out_of_range("JSON array index out of bounds");
-  }
-  return *list[index];
+char JSONStructReader::peek() {
+  this->skip_whitespace_and_comments();
+  return json_char_at(this->data, this->size, this->offset);
 }
 
-JSON::dict_type& JSON::as_dict() {
-  if (!this->is_dict()) {
-    throw type_error("JSON value cannot be accessed as a dict");
+bool JSONStructReader::read_null() {
+  if (this->peek() != 'n') {
+    return false;
   }
-  return ::get<dict_type>(this->value);
+  JSON v;
+  if (!parse_json_constant_value(v, this->data, this->size, this->offset, this->disable_extensions)) {
+    throw JSON::parse_error("unknown constant; pos=" + to_string(this->offset));
+  }
+  return true;
 }
 
-const JSON::dict_type& JSON::as_dict() const {
-  if (!this->is_dict()) {
-    throw type_error("JSON value cannot be accessed as a dict");
+bool JSONStructReader::read_bool() {
+  this->peek();
+  JSON v;
+  if (!parse_json_constant_value(v, this->data, this->size, this->offset, this->disable_extensions) || !v.is_bool()) {
+    throw JSON::parse_error("expected boolean; pos=" + to_string(this->offset));
   }
-  return ::get<dict_type>(this->value);
+  return v.as_bool();
 }
 
-JSON::list_type& JSON::as_list() {
-  if (!this->is_list()) {
-    throw type_error("JSON value cannot be accessed as a list");
+int64_t JSONStructReader::read_int() {
+  char ch = this->peek();
+  if ((ch == '-') || (ch == '+') || isdigit(ch)) {
+    JSON v = parse_json_number_value(this->data, this->size, this->offset, this->disable_extensions);
+    if (v.is_int()) {
+      return v.as_int();
+    }
   }
-  return ::get<list_type>(this->value);
+  throw JSON::parse_error("expected integer; pos=" + to_string(this->offset));
 }
 
-const JSON::list_type& JSON::as_list() const {
-  if (!this->is_list()) {
-    throw type_error("JSON value cannot be accessed as a list");
+double JSONStructReader::read_float() {
+  char ch = this->peek();
+  if ((ch != '-') && (ch != '+') && !isdigit(ch)) {
+    throw JSON::parse_error("expected number; pos=" + to_string(this->offset));
   }
-  return ::get<list_type>(this->value);
+  JSON v = parse_json_number_value(this->data, this->size, this->offset, this->disable_extensions);
+  return v.is_int() ? static_cast<double>(v.as_int()) : v.as_float();
 }
 
-int64_t JSON::as_int() const {
-  if (this->is_int()) {
-    return ::get<int64_t>(this->value);
-  } else if (this->is_float()) {
-    return ::get<double>(this->value);
+void JSONStructReader::read_string(string& ret) {
+  if (this->peek() != '\"') {
+    throw JSON::parse_error("expected string; pos=" + to_string(this->offset));
+  }
+  string_view contents;
+  if (get_json_unescaped_string_contents(contents, this->data, this->size, this->offset)) {
+    ret.assign(contents);
+    this->offset += contents.size() + 2;
   } else {
-    throw type_error("JSON value cannot be accessed as an int");
+    ret = parse_json_string_value(this->data, this->size, this->offset);
   }
 }
 
-double JSON::as_float() const {
-  if (this->is_int()) {
-    return ::get<int64_t>(this->value);
-  } else if (this->is_float()) {
-    return ::get<double>(this->value);
+JSON JSONStructReader::read_value() {
+  StringReader r(this->data, this->size);
+  r.go(this->offset);
+  JSON ret = JSON::parse(r, this->disable_extensions);
+  this->offset = r.where();
+  return ret;
+}
+
+void JSONStructReader::skip_value() {
+  char ch = this->peek();
+  if (ch == '[') {
+    this->begin_list();
+    while (this->next_list_item()) {
+      this->skip_value();
+    }
+  } else if (ch == '{') {
+    this->begin_dict();
+    string_view key;
+    while (this->next_dict_key(key)) {
+      this->skip_value();
+    }
+  } else if (ch == '\"') {
+    size_t end_offset = this->offset + 1;
+    for (;;) {
+      ch = json_char_at(this->data, this->size, end_offset++);
+      if (ch == '\\') {
+        end_offset++;
+      } else if (ch == '\"') {
+        break;
+      }
+    }
+    this->offset = end_offset;
   } else {
-    throw type_error("JSON value cannot be accessed as a float");
+    this->read_value();
   }
 }
 
-string& JSON::as_string() {
-  if (!this->is_string()) {
-    throw type_error("JSON value cannot be accessed as a string");
+void JSONStructReader::expect(char ch, const char* what) {
+  if (this->peek() != ch) {
+    throw JSON::parse_error(std::format("expected {}; pos={}", what, this->offset));
   }
-  return ::get<string>(this->value);
+  this->offset++;
 }
 
-const string& JSON::as_string() const {
-  if (!this->is_string()) {
-    throw type_error("JSON value cannot be accessed as a string");
+bool JSONStructReader::next_item(char end_ch) {
+  this->skip_whitespace_and_comments();
+  char ch = json_char_at(this->data, this->size, this->offset);
+  if (ch == end_ch) {
+    this->offset++;
+    this->container_has_items.pop_back();
+    return false;
   }
-  return ::get<string>(this->value);
-}
 
-bool JSON::as_bool() const {
-  if (!this->is_bool()) {
-    throw type_error("JSON value cannot be accessed as a bool");
+  // Like JSON::parse, a closing bracket is always allowed immediately after
+  // the opening bracket, and after a trailing comma if extensions are on
+  if (this->container_has_items.back()) {
+    if (ch != ',') {
+      throw JSON::parse_error(std::format("string is not a {}; pos={}", (end_ch == ']') ? "list" : "dictionary", this->offset));
+    }
+    this->offset++;
+    if (!this->disable_extensions && (this->peek() == end_ch)) {
+      this->offset++;
+      this->container_has_items.pop_back();
+      return false;
+    }
+  } else {
+    this->container_has_items.back() = true;
   }
-  return ::get<bool>(this->value);
+  return true;
 }
 
-size_t JSON::size() const {
-  switch (this->value.index()) {
-    case 5:
-      return ::get<5>(this->value).size();
-    case 6:
-      return ::get<6>(this->value).size();
-    default:
-      throw type_error("cannot get size of primitive JSON value");
+void JSONStructReader::begin_list() {
+  this->expect('[', "list");
+  this->container_has_items.emplace_back(false);
+}
+
+bool JSONStructReader::next_list_item() {
+  return this->next_item(']');
+}
+
+void JSONStructReader::begin_dict() {
+  this->expect('{', "dictionary");
+  this->container_has_items.emplace_back(false);
+}
+
+bool JSONStructReader::next_dict_key(string_view& key) {
+  if (!this->next_item('}')) {
+    return false;
+  }
+  if (this->peek() != '\"') {
+    throw JSON::parse_error("dictionary key is not a string; pos=" + to_string(this->offset));
   }
+  if (get_json_unescaped_string_contents(key, this->data, this->size, this->offset)) {
+    this->offset += key.size() + 2;
+  } else {
+    this->key_buffer = parse_json_string_value(this->data, this->size, this->offset);
+    key = this->key_buffer;
+  }
+  this->expect(':', "key/value pair");
+  return true;
 }
 
-bool JSON::empty() const {
-  switch (this->value.index()) {
-    case 5:
-      return ::get<5>(this->value).empty();
-    case 6:
-      return ::get<6>(this->value).empty();
-    default:
-      throw type_error("cannot get empty property of primitive JSON value");
+void JSONStructReader::finish() {
+  this->skip_whitespace_and_comments();
+  if (this->offset < this->size) {
+    throw JSON::parse_error("unparsed data remains after value");
   }
 }
 
-void JSON::clear() {
-  switch (this->value.index()) {
-    case 5:
-      ::get<5>(this->value).clear();
-      break;
-    case 6:
-      ::get<6>(this->value).clear();
-      break;
-    default:
-      throw type_error("cannot clear primitive JSON value");
+JSONStructWriter::JSONStructWriter(uint32_t options)
+    : serializer(make_unique<JSONSerializer>(this->buffer, nullptr, options)),
+      after_key(false) {}
+
+JSONStructWriter::~JSONStructWriter() = default;
+
+void JSONStructWriter::write_separator() {
+  if (this->after_key) {
+    this->after_key = false;
+  } else if (!this->container_has_items.empty()) {
+    if (this->container_has_items.back()) {
+      this->buffer.push_back(',');
+    } else {
+      this->container_has_items.back() = true;
+    }
   }
 }
 
+void JSONStructWriter::write_null() {
+  this->write_separator();
+  this->serializer->write_null();
+}
+
+void JSONStructWriter::write_bool(bool v) {
+  this->write_separator();
+  this->serializer->write_bool(v);
+}
+
+void JSONStructWriter::write_int(int64_t v) {
+  this->write_separator();
+  this->serializer->write_int(v);
+}
+
+void JSONStructWriter::write_float(double v) {
+  this->write_separator();
+  this->serializer->write_float(v);
+}
+
+void JSONStructWriter::write_string(string_view v) {
+  this->write_separator();
+  this->serializer->write_string(v);
+}
+
+void JSONStructWriter::write_value(const JSON& v) {
+  this->write_separator();
+  this->serializer->write(v, 0);
+}
+
+void JSONStructWriter::begin_list() {
+  this->write_separator();
+  this->buffer.push_back('[');
+  this->container_has_items.emplace_back(false);
+}
+
+void JSONStructWriter::end_list() {
+  this->container_has_items.pop_back();
+  this->buffer.push_back(']');
+}
+
+void JSONStructWriter::begin_dict() {
+  this->write_separator();
+  this->buffer.push_back('{');
+  this->container_has_items.emplace_back(false);
+}
+
+void JSONStructWriter::write_key(string_view key) {
+  this->write_separator();
+  this->serializer->write_string(key);
+  this->buffer.push_back(':');
+  this->after_key = true;
+}
+
+void JSONStructWriter::end_dict() {
+  this->container_has_items.pop_back();
+  this->buffer.push_back('}');
+}
+
 } // namespace phosg
@@ -1,14 +1,26 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <compare>
+#include <deque>
 #include <exception>
+#include <functional>
 #include <map>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#include "OrderedMap.hh"
+#include "SharedString.hh"
 #include "Strings.hh"
 #include "Types.hh"
 
@@ -24,7 +36,19 @@ public:
   static std::string escape_string(const std::string& s, StringEscapeMode mode = StringEscapeMode::STANDARD);
 
   using list_type = std::vector<std::unique_ptr<JSON>>;
+#ifdef PHOSG_JSON_FLAT_DICT
+  // Dicts are stored in insertion order in a flat vector, with a hash index
+  // only for large dicts (see OrderedMap). This makes building, iterating, and
+  // searching small dicts much faster, and makes serialization order match
+  // parse order. Keys are SharedStrings, and the parsers intern them, so all
+  // occurrences of the same key within a parsed document (for example, in a
+  // long list of records) share a single copy of the key's contents.
+  using dict_key_type = SharedString;
+  using dict_type = OrderedMap<SharedString, std::unique_ptr<JSON>, SharedStringHash>;
+#else
+  using dict_key_type = std::string;
   using dict_type = std::unordered_map<std::string, std::unique_ptr<JSON>>;
+#endif
 
 private:
   template <typename T>
@@ -64,10 +88,46 @@ public:
   static JSON parse(const char* s, size_t size, bool disable_extensions = false);
   static JSON parse(const std::string& s, bool disable_extensions = false);
 
+  // Alternative text parser that first indexes the input's structural
+  // characters (using SIMD instructions, if available) and then builds the
+  // result from the index. This produces the same results (and throws the
+  // same exceptions) as parse() for all inputs, including malformed ones.
+  // Indexing is cheap, so most of the time taken by this function is spent
+  // allocating the resulting objects; parsing into a JSONDocument avoids most
+  // of that cost.
+  static JSON parse_fast(const char* s, size_t size, bool disable_extensions = false);
+  static JSON parse_fast(const std::string& s, bool disable_extensions = false);
+
+  // Parsers for newline-delimited JSON (JSON Lines), in which each line is a
+  // separate JSON value. Lines containing only whitespace are skipped. The
+  // input is split into chunks at line boundaries, which are parsed on
+  // num_threads threads (if num_threads is 0, one thread per CPU core is
+  // used). parse_lines returns the values in the order they appear in the
+  // input. parse_lines_unordered instead calls fn for each value as soon as
+  // it's parsed, along with its (zero-based) line number; fn may be called
+  // from multiple threads at the same time, in any order. If any line is
+  // malformed, these throw a parse_error with the line number appended to the
+  // message (if multiple lines are malformed, it's not specified which one is
+  // reported); exceptions thrown by fn are propagated as-is. In both cases,
+  // the other threads stop after finishing the chunks they're working on.
+  static std::vector<JSON> parse_lines(const char* data, size_t size, size_t num_threads = 0, bool disable_extensions = false);
+  static std::vector<JSON> parse_lines(const std::string& data, size_t num_threads = 0, bool disable_extensions = false);
+  static void parse_lines_unordered(
+      const char* data,
+      size_t size,
+      const std::function<void(size_t line_num, JSON&& value)>& fn,
+      size_t num_threads = 0,
+      bool disable_extensions = false);
+  static void parse_lines_unordered(
+      const std::string& data,
+      const std::function<void(size_t line_num, JSON&& value)>& fn,
+      size_t num_threads = 0,
+      bool disable_extensions = false);
+
   // Because the statement `JSON v = {};` is ambiguous, these functions
   // exist to explicitly construct an empty list or dictionary.
   static inline JSON list() {
-    return JSON(std::vector<std::unique_ptr<JSON>>());
+    return JSON(list_type());
   }
   static inline JSON list(std::initializer_list<JSON> values) {
     list_type v;
@@ -78,7 +138,7 @@ public:
     return JSON(std::move(v));
   }
   static inline JSON dict() {
-    return JSON(std::unordered_map<std::string, std::unique_ptr<JSON>>());
+    return JSON(dict_type());
   }
   static inline JSON dict(std::initializer_list<std::pair<const std::string, JSON>> values) {
     dict_type v;
@@ -139,6 +199,13 @@ public:
 
   ~JSON() = default;
 
+  // Heap-allocated JSON objects (that is, all list items and dict values) are
+  // allocated from the current thread's active JSONArena if there is one, or
+  // from the global heap otherwise. Deleting an arena-allocated object runs its
+  // destructor but doesn't free its memory; see JSONArena for details.
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr);
+
   enum SerializeOption : uint32_t {
     // These options enable serialization behaviors, some of which don't conform
     // to the JSON standard.
@@ -176,6 +243,57 @@ public:
     ESCAPE_CONTROLS_ONLY = 0x20,
   };
   std::string serialize(uint32_t options = 0, size_t indent_level = 0) const;
+  // These variants write the serialized JSON incrementally instead of
+  // returning it all at once. The write_data variant calls write_data with
+  // chunks of the output (up to about 64KB at a time), so the memory used
+  // doesn't depend on the size of the output; this can be used to write to a
+  // file descriptor or socket. The StringWriter variant appends the output to
+  // the writer's buffer.
+  void serialize(const std::function<void(const void*, size_t)>& write_data, uint32_t options = 0, size_t indent_level = 0) const;
+  void serialize(StringWriter& w, uint32_t options = 0, size_t indent_level = 0) const;
+  void print(FILE* stream, uint32_t options = 0, size_t indent_level = 0) const;
+  // Like serialize, but large lists and dicts are split into chunks that are
+  // serialized on multiple threads. This applies to large containers nested
+  // inside small ones too, such as a large list that is the only value in a
+  // dict. The output is identical to serialize's. If num_threads is 0, one
+  // thread per CPU core is used.
+  std::string serialize_parallel(uint32_t options = 0, size_t num_threads = 0, size_t indent_level = 0) const;
+
+  // Binary serialization. This format is not JSON text and is only readable by
+  // parse_binary, but it's more compact than the text format and much faster
+  // to encode and decode, so it's useful for caching JSON values between
+  // processes. Each value is a type byte followed by its contents; integers
+  // are stored as zigzag-encoded varints, floats are stored as 8-byte
+  // little-endian doubles, and strings, lists, and dicts are prefixed with
+  // their lengths. If deduplicate_strings is true, each distinct string (key
+  // or value) up to 128 bytes long is only stored once, and later occurrences
+  // are encoded as references to the first one; this makes the output much
+  // smaller when the same keys appear in many dicts, at the cost of some
+  // encoding speed. parse_binary throws parse_error if the data is malformed
+  // or truncated. Like the text parse functions, the StringReader variant
+  // leaves the reader after the end of the value, and the other variants
+  // throw if there's extra data after it.
+  std::string serialize_binary(bool deduplicate_strings = false) const;
+  void serialize_binary(StringWriter& w, bool deduplicate_strings = false) const;
+  static JSON parse_binary(StringReader& r);
+  static JSON parse_binary(const void* data, size_t size);
+  static JSON parse_binary(const std::string& data);
+
+  // Structural diff and patch. diff returns an RFC 6902 JSON Patch (a list of
+  // add, remove, and replace operations) that transforms this value into
+  // other. Values that compare equal aren't changed, so an int and a float
+  // with the same value don't generate an operation. Within lists, the common
+  // prefix and suffix are skipped, so inserting or removing a run of items
+  // only generates operations for those items. apply_patch applies a patch
+  // (which may also contain move, copy, and test operations) to this value in
+  // place; the rvalue overload moves values out of the patch instead of
+  // copying them. apply_patch throws std::invalid_argument if the patch is
+  // malformed, std::out_of_range if a path doesn't exist, and
+  // std::runtime_error if a test operation fails; when this happens, the
+  // operations before the failing one have already been applied.
+  JSON diff(const JSON& other) const;
+  void apply_patch(const JSON& patch);
+  void apply_patch(JSON&& patch);
 
   // Comparison operators
   std::partial_ordering operator<=>(const JSON& other) const;
@@ -230,6 +348,15 @@ public:
   JSON& at(size_t index);
   const JSON& at(size_t index) const;
 
+  // Like at(), but return nullptr instead of throwing std::out_of_range if the
+  // key or index doesn't exist. (These still throw type_error if the value is
+  // not a dict or list.) All of the get_* functions that take a default value
+  // use these, so they don't throw internally when the key is missing.
+  JSON* find(const std::string& key);
+  const JSON* find(const std::string& key) const;
+  JSON* find(size_t index);
+  const JSON* find(size_t index) const;
+
   inline bool get_bool(const std::string& key) const {
     return this->at(key).as_bool();
   }
@@ -237,18 +364,12 @@ public:
     return this->at(index).as_bool();
   }
   inline bool get_bool(const std::string& key, bool default_value) const {
-    try {
-      return this->at(key).as_bool();
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(key);
+    return v ? v->as_bool() : default_value;
   }
   inline bool get_bool(size_t index, bool default_value) const {
-    try {
-      return this->at(index).as_bool();
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(index);
+    return v ? v->as_bool() : default_value;
   }
 
   int64_t get_int(const std::string& key) const {
@@ -258,18 +379,12 @@ public:
     return this->at(index).as_int();
   }
   int64_t get_int(const std::string& key, int64_t default_value) const {
-    try {
-      return this->at(key).as_int();
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(key);
+    return v ? v->as_int() : default_value;
   }
   int64_t get_int(size_t index, int64_t default_value) const {
-    try {
-      return this->at(index).as_int();
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(index);
+    return v ? v->as_int() : default_value;
   }
 
   double get_float(const std::string& key) const {
@@ -279,18 +394,12 @@ public:
     return this->at(index).as_float();
   }
   double get_float(const std::string& key, double default_value) const {
-    try {
-      return this->at(key).as_float();
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(key);
+    return v ? v->as_float() : default_value;
   }
   double get_float(size_t index, double default_value) const {
-    try {
-      return this->at(index).as_float();
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(index);
+    return v ? v->as_float() : default_value;
   }
 
   template <typename T>
@@ -306,20 +415,14 @@ public:
   template <typename T>
     requires(std::is_enum_v<T>)
   T get_enum(const std::string& key, T default_value) const {
-    try {
-      return enum_for_name<T>(this->at(key).as_string().c_str());
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(key);
+    return v ? enum_for_name<T>(v->as_string().c_str()) : default_value;
   }
   template <typename T>
     requires(std::is_enum_v<T>)
   T get_enum(size_t index, T default_value) const {
-    try {
-      return enum_for_name<T>(this->at(index).as_string().c_str());
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(index);
+    return v ? enum_for_name<T>(v->as_string().c_str()) : default_value;
   }
 
   inline const std::string& get_string(const std::string& key) const {
@@ -329,18 +432,18 @@ public:
     return this->at(index).as_string();
   }
   inline const std::string& get_string(const std::string& key, const std::string& default_value) const {
-    try {
-      return this->at(key).as_string();
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(key);
+    return v ? v->as_string() : default_value;
   }
   inline const std::string& get_string(size_t index, const std::string& default_value) const {
-    try {
-      return this->at(index).as_string();
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(index);
+    return v ? v->as_string() : default_value;
+  }
+  inline std::string_view get_string_view(const std::string& key) const {
+    return this->at(key).as_string_view();
+  }
+  inline std::string_view get_string_view(size_t index) const {
+    return this->at(index).as_string_view();
   }
   inline const list_type& get_list(const std::string& key) const {
     return this->at(key).as_list();
@@ -355,11 +458,8 @@ public:
     return this->at(index).as_dict();
   }
   inline const JSON& get(const std::string& key, const JSON& default_value) const {
-    try {
-      return this->at(key);
-    } catch (const std::out_of_range&) {
-      return default_value;
-    }
+    const JSON* v = this->find(key);
+    return v ? *v : default_value;
   }
 
   // Type-checking accessors. If the object is the requested type, returns the
@@ -375,8 +475,26 @@ public:
   bool as_bool() const;
   int64_t as_int() const;
   double as_float() const;
+  // Strings in a JSONDocument constructed from a shared source buffer may
+  // refer directly to that buffer instead of being stored in std::strings (see
+  // JSONDocument). All of the string accessors work for these strings, but
+  // as_string_view and get_string_view are the only ones that don't copy
+  // them: the non-const as_string converts the value to a std::string, and
+  // the const as_string (and get_string and get_enum, which use it) makes a
+  // copy of the string the first time it's called on the value and returns
+  // a reference to that copy.
   std::string& as_string();
   const std::string& as_string() const;
+  std::string_view as_string_view() const;
+  // If phosg is built with PHOSG_JSON_SHARED_CONTAINERS, copying a list or
+  // dict takes constant time, since the copy shares the original's container.
+  // The non-const versions of as_list and as_dict (which all the modifying
+  // functions use) copy the container first if it's shared, so modifying a
+  // value inside a copied tree only copies the containers on the path to it,
+  // and each of those copies only copies the items' JSON objects, not their
+  // contents. In this mode, a reference returned by the non-const as_list or
+  // as_dict must not be used to modify the container after the JSON object
+  // is copied, since the copy would see the modification too.
   list_type& as_list();
   const list_type& as_list() const;
   dict_type& as_dict();
@@ -396,13 +514,13 @@ public:
     return holds_alternative<double>(this->value);
   }
   inline bool is_string() const {
-    return holds_alternative<std::string>(this->value);
+    return holds_alternative<std::string>(this->value) || holds_alternative<BorrowedString>(this->value);
   }
   inline bool is_list() const {
-    return holds_alternative<list_type>(this->value);
+    return holds_alternative<list_storage_type>(this->value);
   }
   inline bool is_dict() const {
-    return holds_alternative<dict_type>(this->value);
+    return holds_alternative<dict_storage_type>(this->value);
   }
 
   // Container-like functions. These throw type_error if the value is not a list
@@ -473,15 +591,930 @@ private:
   JSON(list_type&& x);
   JSON(dict_type&& x);
 
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+  // Lists and dicts are reference-counted, and copying a JSON object shares
+  // them instead of copying them. The non-const as_list and as_dict copy the
+  // container first if it's shared (see the comment on as_list).
+  template <typename ContainerT>
+  struct SharedContainer {
+    ContainerT items;
+    // True if any of the items may have been allocated from a JSONArena.
+    // These containers are always copied instead of shared, since they may
+    // not outlive the arena.
+    bool may_contain_arena_items;
+  };
+  using list_storage_type = std::shared_ptr<SharedContainer<list_type>>;
+  using dict_storage_type = std::shared_ptr<SharedContainer<dict_type>>;
+  template <typename ContainerT>
+  static std::shared_ptr<SharedContainer<ContainerT>> make_shared_container(ContainerT&& items);
+  template <typename ContainerT>
+  static ContainerT& unshare_container(std::shared_ptr<SharedContainer<ContainerT>>& storage);
+#else
+  using list_storage_type = list_type;
+  using dict_storage_type = dict_type;
+#endif
+  static list_type copy_items(const list_type& items);
+  static dict_type copy_items(const dict_type& items);
+
+  // A string value that refers to memory owned by something else. This is
+  // only used by the parser for JSONDocuments that retain their source
+  // buffers; copying such a value makes a std::string. owned_copy is set by
+  // the const as_string, which must return a reference to a std::string; it
+  // may be called from multiple threads at once, so it's atomic.
+  struct BorrowedString {
+    std::string_view data;
+    mutable std::atomic<const std::string*> owned_copy;
+
+    explicit BorrowedString(std::string_view data);
+    BorrowedString(const BorrowedString& other);
+    BorrowedString(BorrowedString&& other);
+    BorrowedString& operator=(const BorrowedString& other);
+    BorrowedString& operator=(BorrowedString&& other);
+    ~BorrowedString();
+  };
+  static JSON borrowed_string(std::string_view s);
+  friend class IndexedJSONParser;
+
   std::variant<
       std::nullptr_t, // We use this type for JSON null
       bool,
       int64_t, // This is convertible to double implicitly in as_float()
       double, // This is convertible to int implicitly in as_int()
       std::string,
-      list_type,
-      dict_type>
+      list_storage_type,
+      dict_storage_type,
+      BorrowedString>
       value;
 };
 
+// A monotonic allocator for JSON objects. While an arena is active on the
+// current thread (via JSONArena::Scope), every JSON object allocated with new
+// comes from the arena's blocks instead of the global heap, and deleting such
+// an object only runs its destructor. The memory is released all at once when
+// the arena is destroyed, so the arena must outlive every object allocated
+// from it. Strings and the storage for lists and dicts still come from the
+// global heap, since list_type and dict_type use the standard allocator.
+// Objects allocated while no arena is active may be freely mixed into trees
+// that contain arena-allocated objects.
+class JSONArena {
+public:
+  explicit JSONArena(size_t block_size = 0x40000);
+  JSONArena(const JSONArena&) = delete;
+  JSONArena(JSONArena&&) = delete;
+  JSONArena& operator=(const JSONArena&) = delete;
+  JSONArena& operator=(JSONArena&&) = delete;
+  ~JSONArena() = default;
+
+  void* allocate(size_t size);
+
+  inline size_t bytes_allocated() const {
+    return this->total_bytes_allocated;
+  }
+  inline size_t block_count() const {
+    return this->blocks.size();
+  }
+
+  // Returns the arena active on the current thread, or nullptr if none is.
+  static JSONArena* active();
+
+  // Makes an arena active on the current thread for the lifetime of this
+  // object. Scopes may be nested; the previously-active arena (if any) is
+  // restored when the Scope is destroyed.
+  class Scope {
+  public:
+    explicit Scope(JSONArena& arena);
+    Scope(const Scope&) = delete;
+    Scope(Scope&&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    Scope& operator=(Scope&&) = delete;
+    ~Scope();
+
+  private:
+    JSONArena* prev_arena;
+  };
+
+private:
+  size_t block_size;
+  std::vector<std::unique_ptr<uint8_t[]>> blocks;
+  uint8_t* block_ptr;
+  size_t block_bytes_remaining;
+  size_t total_bytes_allocated;
+};
+
+// A parsed JSON value whose list items and dict values all live in a
+// JSONArena owned by the document. This makes parsing large documents much
+// cheaper (there is no per-object heap allocation) and makes destroying them
+// cheaper as well. Values within the document may be modified, but must not be
+// moved out of it (since they may refer to arena memory); to detach part of
+// the document, copy it instead.
+class JSONDocument {
+public:
+  JSONDocument();
+  // The buffer and string constructors use JSON::parse_fast; the StringReader
+  // constructor uses JSON::parse.
+  explicit JSONDocument(StringReader& r, bool disable_extensions = false);
+  JSONDocument(const char* s, size_t size, bool disable_extensions = false);
+  explicit JSONDocument(const std::string& s, bool disable_extensions = false);
+  // Like the string constructor, but the document keeps a reference to source,
+  // and string values that don't contain any escape sequences refer directly
+  // to it instead of being copied, which substantially reduces the memory
+  // used by string-heavy documents. Read these values with as_string_view or
+  // get_string_view to avoid copying them (see JSON::as_string). Copying a
+  // value out of the document copies its strings, so the copy doesn't depend
+  // on source.
+  explicit JSONDocument(std::shared_ptr<const std::string> source, bool disable_extensions = false);
+  JSONDocument(const JSONDocument&) = delete;
+  JSONDocument(JSONDocument&& other) = default;
+  JSONDocument& operator=(const JSONDocument&) = delete;
+  JSONDocument& operator=(JSONDocument&& other);
+  ~JSONDocument() = default;
+
+  inline JSON& root() {
+    return this->root_value;
+  }
+  inline const JSON& root() const {
+    return this->root_value;
+  }
+  inline const JSONArena& arena() const {
+    return *this->arena_ptr;
+  }
+  // Returns the source buffer, if the document was constructed with one
+  inline const std::shared_ptr<const std::string>& source() const {
+    return this->source_data;
+  }
+
+private:
+  // The arena and source must be declared before the root so that the root
+  // (and all of the objects it refers to) is destroyed first
+  std::unique_ptr<JSONArena> arena_ptr;
+  std::shared_ptr<const std::string> source_data;
+  JSON root_value;
+};
+
+// Pull-style reader that generates a sequence of events for a JSON value
+// instead of constructing the entire value in memory. The input is tokenized
+// the same way as JSON::parse, with the same extensions, so any input that
+// JSON::parse accepts generates a valid event sequence. Memory usage is
+// proportional only to the nesting depth of the input (and the size of the
+// largest single key or scalar value), so this can be used to process inputs
+// that are too large to parse into a JSON object.
+//
+// Each call to next() returns the next event. For KEY events, the key is
+// available via key(); for VALUE events (which are generated for all values
+// except lists and dicts), the value is available via value(). After the
+// top-level value is complete, next() returns END, and the StringReader is
+// positioned immediately after the value (like JSON::parse, this does not
+// check for extra data after the value).
+class JSONEventReader {
+public:
+  enum class Event {
+    START_LIST = 0,
+    END_LIST,
+    START_DICT,
+    END_DICT,
+    KEY,
+    VALUE,
+    END,
+  };
+
+  explicit JSONEventReader(StringReader& r, bool disable_extensions = false);
+  ~JSONEventReader() = default;
+
+  Event next();
+
+  inline const std::string& key() const {
+    return this->current_key;
+  }
+  inline std::string& key() {
+    return this->current_key;
+  }
+  inline const JSON& value() const {
+    return this->current_value;
+  }
+  inline JSON& value() {
+    return this->current_value;
+  }
+  // Returns the number of lists and dicts that contain the current position
+  inline size_t depth() const {
+    return this->stack.size();
+  }
+
+private:
+  enum class State : uint8_t {
+    LIST_START = 0, // After [
+    LIST_ITEM, // After a list item
+    DICT_START, // After {
+    DICT_KEY, // After a key
+    DICT_VALUE, // After a value
+  };
+
+  StringReader& r;
+  bool disable_extensions;
+  bool root_started;
+  std::vector<State> stack;
+  std::string current_key;
+  JSON current_value;
+
+  Event start_value();
+};
+
+class JSONDictKeyTable;
+
+// Push-style parser for input that arrives in pieces, such as messages read
+// from a socket. Call feed() with each piece as it arrives; the parser keeps
+// its state between calls, so each byte is only examined once no matter how
+// the input is split up, and parsing can overlap with waiting for more data.
+// The input may contain any number of top-level values, which are queued as
+// they are completed and can be retrieved with has_value() and get_value().
+// The syntax (including extensions) is the same as for JSON::parse, except
+// that numbers and constants must be followed by whitespace or punctuation,
+// as for JSON::parse_fast.
+//
+// A number at the end of the input isn't known to be complete until more data
+// arrives, so call finish() at the end of the stream. finish() throws
+// parse_error if the stream ends in the middle of a value.
+//
+// If feed() or finish() throws, the parser's state is undefined; call reset()
+// before using it again.
+class JSONPushParser {
+public:
+  explicit JSONPushParser(bool disable_extensions = false);
+  JSONPushParser(const JSONPushParser&) = delete;
+  JSONPushParser(JSONPushParser&&);
+  JSONPushParser& operator=(const JSONPushParser&) = delete;
+  JSONPushParser& operator=(JSONPushParser&&);
+  ~JSONPushParser();
+
+  void feed(const void* data, size_t size);
+  inline void feed(const std::string& data) {
+    this->feed(data.data(), data.size());
+  }
+  void finish();
+  // Discards all parser state, including any completed values that haven't
+  // been retrieved yet
+  void reset();
+
+  inline bool has_value() const {
+    return !this->completed_values.empty();
+  }
+  // Returns the oldest completed value. Throws out_of_range if there isn't one
+  JSON get_value();
+
+  // Returns true if the parser is in the middle of a value (or comment)
+  inline bool in_value() const {
+    return !this->stack.empty() || (this->token_type != TokenType::NONE);
+  }
+  inline size_t bytes_consumed() const {
+    return this->offset;
+  }
+
+private:
+  enum class State : uint8_t {
+    LIST_START = 0, // After [
+    LIST_ITEM, // After a list item
+    LIST_COMMA, // After a comma in a list
+    DICT_START, // After {
+    DICT_KEY, // After a key
+    DICT_COLON, // After a colon
+    DICT_VALUE, // After a value
+    DICT_COMMA, // After a comma in a dict
+  };
+  enum class TokenType : uint8_t {
+    NONE = 0,
+    STRING,
+    NUMBER,
+    CONSTANT,
+    SLASH, // A / that could be the beginning of a comment
+    COMMENT,
+  };
+  struct Frame {
+    State state;
+    JSON container;
+    JSON::dict_key_type key;
+  };
+
+  bool disable_extensions;
+  size_t offset;
+  TokenType token_type;
+  bool token_has_escapes;
+  bool token_escape_pending;
+  std::string token;
+  std::vector<Frame> stack;
+  std::deque<JSON> completed_values;
+  std::unique_ptr<JSONDictKeyTable> keys;
+
+  void start_value(char ch);
+  void finish_token();
+  void finish_string();
+  void add_value(JSON&& value);
+};
+
+// Read-only view of a JSON value in a text buffer. Constructing a JSONView
+// indexes the structure of the input (the same way JSON::parse_fast does) and
+// checks that it's well-formed, but doesn't decode any values; numbers,
+// strings, and constants are only decoded when they're accessed, and no JSON
+// objects are constructed unless to_json() is called. This makes it much
+// cheaper than JSON::parse when only a few values in a large input are needed.
+//
+// The input buffer must remain valid and unmodified for the lifetime of the
+// view and all views derived from it. Views are cheap to copy; they share the
+// index built by the root view.
+//
+// Because scalar values aren't decoded until they're accessed, malformed
+// scalars (e.g. invalid escape sequences in strings or numbers like "1x") are
+// only detected when they're accessed, and cause the accessor to throw
+// JSON::parse_error. Malformed structure (e.g. unbalanced brackets or missing
+// commas) is detected by the constructor. Note that a JSONView may accept some
+// malformed inputs that JSON::parse rejects, if the malformed values are never
+// accessed.
+class JSONView {
+public:
+  JSONView(const char* data, size_t size, bool disable_extensions = false);
+  explicit JSONView(const std::string& data, bool disable_extensions = false);
+  // The view doesn't own the input, so it can't be constructed from a
+  // temporary string
+  JSONView(std::string&& data, bool disable_extensions = false) = delete;
+  JSONView(const JSONView&) = default;
+  JSONView(JSONView&&) = default;
+  JSONView& operator=(const JSONView&) = default;
+  JSONView& operator=(JSONView&&) = default;
+  ~JSONView() = default;
+
+  // Type inspectors. These are cheap, except is_int and is_float, which have
+  // to decode the number to know which type it is.
+  bool is_null() const;
+  bool is_bool() const;
+  bool is_int() const;
+  bool is_float() const;
+  bool is_string() const;
+  bool is_list() const;
+  bool is_dict() const;
+
+  // Type-checking accessors. These behave the same way as the corresponding
+  // functions on JSON (and throw JSON::type_error if the value is the wrong
+  // type). as_string_view returns a view of the string's contents in the
+  // input buffer, so it does not copy the string; however, this is only
+  // possible if the string contains no escape sequences, so it throws
+  // JSON::type_error if the string contains any.
+  bool as_bool() const;
+  int64_t as_int() const;
+  double as_float() const;
+  std::string as_string() const;
+  std::string_view as_string_view() const;
+
+  // Returns a JSON object containing the same value as this view.
+  JSON to_json() const;
+
+  // Container accessors. Like the corresponding JSON functions, these throw
+  // JSON::type_error if the value is the wrong type, and std::out_of_range if
+  // the key or index doesn't exist. Lookups are linear in the number of
+  // entries in the container. If a dict contains the same key multiple times,
+  // the first occurrence is used (as JSON::parse does).
+  size_t size() const;
+  bool empty() const;
+  bool contains(const std::string& key) const;
+  JSONView at(const std::string& key) const;
+  JSONView at(size_t index) const;
+  // Like at(), but return std::nullopt instead of throwing std::out_of_range
+  // if the key or index doesn't exist.
+  std::optional<JSONView> find(const std::string& key) const;
+  std::optional<JSONView> find(size_t index) const;
+  std::vector<JSONView> list_items() const;
+  std::vector<std::pair<std::string, JSONView>> dict_items() const;
+
+  inline bool get_bool(const std::string& key) const {
+    return this->at(key).as_bool();
+  }
+  inline bool get_bool(const std::string& key, bool default_value) const {
+    auto v = this->find(key);
+    return v.has_value() ? v->as_bool() : default_value;
+  }
+  inline int64_t get_int(const std::string& key) const {
+    return this->at(key).as_int();
+  }
+  inline int64_t get_int(const std::string& key, int64_t default_value) const {
+    auto v = this->find(key);
+    return v.has_value() ? v->as_int() : default_value;
+  }
+  inline double get_float(const std::string& key) const {
+    return this->at(key).as_float();
+  }
+  inline double get_float(const std::string& key, double default_value) const {
+    auto v = this->find(key);
+    return v.has_value() ? v->as_float() : default_value;
+  }
+  inline std::string get_string(const std::string& key) const {
+    return this->at(key).as_string();
+  }
+  inline std::string get_string(const std::string& key, const std::string& default_value) const {
+    auto v = this->find(key);
+    return v.has_value() ? v->as_string() : default_value;
+  }
+
+private:
+  struct Index;
+  std::shared_ptr<const Index> index;
+  size_t index_pos;
+
+  JSONView(std::shared_ptr<const Index> index, size_t index_pos);
+
+  char first_char() const;
+  size_t end_index_pos() const;
+  size_t next_index_pos(size_t index_pos) const;
+  JSON decode_scalar() const;
+};
+
+// A pre-parsed path into a JSON value, which can be evaluated against many
+// values (or views) without re-parsing it. Paths are written as RFC 6901 JSON
+// Pointers: the empty string refers to the root value, and "/a/0/b" refers to
+// root["a"][0]["b"]. Within each component, ~1 means / and ~0 means ~. As in
+// the RFC, a component refers to a list item if it's a decimal number with no
+// leading zeroes, and "-" (the item after the end of a list) never exists.
+//
+// If enable_selectors is true, two additional kinds of components can be used,
+// which can match multiple values:
+// - "*" matches every item in a list or every value in a dict.
+// - "?key" matches every item in a list (or value in a dict) that is a dict
+//   containing key, and "?key=value" matches only those where the key's value
+//   is equal to value, which is parsed as JSON (for example, ?id=3 or
+//   ?type="book").
+// Paths containing selectors must be evaluated with find_all.
+//
+// Evaluating a path never copies any part of the input, and never throws if
+// the path doesn't exist; find returns nullptr or std::nullopt instead, and
+// find_all returns an empty vector.
+class JSONPath {
+public:
+  explicit JSONPath(const std::string& path, bool enable_selectors = false);
+  ~JSONPath() = default;
+
+  // Returns the path in its original form
+  inline const std::string& str() const {
+    return this->path;
+  }
+  // Returns true if the path contains any wildcards or filters
+  inline bool has_selectors() const {
+    return this->contains_selectors;
+  }
+
+  // Returns the value referred to by the path, or nullptr (or std::nullopt)
+  // if it doesn't exist. These throw std::logic_error if the path contains
+  // selectors.
+  const JSON* find(const JSON& root) const;
+  JSON* find(JSON& root) const;
+  std::optional<JSONView> find(const JSONView& root) const;
+  // Like find, but throw std::out_of_range if the value doesn't exist
+  const JSON& at(const JSON& root) const;
+  JSON& at(JSON& root) const;
+  JSONView at(const JSONView& root) const;
+
+  // Returns the number of components in the path
+  inline size_t size() const {
+    return this->components.size();
+  }
+  // Returns the value that contains the value referred to by the path (that
+  // is, the value referred to by all but the last component of the path), or
+  // nullptr if it doesn't exist. This throws std::logic_error if the path is
+  // empty or contains selectors.
+  JSON* find_parent(JSON& root) const;
+  // Returns the last component of the path, without escape sequences. This
+  // throws std::logic_error if the path is empty.
+  const std::string& last_key() const;
+  // Returns the list index referred to by the last component of the path, or
+  // SIZE_MAX if it isn't a valid list index
+  size_t last_index() const;
+
+  // Returns all values matching the path, in the order they appear in their
+  // containers (which is arbitrary for dicts, unless flat dicts are used)
+  std::vector<const JSON*> find_all(const JSON& root) const;
+  std::vector<JSONView> find_all(const JSONView& root) const;
+
+private:
+  enum class ComponentType {
+    KEY = 0,
+    WILDCARD,
+    FILTER,
+  };
+  struct Component {
+    ComponentType type;
+    // For KEY, the dict key; for FILTER, the key that must be present
+    std::string key;
+    // For KEY, the list index that this component refers to, or SIZE_MAX if
+    // it isn't a valid list index
+    size_t index;
+    // For FILTER, the value that key must have (if has_filter_value is true)
+    bool has_filter_value;
+    JSON filter_value;
+  };
+
+  std::string path;
+  std::vector<Component> components;
+  bool contains_selectors;
+
+  void check_no_selectors() const;
+  // JSONT is JSON or const JSON. The non-const version uses the non-const
+  // accessors, so any shared containers along the path are copied first (see
+  // JSON::as_list).
+  template <typename JSONT>
+  JSONT* find(JSONT& root, size_t num_components) const;
+  bool filter_matches(const Component& c, const JSON& v) const;
+  bool filter_matches(const Component& c, const JSONView& v) const;
+  void find_all(std::vector<const JSON*>& ret, const JSON& v, size_t component_index) const;
+  void find_all(std::vector<JSONView>& ret, const JSONView& v, size_t component_index) const;
+};
+
+// Reads JSON text one value at a time, without constructing JSON objects for
+// lists or dicts. This is used by parse_json_struct (below), but can also be
+// used directly to parse JSON into custom data structures. The syntax
+// (including extensions) is the same as for JSON::parse.
+//
+// The read_* functions throw JSON::parse_error if the next value isn't of the
+// expected type, and std::out_of_range if the text ends before the value is
+// complete. To read a list, call begin_list, then call next_list_item
+// before reading each item; it returns false (and consumes the closing
+// bracket) when there are no more items. Dicts work the same way, except
+// next_dict_key also reads the key and the following colon.
+class JSONStructReader {
+public:
+  JSONStructReader(const char* data, size_t size, bool disable_extensions = false);
+  ~JSONStructReader() = default;
+
+  // Returns the first character of the next value, after skipping whitespace
+  // and comments
+  char peek();
+  // If the next value is null, consumes it and returns true
+  bool read_null();
+  bool read_bool();
+  int64_t read_int();
+  // Integers are also accepted here, and are converted to doubles
+  double read_float();
+  void read_string(std::string& ret);
+  inline std::string read_string() {
+    std::string ret;
+    this->read_string(ret);
+    return ret;
+  }
+  // Reads any value (including lists and dicts) as a JSON object
+  JSON read_value();
+  // Consumes the next value without constructing anything
+  void skip_value();
+
+  void begin_list();
+  bool next_list_item();
+  void begin_dict();
+  // The returned key is valid until the next call to next_dict_key
+  bool next_dict_key(std::string_view& key);
+
+  // Throws JSON::parse_error if there is any data after the last value
+  void finish();
+
+  inline size_t where() const {
+    return this->offset;
+  }
+
+private:
+  const char* data;
+  size_t size;
+  size_t offset;
+  bool disable_extensions;
+  // One entry for each list or dict that contains the current position; true
+  // if at least one item has been read from that container
+  std::vector<bool> container_has_items;
+  // Holds keys that contain escape sequences; other keys refer to data directly
+  std::string key_buffer;
+
+  void skip_whitespace_and_comments();
+  void expect(char ch, const char* what);
+  bool next_item(char end_ch);
+};
+
+class JSONSerializer;
+
+// Writes compact JSON text one value at a time, without constructing JSON
+// objects. This is the inverse of JSONStructReader, and is used by
+// serialize_json_struct. The options are the same as for JSON::serialize,
+// except FORMAT, EXPAND_LEAF_CONTAINERS, and SORT_DICT_KEYS have no effect.
+// Separators are written automatically; in a dict, call write_key before
+// writing each value.
+class JSONStructWriter {
+public:
+  explicit JSONStructWriter(uint32_t options = 0);
+  JSONStructWriter(const JSONStructWriter&) = delete;
+  JSONStructWriter(JSONStructWriter&&) = delete;
+  JSONStructWriter& operator=(const JSONStructWriter&) = delete;
+  JSONStructWriter& operator=(JSONStructWriter&&) = delete;
+  ~JSONStructWriter();
+
+  void write_null();
+  void write_bool(bool v);
+  void write_int(int64_t v);
+  void write_float(double v);
+  void write_string(std::string_view v);
+  void write_value(const JSON& v);
+
+  void begin_list();
+  void end_list();
+  void begin_dict();
+  void write_key(std::string_view key);
+  void end_dict();
+
+  inline const std::string& str() const {
+    return this->buffer;
+  }
+  inline std::string& str() {
+    return this->buffer;
+  }
+
+private:
+  std::string buffer;
+  std::unique_ptr<JSONSerializer> serializer;
+  // Same as in JSONStructReader
+  std::vector<bool> container_has_items;
+  bool after_key;
+
+  void write_separator();
+};
+
+// Typed struct mapping. To parse a struct directly from JSON text (or write a
+// struct directly as JSON text) without constructing a JSON tree, specialize
+// JSONStructFields to describe the struct's fields, like this:
+//
+//   struct Point {
+//     int64_t x;
+//     int64_t y;
+//     std::optional<std::string> label;
+//   };
+//   template <>
+//   struct phosg::JSONStructFields<Point> {
+//     static constexpr auto fields = std::make_tuple(
+//         PHOSG_JSON_FIELD(Point, x),
+//         PHOSG_JSON_FIELD(Point, y),
+//         phosg::json_field("name", &Point::label));
+//   };
+//
+//   Point pt = phosg::parse_json_struct<Point>("{\"x\": 1, \"y\": 2}");
+//   std::string text = phosg::serialize_json_struct(pt);
+//
+// Fields may be bools, integers, floats, std::strings, JSON objects (which
+// can hold any value), other structs with JSONStructFields, std::vectors of
+// any of these, std::maps or std::unordered_maps from std::string to any of
+// these, or std::optionals of any of these. An optional field may be missing
+// or null in the input, and is omitted from the output if it has no value;
+// all other fields are required. Keys that don't match any field are ignored.
+// Any of these types can also be parsed or serialized at the top level (for
+// example, a std::vector of structs).
+
+template <typename StructT, typename MemberT>
+struct JSONStructField {
+  std::string_view name;
+  MemberT StructT::* member;
+};
+
+template <typename StructT, typename MemberT>
+constexpr JSONStructField<StructT, MemberT> json_field(std::string_view name, MemberT StructT::* member) {
+  return JSONStructField<StructT, MemberT>{name, member};
+}
+
+#define PHOSG_JSON_FIELD(StructT, member_name) phosg::json_field(#member_name, &StructT::member_name)
+
+template <typename StructT>
+struct JSONStructFields;
+
+namespace json_struct_detail {
+
+template <typename T, typename = void>
+struct is_struct : std::false_type {};
+template <typename T>
+struct is_struct<T, std::void_t<decltype(JSONStructFields<T>::fields)>> : std::true_type {};
+
+template <typename T>
+struct is_optional : std::false_type {};
+template <typename T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+template <typename T>
+struct is_vector : std::false_type {};
+template <typename T, typename AllocatorT>
+struct is_vector<std::vector<T, AllocatorT>> : std::true_type {};
+
+template <typename T>
+struct is_string_map : std::false_type {};
+template <typename T, typename... ArgsT>
+struct is_string_map<std::map<std::string, T, ArgsT...>> : std::true_type {};
+template <typename T, typename... ArgsT>
+struct is_string_map<std::unordered_map<std::string, T, ArgsT...>> : std::true_type {};
+
+template <typename T>
+void read(JSONStructReader& r, T& ret);
+template <typename T>
+void write(JSONStructWriter& w, const T& v);
+
+template <typename StructT>
+constexpr size_t num_fields = std::tuple_size_v<std::remove_cv_t<decltype(JSONStructFields<StructT>::fields)>>;
+
+template <typename StructT, size_t Index>
+void read_field(JSONStructReader& r, StructT& ret) {
+  read(r, ret.*(std::get<Index>(JSONStructFields<StructT>::fields).member));
+}
+
+template <typename StructT, size_t Index>
+void handle_missing_field(StructT& ret) {
+  const auto& field = std::get<Index>(JSONStructFields<StructT>::fields);
+  auto& member = ret.*(field.member);
+  if constexpr (is_optional<std::remove_cvref_t<decltype(member)>>::value) {
+    // Optional fields that aren't present are reset, so the result doesn't
+    // depend on the struct's previous contents
+    member.reset();
+  } else {
+    throw JSON::parse_error("required field is missing: " + std::string(field.name));
+  }
+}
+
+template <typename StructT, size_t... Indexes>
+void read_struct(JSONStructReader& r, StructT& ret, std::index_sequence<Indexes...>) {
+  static constexpr std::array<std::string_view, sizeof...(Indexes)> names = {
+      std::get<Indexes>(JSONStructFields<StructT>::fields).name...};
+  static constexpr std::array<void (*)(JSONStructReader&, StructT&), sizeof...(Indexes)> readers = {
+      &read_field<StructT, Indexes>...};
+  static constexpr std::array<void (*)(StructT&), sizeof...(Indexes)> missing_handlers = {
+      &handle_missing_field<StructT, Indexes>...};
+
+  // Keys usually appear in the same order as the fields, so we start looking
+  // for each key just after the previous key's field
+  std::array<bool, sizeof...(Indexes)> found{};
+  size_t next_index = 0;
+  r.begin_dict();
+  std::string_view key;
+  while (r.next_dict_key(key)) {
+    size_t index = next_index;
+    for (size_t z = 0; z < names.size(); z++) {
+      if (names[index] == key) {
+        break;
+      }
+      index = (index + 1 < names.size()) ? (index + 1) : 0;
+    }
+    if (names.empty() || (names[index] != key)) {
+      r.skip_value();
+    } else {
+      readers[index](r, ret);
+      found[index] = true;
+      next_index = (index + 1 < names.size()) ? (index + 1) : 0;
+    }
+  }
+
+  for (size_t z = 0; z < names.size(); z++) {
+    if (!found[z]) {
+      missing_handlers[z](ret);
+    }
+  }
+}
+
+template <typename StructT, typename MemberT>
+void write_field(JSONStructWriter& w, const StructT& v, const JSONStructField<StructT, MemberT>& field) {
+  const MemberT& member = v.*(field.member);
+  if constexpr (is_optional<MemberT>::value) {
+    if (!member.has_value()) {
+      return;
+    }
+  }
+  w.write_key(field.name);
+  write(w, member);
+}
+
+template <typename StructT, size_t... Indexes>
+void write_struct(JSONStructWriter& w, const StructT& v, std::index_sequence<Indexes...>) {
+  w.begin_dict();
+  (write_field(w, v, std::get<Indexes>(JSONStructFields<StructT>::fields)), ...);
+  w.end_dict();
+}
+
+template <typename T>
+void read(JSONStructReader& r, T& ret) {
+  if constexpr (std::is_same_v<T, bool>) {
+    ret = r.read_bool();
+  } else if constexpr (std::is_integral_v<T>) {
+    int64_t v = r.read_int();
+    if (!std::in_range<T>(v)) {
+      throw JSON::parse_error("integer value out of range; pos=" + std::to_string(r.where()));
+    }
+    ret = static_cast<T>(v);
+  } else if constexpr (std::is_floating_point_v<T>) {
+    ret = r.read_float();
+  } else if constexpr (std::is_same_v<T, std::string>) {
+    r.read_string(ret);
+  } else if constexpr (std::is_same_v<T, JSON>) {
+    ret = r.read_value();
+  } else if constexpr (is_optional<T>::value) {
+    if (r.read_null()) {
+      ret.reset();
+    } else {
+      read(r, ret.emplace());
+    }
+  } else if constexpr (std::is_same_v<T, std::vector<bool>>) {
+    // vector<bool>::emplace_back returns a proxy object, not a bool&
+    ret.clear();
+    r.begin_list();
+    while (r.next_list_item()) {
+      bool item;
+      read(r, item);
+      ret.push_back(item);
+    }
+  } else if constexpr (is_vector<T>::value) {
+    ret.clear();
+    r.begin_list();
+    while (r.next_list_item()) {
+      read(r, ret.emplace_back());
+    }
+  } else if constexpr (is_string_map<T>::value) {
+    ret.clear();
+    r.begin_dict();
+    std::string_view key;
+    while (r.next_dict_key(key)) {
+      read(r, ret[std::string(key)]);
+    }
+  } else {
+    static_assert(is_struct<T>::value, "type cannot be parsed from JSON; specialize JSONStructFields for it");
+    read_struct(r, ret, std::make_index_sequence<num_fields<T>>());
+  }
+}
+
+template <typename T>
+void write(JSONStructWriter& w, const T& v) {
+  if constexpr (std::is_same_v<T, bool>) {
+    w.write_bool(v);
+  } else if constexpr (std::is_integral_v<T>) {
+    if (!std::in_range<int64_t>(v)) {
+      throw std::out_of_range("integer value out of range");
+    }
+    w.write_int(static_cast<int64_t>(v));
+  } else if constexpr (std::is_floating_point_v<T>) {
+    w.write_float(v);
+  } else if constexpr (std::is_same_v<T, std::string>) {
+    w.write_string(v);
+  } else if constexpr (std::is_same_v<T, JSON>) {
+    w.write_value(v);
+  } else if constexpr (is_optional<T>::value) {
+    if (v.has_value()) {
+      write(w, *v);
+    } else {
+      w.write_null();
+    }
+  } else if constexpr (is_vector<T>::value) {
+    w.begin_list();
+    for (const auto& item : v) {
+      write(w, item);
+    }
+    w.end_list();
+  } else if constexpr (is_string_map<T>::value) {
+    w.begin_dict();
+    for (const auto& it : v) {
+      w.write_key(it.first);
+      write(w, it.second);
+    }
+    w.end_dict();
+  } else {
+    static_assert(is_struct<T>::value, "type cannot be serialized as JSON; specialize JSONStructFields for it");
+    write_struct(w, v, std::make_index_sequence<num_fields<T>>());
+  }
+}
+
+} // namespace json_struct_detail
+
+// Parses JSON text directly into a value of type T. Throws JSON::parse_error
+// if the text isn't valid JSON, if any value has the wrong type, or if any
+// required struct field is missing. Like JSON::parse, this throws
+// std::out_of_range instead if the text ends in the middle of a value (for
+// example, if it contains an unterminated string, list, or dict).
+template <typename T>
+void parse_json_struct(T& ret, const char* data, size_t size, bool disable_extensions = false) {
+  JSONStructReader r(data, size, disable_extensions);
+  json_struct_detail::read(r, ret);
+  r.finish();
+}
+template <typename T>
+T parse_json_struct(const char* data, size_t size, bool disable_extensions = false) {
+  T ret{};
+  parse_json_struct(ret, data, size, disable_extensions);
+  return ret;
+}
+template <typename T>
+T parse_json_struct(const std::string& data, bool disable_extensions = false) {
+  return parse_json_struct<T>(data.data(), data.size(), disable_extensions);
+}
+
+// Serializes a value of type T directly as JSON text. The output is the same
+// as serializing the equivalent JSON object without the FORMAT option, except
+// that struct fields are written in the order they're listed in
+// JSONStructFields.
+template <typename T>
+void serialize_json_struct(JSONStructWriter& w, const T& v) {
+  json_struct_detail::write(w, v);
+}
+template <typename T>
+std::string serialize_json_struct(const T& v, uint32_t options = 0) {
+  JSONStructWriter w(options);
+  json_struct_detail::write(w, v);
+  return std::move(w.str());
+}
+
 } // namespace phosg
@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "JSON.hh"
+#include "Strings.hh"
+#include "Time.hh"
+
+using namespace std;
+using namespace phosg;
+
+// All heap allocations made by the process are counted, so we can compare the
+// allocation behavior of the different strategies as well as their speed.
+// Each allocation's size is stored just before the returned pointer, so we can
+// also track how much memory is live (e.g. retained by a parsed document).
+static atomic<size_t> allocation_count(0);
+static atomic<size_t> allocation_bytes(0);
+static atomic<size_t> live_bytes(0);
+static constexpr size_t ALLOCATION_HEADER_SIZE = alignof(max_align_t);
+
+void* operator new(size_t size) {
+  allocation_count++;
+  allocation_bytes += size;
+  live_bytes += size;
+  void* ret = malloc(size + ALLOCATION_HEADER_SIZE);
+  if (!ret) {
+    throw bad_alloc();
+  }
+  *reinterpret_cast<size_t*>(ret) = size;
+  return reinterpret_cast<uint8_t*>(ret) + ALLOCATION_HEADER_SIZE;
+}
+
+// GCC doesn't know that operator new is also replaced here, so it warns about
+// freeing memory that it thinks was allocated by the standard operator new
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* ptr) noexcept {
+  if (ptr) {
+    void* header = reinterpret_cast<uint8_t*>(ptr) - ALLOCATION_HEADER_SIZE;
+    live_bytes -= *reinterpret_cast<size_t*>(header);
+    free(header);
+  }
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  operator delete(ptr);
+}
+#pragma GCC diagnostic pop
+
+static string generate_records_json(size_t count) {
+  BlockStringWriter w;
+  w.write("[");
+  for (size_t z = 0; z < count; z++) {
+    w.write_fmt("{}{{\"id\": {}, \"name\": \"record number {} with a long name\", \"score\": {}.5, "
+                "\"active\": {}, \"tags\": [\"alpha\", \"beta\", \"gamma\"], "
+                "\"position\": {{\"x\": {}, \"y\": {}, \"z\": -{}.25}}}}",
+        z ? "," : "", z, z, z % 100, (z & 1) ? "true" : "false", z * 3, z * 7, z % 1000);
+  }
+  w.write("]");
+  return w.close();
+}
+
+// Generates a list of count log entries, most of whose contents are strings
+// that are too long for std::string's inline storage
+static string generate_log_entries_json(size_t count) {
+  BlockStringWriter w;
+  w.write("[");
+  for (size_t z = 0; z < count; z++) {
+    w.write_fmt("{}{{\"timestamp\": \"2024-01-{:02}T12:{:02}:{:02}.000000Z\", "
+                "\"source\": \"worker-{}.cluster.example.com\", "
+                "\"message\": \"Finished processing request {} for user {} in {} milliseconds\", "
+                "\"path\": \"/api/v2/accounts/{}/items/{}\"}}",
+        z ? "," : "", (z % 28) + 1, z % 60, (z * 7) % 60, z % 64, z, z * 13, z % 1000, z * 17, z);
+  }
+  w.write("]");
+  return w.close();
+}
+
+// Parses input with each strategy and reports how much memory the result
+// holds on to (not counting temporary allocations made during parsing). For
+// the retained-source document, this doesn't include the source itself, since
+// the caller already had it in memory.
+static void report_retained_memory(const char* input_name, const string& input) {
+  auto report = [&](const char* name, size_t start_live_bytes) -> void {
+    size_t retained_bytes = live_bytes.load() - start_live_bytes;
+    fwrite_fmt(stdout, "{:<48} {:>8.1f} MB retained  ({:.2f}x input size)\n",
+        std::format("{} ({})", name, input_name), static_cast<double>(retained_bytes) / (1024 * 1024),
+        static_cast<double>(retained_bytes) / input.size());
+  };
+  {
+    size_t start_live_bytes = live_bytes.load();
+    JSON json = JSON::parse(input);
+    report("JSON::parse", start_live_bytes);
+  }
+  {
+    size_t start_live_bytes = live_bytes.load();
+    JSONDocument doc(input);
+    report("JSONDocument", start_live_bytes);
+  }
+  {
+    auto shared_input = make_shared<const string>(input);
+    size_t start_live_bytes = live_bytes.load();
+    JSONDocument doc(shared_input);
+    report("JSONDocument (retained source)", start_live_bytes);
+  }
+}
+
+// Generates a list of count [x, y, z] coordinate lists, like a GeoJSON
+// geometry or a point cloud
+static string generate_coordinates_json(size_t count) {
+  BlockStringWriter w;
+  w.write("[");
+  for (size_t z = 0; z < count; z++) {
+    w.write_fmt("{}[{},{},{}]", z ? "," : "", z * 0.001234567, -static_cast<double>(z) / 7.0, z * 31);
+  }
+  w.write("]");
+  return w.close();
+}
+
+// Generates a list of count dicts, each with keys_per_dict keys
+static string generate_dicts_json(size_t count, size_t keys_per_dict) {
+  BlockStringWriter w;
+  w.write("[");
+  for (size_t z = 0; z < count; z++) {
+    w.write(z ? ",{" : "{");
+    for (size_t y = 0; y < keys_per_dict; y++) {
+      w.write_fmt("{}\"field_{}\":{}", y ? "," : "", y, z + y);
+    }
+    w.write("}");
+  }
+  w.write("]");
+  return w.close();
+}
+
+// The same structure as each record in generate_records_json, for the typed
+// struct benchmarks
+struct BenchmarkPosition {
+  int64_t x;
+  int64_t y;
+  double z;
+};
+
+template <>
+struct phosg::JSONStructFields<BenchmarkPosition> {
+  static constexpr auto fields = std::make_tuple(
+      PHOSG_JSON_FIELD(BenchmarkPosition, x),
+      PHOSG_JSON_FIELD(BenchmarkPosition, y),
+      PHOSG_JSON_FIELD(BenchmarkPosition, z));
+};
+
+struct BenchmarkRecord {
+  int64_t id;
+  string name;
+  double score;
+  bool active;
+  vector<string> tags;
+  BenchmarkPosition position;
+
+  BenchmarkRecord() = default;
+  // This is how records are usually converted from JSON objects
+  explicit BenchmarkRecord(const JSON& json)
+      : id(json.get_int("id")),
+        name(json.get_string("name")),
+        score(json.get_float("score")),
+        active(json.get_bool("active")) {
+    for (const auto& tag : json.get_list("tags")) {
+      this->tags.emplace_back(tag->as_string());
+    }
+    const JSON& position_json = json.at("position");
+    this->position.x = position_json.get_int("x");
+    this->position.y = position_json.get_int("y");
+    this->position.z = position_json.get_float("z");
+  }
+};
+
+template <>
+struct phosg::JSONStructFields<BenchmarkRecord> {
+  static constexpr auto fields = std::make_tuple(
+      PHOSG_JSON_FIELD(BenchmarkRecord, id),
+      PHOSG_JSON_FIELD(BenchmarkRecord, name),
+      PHOSG_JSON_FIELD(BenchmarkRecord, score),
+      PHOSG_JSON_FIELD(BenchmarkRecord, active),
+      PHOSG_JSON_FIELD(BenchmarkRecord, tags),
+      PHOSG_JSON_FIELD(BenchmarkRecord, position));
+};
+
+template <typename FnT>
+void run_benchmark(const char* name, size_t input_bytes, size_t iterations, FnT&& fn) {
+  size_t start_allocations = allocation_count.load();
+  size_t start_allocation_bytes = allocation_bytes.load();
+  uint64_t start_time = now();
+  for (size_t z = 0; z < iterations; z++) {
+    fn();
+  }
+  uint64_t total_usecs = now() - start_time;
+  size_t total_allocations = allocation_count.load() - start_allocations;
+  size_t total_allocation_bytes = allocation_bytes.load() - start_allocation_bytes;
+
+  double usecs_per_iteration = static_cast<double>(total_usecs) / iterations;
+  double gb_per_sec = (usecs_per_iteration > 0) ? (input_bytes / usecs_per_iteration / 1000.0) : 0.0;
+  double allocated_mb = static_cast<double>(total_allocation_bytes) / iterations / (1024 * 1024);
+  fwrite_fmt(stdout, "{:<40} {:>12.0f} usecs  {:>10} allocs  {:>8.1f} MB allocated  {:>8.3f} GB/s\n",
+      name, usecs_per_iteration, total_allocations / iterations, allocated_mb, gb_per_sec);
+}
+
+int main(int argc, char** argv) {
+  size_t record_count = (argc > 1) ? stoull(argv[1], nullptr, 0) : 100000;
+  size_t iterations = (argc > 2) ? stoull(argv[2], nullptr, 0) : 5;
+
+  string records_json = generate_records_json(record_count);
+  fwrite_fmt(stdout, "Input: {} records, {}\n", record_count, format_size(records_json.size()));
+
+  fwrite_fmt(stdout, "-- parse + destroy\n");
+  run_benchmark("JSON::parse (unique_ptr nodes)", records_json.size(), iterations, [&]() {
+    JSON json = JSON::parse(records_json);
+  });
+  run_benchmark("JSONDocument (fast parser, arena nodes)", records_json.size(), iterations, [&]() {
+    JSONDocument doc(records_json);
+  });
+  run_benchmark("JSON::parse_fast (structural index)", records_json.size(), iterations, [&]() {
+    JSON json = JSON::parse_fast(records_json);
+  });
+  auto shared_records_json = make_shared<const string>(records_json);
+  run_benchmark("JSONDocument (retained source)", records_json.size(), iterations, [&]() {
+    JSONDocument doc(shared_records_json);
+  });
+
+  fwrite_fmt(stdout, "-- memory retained after parsing\n");
+  report_retained_memory("records", records_json);
+  {
+    string log_entries_json = generate_log_entries_json(record_count);
+    fwrite_fmt(stdout, "String-heavy input: {} log entries, {}\n", record_count, format_size(log_entries_json.size()));
+    report_retained_memory("log entries", log_entries_json);
+  }
+
+  fwrite_fmt(stdout, "-- parse + read 3 values\n");
+  size_t probe_index = record_count / 2;
+  run_benchmark("JSON::parse_fast + at()", records_json.size(), iterations, [&]() {
+    JSON json = JSON::parse_fast(records_json);
+    const JSON& record = json.at(probe_index);
+    if (record.get_int("id") != static_cast<int64_t>(probe_index) || record.get_string("name").empty() ||
+        record.at("position").get_int("x") != static_cast<int64_t>(probe_index * 3)) {
+      throw logic_error("incorrect values read");
+    }
+  });
+  run_benchmark("JSONView + at()", records_json.size(), iterations, [&]() {
+    JSONView view(records_json);
+    JSONView record = view.at(probe_index);
+    if (record.get_int("id") != static_cast<int64_t>(probe_index) || record.at("name").as_string_view().empty() ||
+        record.at("position").get_int("x") != static_cast<int64_t>(probe_index * 3)) {
+      throw logic_error("incorrect values read");
+    }
+  });
+
+  fwrite_fmt(stdout, "-- path lookups (every record)\n");
+  JSON records = JSON::parse_fast(records_json);
+  run_benchmark("JSON::at() chain", records_json.size(), iterations, [&]() {
+    int64_t sum = 0;
+    for (const auto& record : records.as_list()) {
+      sum += record->at("position").at("y").as_int() + record->at("tags").at(1).as_string().size();
+    }
+    if (sum == 0) {
+      throw logic_error("incorrect values read");
+    }
+  });
+  JSONPath y_path("/position/y");
+  JSONPath tag_path("/tags/1");
+  run_benchmark("JSONPath::find (precompiled)", records_json.size(), iterations, [&]() {
+    int64_t sum = 0;
+    for (const auto& record : records.as_list()) {
+      sum += y_path.find(*record)->as_int() + tag_path.find(*record)->as_string().size();
+    }
+    if (sum == 0) {
+      throw logic_error("incorrect values read");
+    }
+  });
+  JSONPath all_y_path("/*/position/y", true);
+  run_benchmark("JSONPath::find_all (wildcard)", records_json.size(), iterations, [&]() {
+    if (all_y_path.find_all(records).size() != record_count) {
+      throw logic_error("incorrect values read");
+    }
+  });
+
+  fwrite_fmt(stdout, "-- diff and patch (one record changed)\n");
+  JSON modified_records = records;
+  modified_records.at(probe_index).at("position").at("y") = -1;
+  modified_records.at(probe_index).at("tags").emplace_back("delta");
+  run_benchmark("JSON::diff", records_json.size(), iterations, [&]() {
+    if (records.diff(modified_records).size() != 2) {
+      throw logic_error("incorrect patch generated");
+    }
+  });
+  JSON patch = records.diff(modified_records);
+  JSON reverse_patch = modified_records.diff(records);
+  run_benchmark("JSON::apply_patch (forward and back)", records_json.size(), iterations, [&]() {
+    records.apply_patch(patch);
+    records.apply_patch(reverse_patch);
+  });
+  string modified_records_json = modified_records.serialize();
+  run_benchmark("JSON::parse_fast (entire document)", records_json.size(), iterations, [&]() {
+    JSON json = JSON::parse_fast(modified_records_json);
+  });
+
+  fwrite_fmt(stdout, "-- copy and modify one value\n");
+  run_benchmark("JSON copy + at() assignment", records_json.size(), iterations, [&]() {
+    JSON copy = records;
+    copy.at(probe_index).at("position").at("y") = -1;
+  });
+
+  fwrite_fmt(stdout, "-- typed structs\n");
+  run_benchmark("JSON::parse_fast + convert", records_json.size(), iterations, [&]() {
+    JSON json = JSON::parse_fast(records_json);
+    vector<BenchmarkRecord> structs;
+    structs.reserve(json.size());
+    for (const auto& record : json.as_list()) {
+      structs.emplace_back(*record);
+    }
+  });
+  run_benchmark("parse_json_struct", records_json.size(), iterations, [&]() {
+    auto structs = parse_json_struct<vector<BenchmarkRecord>>(records_json);
+  });
+  auto record_structs = parse_json_struct<vector<BenchmarkRecord>>(records_json);
+  run_benchmark("convert + JSON::serialize", records_json.size(), iterations, [&]() {
+    JSON json = JSON::list();
+    for (const auto& record : record_structs) {
+      JSON tags_json = JSON::list();
+      for (const auto& tag : record.tags) {
+        tags_json.emplace_back(tag);
+      }
+      json.emplace_back(JSON::dict({
+          {"id", record.id},
+          {"name", record.name},
+          {"score", record.score},
+          {"active", record.active},
+          {"tags", std::move(tags_json)},
+          {"position", JSON::dict({{"x", record.position.x}, {"y", record.position.y}, {"z", record.position.z}})},
+      }));
+    }
+    string data = json.serialize();
+  });
+  run_benchmark("serialize_json_struct", records_json.size(), iterations, [&]() {
+    string data = serialize_json_struct(record_structs);
+  });
+
+  fwrite_fmt(stdout, "-- serialize\n");
+  run_benchmark("JSON::serialize (string)", records_json.size(), iterations, [&]() {
+    string data = records.serialize(JSON::SerializeOption::FORMAT);
+  });
+  run_benchmark("JSON::serialize (64KB chunks to callback)", records_json.size(), iterations, [&]() {
+    size_t bytes = 0;
+    records.serialize([&](const void*, size_t size) -> void {
+      bytes += size;
+    },
+        JSON::SerializeOption::FORMAT);
+  });
+  size_t max_threads = thread::hardware_concurrency();
+  for (size_t num_threads = 1; num_threads <= max_threads; num_threads = (num_threads < max_threads) ? min(num_threads * 2, max_threads) : (max_threads + 1)) {
+    string name = std::format("JSON::serialize_parallel ({} threads)", num_threads);
+    run_benchmark(name.c_str(), records_json.size(), iterations, [&]() {
+      string data = records.serialize_parallel(JSON::SerializeOption::FORMAT, num_threads);
+    });
+  }
+
+  fwrite_fmt(stdout, "-- binary serialization\n");
+  string text_data = records.serialize();
+  string binary_data = records.serialize_binary(false);
+  string deduplicated_binary_data = records.serialize_binary(true);
+  fwrite_fmt(stdout, "Sizes: {} text, {} binary, {} binary with deduplicated strings\n",
+      format_size(text_data.size()), format_size(binary_data.size()), format_size(deduplicated_binary_data.size()));
+  run_benchmark("JSON::serialize", text_data.size(), iterations, [&]() {
+    string data = records.serialize();
+  });
+  run_benchmark("JSON::serialize_binary", text_data.size(), iterations, [&]() {
+    string data = records.serialize_binary(false);
+  });
+  run_benchmark("JSON::serialize_binary (deduplicated)", text_data.size(), iterations, [&]() {
+    string data = records.serialize_binary(true);
+  });
+  run_benchmark("JSON::parse_fast", text_data.size(), iterations, [&]() {
+    JSON json = JSON::parse_fast(text_data);
+  });
+  run_benchmark("JSON::parse_binary", text_data.size(), iterations, [&]() {
+    JSON json = JSON::parse_binary(binary_data);
+  });
+  run_benchmark("JSON::parse_binary (deduplicated)", text_data.size(), iterations, [&]() {
+    JSON json = JSON::parse_binary(deduplicated_binary_data);
+  });
+
+  string coordinates_json = generate_coordinates_json(record_count * 5);
+  fwrite_fmt(stdout, "-- numbers ({} coordinates, {})\n", record_count * 5, format_size(coordinates_json.size()));
+  run_benchmark("JSON::parse", coordinates_json.size(), iterations, [&]() {
+    JSON json = JSON::parse(coordinates_json);
+  });
+  run_benchmark("JSON::parse_fast", coordinates_json.size(), iterations, [&]() {
+    JSON json = JSON::parse_fast(coordinates_json);
+  });
+  JSON coordinates = JSON::parse_fast(coordinates_json);
+  run_benchmark("JSON::serialize", coordinates_json.size(), iterations, [&]() {
+    string data = coordinates.serialize();
+  });
+
+#ifdef PHOSG_JSON_FLAT_DICT
+  const char* dict_type_name = "flat dicts";
+#else
+  const char* dict_type_name = "unordered_map dicts";
+#endif
+  for (size_t keys_per_dict : {8, 1000}) {
+    size_t dict_count = (record_count * 10) / keys_per_dict;
+    string dicts_json = generate_dicts_json(dict_count, keys_per_dict);
+    fwrite_fmt(stdout, "-- {} dicts with {} keys each ({}, {})\n",
+        dict_count, keys_per_dict, format_size(dicts_json.size()), dict_type_name);
+    run_benchmark("parse", dicts_json.size(), iterations, [&]() {
+      JSON json = JSON::parse_fast(dicts_json);
+    });
+    JSON dicts = JSON::parse_fast(dicts_json);
+    vector<string> keys;
+    for (size_t y = 0; y < keys_per_dict; y++) {
+      keys.emplace_back(std::format("field_{}", y));
+    }
+    run_benchmark("lookup (every key)", dicts_json.size(), iterations, [&]() {
+      int64_t sum = 0;
+      for (const auto& dict : dicts.as_list()) {
+        for (const auto& key : keys) {
+          sum += dict->get_int(key);
+        }
+      }
+      if (sum == 0) {
+        throw logic_error("incorrect values read");
+      }
+    });
+    run_benchmark("lookup with default (missing key)", dicts_json.size(), iterations, [&]() {
+      int64_t sum = 0;
+      for (const auto& dict : dicts.as_list()) {
+        sum += dict->get_int("missing", 1);
+      }
+      if (sum == 0) {
+        throw logic_error("incorrect values read");
+      }
+    });
+    run_benchmark("iterate", dicts_json.size(), iterations, [&]() {
+      int64_t sum = 0;
+      for (const auto& dict : dicts.as_list()) {
+        for (const auto& [key, value] : dict->as_dict()) {
+          sum += value->as_int();
+        }
+      }
+      if (sum == 0) {
+        throw logic_error("incorrect values read");
+      }
+    });
+    run_benchmark("serialize", dicts_json.size(), iterations, [&]() {
+      string data = dicts.serialize();
+    });
+  }
+
+  fwrite_fmt(stdout, "-- streaming\n");
+  run_benchmark("JSONEventReader (count values)", records_json.size(), iterations, [&]() {
+    StringReader r(records_json);
+    JSONEventReader er(r);
+    size_t value_count = 0;
+    for (auto ev = er.next(); ev != JSONEventReader::Event::END; ev = er.next()) {
+      value_count += (ev == JSONEventReader::Event::VALUE);
+    }
+    if (value_count == 0) {
+      throw logic_error("no values were read");
+    }
+  });
+
+  fwrite_fmt(stdout, "-- push parser (1500-byte pieces)\n");
+  run_benchmark("buffer all pieces, then JSON::parse", records_json.size(), iterations, [&]() {
+    string buffer;
+    for (size_t offset = 0; offset < records_json.size(); offset += 1500) {
+      buffer.append(records_json, offset, 1500);
+    }
+    JSON json = JSON::parse(buffer);
+  });
+  run_benchmark("JSONPushParser::feed", records_json.size(), iterations, [&]() {
+    JSONPushParser p;
+    for (size_t offset = 0; offset < records_json.size(); offset += 1500) {
+      p.feed(records_json.data() + offset, min<size_t>(1500, records_json.size() - offset));
+    }
+    p.finish();
+    JSON json = p.get_value();
+  });
+
+  fwrite_fmt(stdout, "-- JSON lines\n");
+  string lines_data;
+  for (const auto& record : records.as_list()) {
+    lines_data += record->serialize();
+    lines_data += '\n';
+  }
+  run_benchmark("JSON::parse_fast (line by line)", lines_data.size(), iterations, [&]() {
+    vector<JSON> values;
+    for (size_t offset = 0; offset < lines_data.size();) {
+      size_t end_offset = lines_data.find('\n', offset);
+      values.emplace_back(JSON::parse_fast(lines_data.data() + offset, end_offset - offset));
+      offset = end_offset + 1;
+    }
+  });
+  for (size_t num_threads = 1; num_threads <= max_threads; num_threads = (num_threads < max_threads) ? min(num_threads * 2, max_threads) : (max_threads + 1)) {
+    string name = std::format("JSON::parse_lines ({} threads)", num_threads);
+    run_benchmark(name.c_str(), lines_data.size(), iterations, [&]() {
+      auto values = JSON::parse_lines(lines_data, num_threads);
+    });
+  }
+
+  return 0;
+}
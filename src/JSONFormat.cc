@@ -72,12 +72,11 @@ int main(int argc, char** argv) {
     return 2;
   }
 
-  string result = json.serialize(options);
-
   if (!dst_filename || !strcmp(dst_filename, "-")) {
-    fwritex(stdout, result);
+    json.print(stdout, options);
   } else {
-    save_file(dst_filename, result);
+    auto f = fopen_unique(dst_filename, "wb");
+    json.print(f.get(), options);
   }
 
   return 0;
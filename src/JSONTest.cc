@@ -3,7 +3,13 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "JSON.hh"
 #include "UnitTest.hh"
@@ -44,6 +50,48 @@ const char* phosg::name_for_enum<JSONTestEnum>(JSONTestEnum v) {
   }
 }
 
+struct JSONTestPosition {
+  double x;
+  double y;
+
+  bool operator==(const JSONTestPosition&) const = default;
+};
+
+template <>
+struct phosg::JSONStructFields<JSONTestPosition> {
+  static constexpr auto fields = std::make_tuple(
+      PHOSG_JSON_FIELD(JSONTestPosition, x),
+      PHOSG_JSON_FIELD(JSONTestPosition, y));
+};
+
+struct JSONTestRecord {
+  int64_t id;
+  uint8_t level;
+  string name;
+  bool active;
+  JSONTestPosition position;
+  vector<string> tags;
+  optional<int64_t> parent_id;
+  map<string, vector<JSONTestPosition>> paths;
+  JSON extra;
+
+  bool operator==(const JSONTestRecord&) const = default;
+};
+
+template <>
+struct phosg::JSONStructFields<JSONTestRecord> {
+  static constexpr auto fields = std::make_tuple(
+      PHOSG_JSON_FIELD(JSONTestRecord, id),
+      PHOSG_JSON_FIELD(JSONTestRecord, level),
+      PHOSG_JSON_FIELD(JSONTestRecord, name),
+      PHOSG_JSON_FIELD(JSONTestRecord, active),
+      json_field("pos", &JSONTestRecord::position),
+      PHOSG_JSON_FIELD(JSONTestRecord, tags),
+      PHOSG_JSON_FIELD(JSONTestRecord, parent_id),
+      PHOSG_JSON_FIELD(JSONTestRecord, paths),
+      PHOSG_JSON_FIELD(JSONTestRecord, extra));
+};
+
 int main(int, char**) {
   uint32_t hex_option = JSON::SerializeOption::HEX_INTEGERS;
   uint32_t format_option = JSON::SerializeOption::FORMAT;
@@ -545,6 +593,30 @@ int main(int, char**) {
   expect_eq(root.get("dict1", JSON::dict({{"two", 2}})), JSON::dict({{"one", 1}}));
   expect_eq(root.get("missing", JSON::dict({{"two", 2}})), JSON::dict({{"two", 2}}));
 
+  {
+    fwrite_fmt(stderr, "-- find\n");
+    expect_eq(root.find("int1"), &root.at("int1"));
+    expect_eq(root.find("missing"), nullptr);
+    const JSON& const_root = root;
+    expect_eq(const_root.find("int1"), &const_root.at("int1"));
+    expect_eq(const_root.find("missing"), nullptr);
+    expect_eq(*root.at("list1").find(0), 1);
+    expect_eq(root.at("list1").find(1), nullptr);
+    expect_raises(JSON::type_error, [&]() {
+      root.find(0);
+    });
+    expect_raises(JSON::type_error, [&]() {
+      root.at("list1").find("int1");
+    });
+    expect_raises(JSON::type_error, [&]() {
+      root.get_int("string1", 5);
+    });
+    JSON list_root = JSON::list({1, "two"});
+    expect_eq(list_root.get_int(0, 5), 1);
+    expect_eq(list_root.get_int(2, 5), 5);
+    expect_eq(list_root.get_string(1, "def"), "two");
+  }
+
   fwrite_fmt(stderr, "-- retrieval + equality (with other JSON objects)\n");
   expect_eq(root.at("null"), JSON(nullptr));
   expect_eq(root.at("true"), JSON(true));
@@ -641,6 +713,138 @@ int main(int, char**) {
   expect_eq(root.at("dict1").serialize(format_option), "{\"one\": 1}");
   expect_eq(root.at("dict1").serialize(format_option | expand_option), "{\n  \"one\": 1\n}");
 
+  {
+    fwrite_fmt(stderr, "-- serialize (streaming)\n");
+    JSON big = JSON::list();
+    for (size_t z = 0; z < 2000; z++) {
+      big.emplace_back(JSON(root));
+    }
+    for (uint32_t options : {0U, format_option, format_option | expand_option, expand_option, hex_option | one_char_trivial_option,
+             static_cast<uint32_t>(JSON::SerializeOption::SORT_DICT_KEYS | JSON::SerializeOption::HEX_ESCAPE_CODES)}) {
+      string expected = big.serialize(options, 2);
+      string streamed;
+      size_t max_chunk_size = 0;
+      big.serialize([&](const void* data, size_t size) -> void {
+        streamed.append(reinterpret_cast<const char*>(data), size);
+        max_chunk_size = max<size_t>(max_chunk_size, size);
+      },
+          options, 2);
+      expect_eq(streamed, expected);
+      expect_lt(max_chunk_size, expected.size());
+
+      StringWriter w;
+      w.write("prefix");
+      big.serialize(w, options, 2);
+      expect_eq(w.str(), "prefix" + expected);
+    }
+  }
+
+  {
+    fwrite_fmt(stderr, "-- serialize (parallel)\n");
+    // A large list, a large dict nested inside a small dict, and a small list
+    JSON big = JSON::dict({{"list", JSON::list()}, {"wrapper", JSON::dict({{"dict", JSON::dict()}})}, {"small", JSON::list({1, 2})}});
+    for (size_t z = 0; z < 3000; z++) {
+      big.at("list").emplace_back(JSON(root));
+      big.at("wrapper").at("dict").emplace(std::format("key{}", z), (z & 1) ? JSON(z) : JSON::list({z, "z"}));
+    }
+    for (uint32_t options : {0U, format_option, format_option | expand_option, expand_option, hex_option | one_char_trivial_option,
+             static_cast<uint32_t>(JSON::SerializeOption::SORT_DICT_KEYS | JSON::SerializeOption::FORMAT)}) {
+      string expected = big.serialize(options, 2);
+      for (size_t num_threads : {1, 2, 3, 8}) {
+        expect_eq(big.serialize_parallel(options, num_threads, 2), expected);
+      }
+      expect_eq(root.serialize_parallel(options, 4), root.serialize(options));
+      expect_eq(JSON::list().serialize_parallel(options, 4), "[]");
+      expect_eq(JSON(7).serialize_parallel(options, 4), JSON(7).serialize(options));
+    }
+  }
+
+#ifdef PHOSG_JSON_FLAT_DICT
+  {
+    fwrite_fmt(stderr, "-- flat dicts\n");
+    // Dicts preserve insertion order, including when parsed and reserialized
+    string ordered_data = "{\"zeta\":1,\"alpha\":2,\"mu\":{\"y\":3,\"x\":4}}";
+    JSON ordered = JSON::parse(ordered_data);
+    expect_eq(ordered.serialize(), ordered_data);
+    expect_eq(JSON::parse_fast(ordered_data).serialize(), ordered_data);
+    expect_eq(JSON(ordered).serialize(), ordered_data);
+    expect_eq(ordered.serialize(JSON::SerializeOption::SORT_DICT_KEYS), "{\"alpha\":2,\"mu\":{\"x\":4,\"y\":3},\"zeta\":1}");
+    ordered.erase("alpha");
+    ordered.emplace("beta", 5);
+    expect_eq(ordered.serialize(), "{\"zeta\":1,\"mu\":{\"y\":3,\"x\":4},\"beta\":5}");
+
+    JSON large = JSON::dict();
+    for (size_t z = 0; z < 100; z++) {
+      large.emplace(std::format("key{}", 99 - z), z);
+    }
+    expect_eq(large.get_int("key0"), 99);
+    expect_eq(large.as_dict().begin()->first, "key99");
+    expect_eq(JSON::parse(large.serialize()), large);
+
+    // Keys are interned by all parsers, so the same key in different dicts
+    // shares storage (including keys that contain escape sequences)
+    string records_data = "[{\"id\":1,\"n\\u0061me\":\"a\"},{\"id\":2,\"n\\u0061me\":\"b\"}]";
+    JSON records_json = JSON::list({JSON::dict({{"id", 1}, {"name", "a"}}), JSON::dict({{"id", 2}, {"name", "b"}})});
+    for (const auto& records : {JSON::parse(records_data), JSON::parse_fast(records_data), JSON::parse_binary(records_json.serialize_binary())}) {
+      expect_eq(records, records_json);
+      const auto& dict0 = records.at(0).as_dict();
+      const auto& dict1 = records.at(1).as_dict();
+      expect_eq(dict0.begin()->first, "id");
+      expect((dict0.begin() + 1)->first.shares_data_with((dict1.begin() + 1)->first));
+      expect(dict0.begin()->first.shares_data_with(dict1.begin()->first));
+    }
+  }
+#endif
+
+  {
+    fwrite_fmt(stderr, "-- copies\n");
+    // Modifying a copy never affects the original, whether or not containers
+    // are shared between copies
+    JSON original = JSON::dict({{"root", root}, {"list", JSON::list({JSON::list({1}), JSON::dict({{"a", 2}})})}});
+    JSON copy = original;
+    expect_eq(copy, original);
+    copy.at("root").at("list1").emplace_back(2);
+    copy.at("list").at(1).at("a") = 3;
+    expect_eq(original.at("root").at("list1"), JSON::list({1}));
+    expect_eq(original.at("list").at(1).at("a"), 2);
+    expect_eq(copy.at("root").at("list1"), JSON::list({1, 2}));
+    expect_ne(copy, original);
+    JSON cleared = original;
+    cleared.at("list").clear();
+    expect_eq(original.at("list").size(), 2);
+
+#ifdef PHOSG_JSON_SHARED_CONTAINERS
+    // Only the containers on the paths to the modified values were copied
+    const JSON& const_original = original;
+    const JSON& const_copy = copy;
+    expect_ne(&const_copy.as_dict(), &const_original.as_dict());
+    expect_ne(&const_copy.at("root").as_dict(), &const_original.at("root").as_dict());
+    expect_eq(&const_copy.at("root").at("dict1").as_dict(), &const_original.at("root").at("dict1").as_dict());
+    expect_eq(&const_copy.at("list").at(0).as_list(), &const_original.at("list").at(0).as_list());
+    expect_ne(&const_copy.at("list").at(1).as_dict(), &const_original.at("list").at(1).as_dict());
+#endif
+
+    // Workers can copy and modify the same tree concurrently
+    vector<thread> threads;
+    for (size_t z = 0; z < 4; z++) {
+      threads.emplace_back([&, z]() {
+        for (size_t y = 0; y < 100; y++) {
+          JSON worker_copy = original;
+          worker_copy.at("root").at("list1").emplace_back(z);
+          worker_copy.at("list").at(0).at(0) = static_cast<int64_t>(y);
+          if ((worker_copy.at("root").at("list1").size() != 2) || (worker_copy.at("list").at(0).at(0) != static_cast<int64_t>(y))) {
+            throw logic_error("incorrect copy");
+          }
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    expect_eq(original.at("root").at("list1"), JSON::list({1}));
+    expect_eq(original.at("list").at(0), JSON::list({1}));
+  }
+
   fwrite_fmt(stderr, "-- parse\n");
   expect_eq(root.at("null"), JSON::parse("null"));
   expect_eq(root.at("true"), JSON::parse("true"));
@@ -671,6 +875,34 @@ int main(int, char**) {
   fwrite_fmt(stderr, "-- parse dict with trailing comma\n");
   expect_eq(root.at("dict1"), JSON::parse("{\"one\":1,}"));
 
+  {
+    fwrite_fmt(stderr, "-- numbers\n");
+    expect_eq(JSON::parse("9223372036854775807").as_int(), INT64_MAX);
+    expect_eq(JSON::parse("-9223372036854775808").as_int(), INT64_MIN);
+    expect(JSON::parse("9223372036854775808").is_float());
+    expect_eq(JSON::parse("9223372036854775808").as_float(), 9223372036854775808.0);
+    expect(JSON::parse("1e3").is_float());
+    expect_eq(JSON::parse("1e3").as_float(), 1000.0);
+    expect_eq(JSON::parse("-1.5E-2").as_float(), -0.015);
+    expect_eq(JSON::parse("1e400").as_float(), numeric_limits<double>::infinity());
+    expect_eq(JSON::parse("-1e-400").as_float(), 0.0);
+    expect_eq(JSON::parse("0.1").as_float(), 0.1);
+    expect_eq(JSON::parse("-0x7FFFFFFFFFFFFFFF").as_int(), -INT64_MAX);
+
+    expect_eq(JSON(0.1).serialize(), "0.1");
+    expect_eq(JSON(-2.0).serialize(), "-2.0");
+    expect_eq(JSON(1e21).serialize(), "1e+21");
+    expect_eq(JSON(1.5e-10).serialize(), "1.5e-10");
+    expect_eq(JSON(INT64_MIN).serialize(), "-9223372036854775808");
+    for (double v : {0.1, 1.0 / 3.0, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308,
+             123456789.123456789, -2.5e-10, 1e21, 1e22, 0.0}) {
+      string data = JSON(v).serialize();
+      expect_eq(JSON::parse(data).as_float(), v);
+      expect_eq(JSON::parse_fast(data).as_float(), v);
+      expect(JSON::parse(data).is_float());
+    }
+  }
+
   fwrite_fmt(stderr, "-- serialize / parse\n");
   expect_eq(JSON::parse(root.serialize()), root);
   fwrite_fmt(stderr, "-- serialize (format) / parse\n");
@@ -711,6 +943,776 @@ int main(int, char**) {
   expect_raises(JSON::parse_error, [&]() {
     JSON::parse("// this is null\nnull", 20, true);
   });
+  expect_eq(JSON::parse("[]", 2, true), JSON::list());
+  expect_eq(JSON::parse("{ }", 3, true), JSON::dict());
+  expect_raises(JSON::parse_error, [&]() {
+    JSON::parse("[1,]", 4, true);
+  });
+
+  {
+    fwrite_fmt(stderr, "-- binary serialization\n");
+    JSON values = JSON::list({root, INT64_MIN, INT64_MAX, -1, 0, 63, -64, 64, 1e300, -0.5, string(1000, 'x'), ""});
+    for (bool deduplicate_strings : {false, true}) {
+      string data = values.serialize_binary(deduplicate_strings);
+      expect_eq(JSON::parse_binary(data), values);
+
+      // Every truncated prefix of the data should fail to parse
+      for (size_t size = 0; size < data.size(); size++) {
+        expect_raises(JSON::parse_error, [&]() {
+          JSON::parse_binary(data.data(), size);
+        });
+      }
+      expect_raises(JSON::parse_error, [&]() {
+        JSON::parse_binary(data + string(1, '\0'));
+      });
+
+      // The StringWriter variant appends, and the StringReader variant stops
+      // at the end of the value
+      StringWriter w;
+      w.write("abc");
+      values.serialize_binary(w, deduplicate_strings);
+      JSON(7).serialize_binary(w, deduplicate_strings);
+      expect_eq(w.str().substr(3, data.size()), data);
+      StringReader r(w.str());
+      r.skip(3);
+      expect_eq(JSON::parse_binary(r), values);
+      expect_eq(JSON::parse_binary(r), 7);
+      expect(r.eof());
+    }
+
+    // Deduplicating strings makes repeated keys and values much smaller
+    JSON records = JSON::list();
+    for (size_t z = 0; z < 100; z++) {
+      records.emplace_back(JSON::dict({{"identifier", z}, {"description", "repeated value"}}));
+    }
+    string basic_data = records.serialize_binary(false);
+    string deduplicated_data = records.serialize_binary(true);
+    expect_lt(deduplicated_data.size() * 3, basic_data.size());
+    expect_eq(JSON::parse_binary(deduplicated_data), records);
+
+    expect_raises(JSON::parse_error, [&]() {
+      JSON::parse_binary(string("\x02\x00", 2)); // Unknown format
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      JSON::parse_binary(string("\x00\x09", 2)); // Unknown type
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      JSON::parse_binary(string("\x01\x05\x03", 3)); // Invalid string reference
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      JSON::parse_binary(string("\x00\x03\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01", 13)); // Varint too long
+    });
+  }
+
+  {
+    fwrite_fmt(stderr, "-- fast parser\n");
+    // parse_fast must return the same value as parse, or throw the same
+    // exception with the same message
+    auto check_parse_fast = [&](const string& data, bool disable_extensions) -> void {
+      string expected_error, actual_error;
+      JSON expected, actual;
+      try {
+        expected = JSON::parse(data, disable_extensions);
+      } catch (const exception& e) {
+        expected_error = e.what();
+      }
+      try {
+        actual = JSON::parse_fast(data, disable_extensions);
+      } catch (const exception& e) {
+        actual_error = e.what();
+      }
+      expect_eq(actual_error, expected_error);
+      expect_eq(actual, expected);
+    };
+
+    vector<string> cases = {
+        root.serialize(),
+        root.serialize(JSON::SerializeOption::FORMAT),
+        root.serialize(JSON::SerializeOption::HEX_INTEGERS | JSON::SerializeOption::ONE_CHARACTER_TRIVIAL_CONSTANTS),
+        "", " ", "null", "n", "nul", "nulll", "t", "tru", "true", "truex", "f", "false", "-", "+5", "0x1F",
+        "0x", "1.5e3", "1.5E-2", "1e", "1.2.3", "1x", "-12 ", "[1 2]", "[1,,2]", "[,]", "[1,]", "{\"a\":1,}",
+        "{\"a\" 1}", "{1:2}", "{\"a\":}", "[", "{", "]", "}", "[[[]]]", "{\"a\":{\"b\":[{}]}}", "\"abc",
+        "\"a\\\"b\"", "\"a\\\\\"", "\"\\x41\\u0042\"", "\"\\u1234\"", "\"\\x4\"", "\"\\q\"", "\"a\" \"b\"",
+        "[null,true,false,n,t,f]", "[1]x", "// comment\n[1, // one\n2]", "[1//c\n]", "[\"//not a comment\"]",
+        "1/2", "[\"a\"1]", "[1\"a\"]", "{\"a\":1\n,\"b\":2}\n\n", "\t\r\n[ ]"};
+    // Strings whose escape sequences and quotes fall on either side of a
+    // 64-byte block boundary
+    for (size_t z = 58; z < 70; z++) {
+      cases.emplace_back("[\"" + string(z, 'a') + "\\\\\", \"\\\"\", {\"" + string(z, 'b') + "\\\"\": 2}]");
+      cases.emplace_back("[" + string(z, ' ') + "\"\\\\\\\"\", 1234, \"x\"]");
+      cases.emplace_back(string(z, ' ') + "12345678 ");
+    }
+    for (const auto& c : cases) {
+      check_parse_fast(c, false);
+      check_parse_fast(c, true);
+    }
+  }
+
+  {
+    fwrite_fmt(stderr, "-- JSON lines\n");
+    // This is large enough to be split into multiple chunks
+    string lines_data;
+    vector<JSON> expected_values;
+    for (size_t z = 0; z < 20000; z++) {
+      JSON value = JSON::dict({{"id", z}, {"name", std::format("item {}", z)}, {"tags", JSON::list({z % 3, "x"})}});
+      lines_data += value.serialize();
+      lines_data += (z % 7) ? "\n" : "\r\n  \n";
+      expected_values.emplace_back(std::move(value));
+    }
+    lines_data += "\"last line without newline\"";
+    expected_values.emplace_back("last line without newline");
+
+    for (size_t num_threads : {1, 4}) {
+      auto values = JSON::parse_lines(lines_data, num_threads);
+      expect_eq(values.size(), expected_values.size());
+      for (size_t z = 0; z < values.size(); z++) {
+        expect_eq(values[z], expected_values[z]);
+      }
+
+      mutex values_lock;
+      vector<pair<size_t, JSON>> unordered_values;
+      JSON::parse_lines_unordered(lines_data, [&](size_t line_num, JSON&& value) {
+        lock_guard g(values_lock);
+        unordered_values.emplace_back(line_num, std::move(value));
+      }, num_threads);
+      expect_eq(unordered_values.size(), expected_values.size());
+      sort(unordered_values.begin(), unordered_values.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+      });
+      // Values on lines with z % 7 == 0 are followed by a blank line
+      size_t expected_line_num = 0;
+      for (size_t z = 0; z < unordered_values.size(); z++) {
+        expect_eq(unordered_values[z].first, expected_line_num);
+        expect_eq(unordered_values[z].second, expected_values[z]);
+        expected_line_num += (z % 7) ? 1 : 2;
+      }
+    }
+
+    expect_eq(JSON::parse_lines("").size(), 0);
+    expect_eq(JSON::parse_lines("\n \n\t\n").size(), 0);
+    expect_eq(JSON::parse_lines("1\n[2]\n{\"3\": 3}"), vector<JSON>({1, JSON::list({2}), JSON::dict({{"3", 3}})}));
+
+    string malformed_data = lines_data;
+    malformed_data.insert(malformed_data.find("\"item 15000\""), "{");
+    for (size_t num_threads : {1, 4}) {
+      try {
+        JSON::parse_lines(malformed_data, num_threads);
+        expect(false);
+      } catch (const JSON::parse_error& e) {
+        string what = e.what();
+        expect(what.ends_with("; line=17144"));
+      }
+    }
+    expect_raises(runtime_error, [&]() {
+      JSON::parse_lines_unordered(lines_data, [&](size_t line_num, JSON&&) {
+        if (line_num == 10000) {
+          throw runtime_error("callback failed");
+        }
+      }, 4);
+    });
+  }
+
+  {
+    fwrite_fmt(stderr, "-- event reader\n");
+    using Event = JSONEventReader::Event;
+    {
+      string data = "{\"a\": [1, \"two\", {}], // comment\n \"b\": n, \"c\": [],} 7";
+      StringReader r(data);
+      JSONEventReader er(r);
+      expect_eq(er.next(), Event::START_DICT);
+      expect_eq(er.depth(), 1);
+      expect_eq(er.next(), Event::KEY);
+      expect_eq(er.key(), "a");
+      expect_eq(er.next(), Event::START_LIST);
+      expect_eq(er.depth(), 2);
+      expect_eq(er.next(), Event::VALUE);
+      expect_eq(er.value(), 1);
+      expect_eq(er.next(), Event::VALUE);
+      expect_eq(er.value(), "two");
+      expect_eq(er.next(), Event::START_DICT);
+      expect_eq(er.next(), Event::END_DICT);
+      expect_eq(er.next(), Event::END_LIST);
+      expect_eq(er.next(), Event::KEY);
+      expect_eq(er.key(), "b");
+      expect_eq(er.next(), Event::VALUE);
+      expect_eq(er.value(), nullptr);
+      expect_eq(er.next(), Event::KEY);
+      expect_eq(er.key(), "c");
+      expect_eq(er.next(), Event::START_LIST);
+      expect_eq(er.next(), Event::END_LIST);
+      expect_eq(er.next(), Event::END_DICT);
+      expect_eq(er.depth(), 0);
+      expect_eq(er.next(), Event::END);
+      expect_eq(er.next(), Event::END);
+      // The reader should stop right after the value
+      expect_eq(JSON::parse(r), 7);
+    }
+
+    // Rebuilding a value from its events should produce the same value
+    auto rebuild = [&](const string& data, bool disable_extensions) -> JSON {
+      StringReader r(data);
+      JSONEventReader er(r, disable_extensions);
+      vector<JSON> containers;
+      vector<string> keys;
+      JSON ret;
+      auto add_value = [&](JSON&& v) -> void {
+        if (containers.empty()) {
+          ret = std::move(v);
+        } else if (containers.back().is_list()) {
+          containers.back().emplace_back(std::move(v));
+        } else {
+          containers.back().emplace(std::move(keys.back()), std::move(v));
+          keys.pop_back();
+        }
+      };
+      for (Event ev = er.next(); ev != Event::END; ev = er.next()) {
+        if (ev == Event::START_LIST) {
+          containers.emplace_back(JSON::list());
+        } else if (ev == Event::START_DICT) {
+          containers.emplace_back(JSON::dict());
+        } else if ((ev == Event::END_LIST) || (ev == Event::END_DICT)) {
+          JSON v = std::move(containers.back());
+          containers.pop_back();
+          add_value(std::move(v));
+        } else if (ev == Event::KEY) {
+          keys.emplace_back(std::move(er.key()));
+        } else {
+          add_value(std::move(er.value()));
+        }
+      }
+      return ret;
+    };
+    expect_eq(rebuild(root.serialize(), true), root);
+    expect_eq(rebuild(root.serialize(JSON::SerializeOption::FORMAT), false), root);
+    expect_eq(rebuild(root.serialize(JSON::SerializeOption::HEX_INTEGERS | JSON::SerializeOption::ONE_CHARACTER_TRIVIAL_CONSTANTS), false), root);
+    expect_eq(rebuild("[]", true), JSON::list());
+    expect_eq(rebuild("{}", true), JSON::dict());
+
+    expect_raises(JSON::parse_error, [&]() {
+      rebuild("[1, 2,]", true);
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      rebuild("[1 2]", false);
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      rebuild("{\"a\" 2}", false);
+    });
+    expect_raises(JSON::type_error, [&]() {
+      rebuild("{2: 2}", false);
+    });
+    expect_raises(out_of_range, [&]() {
+      rebuild("[1, [2, 3]", false);
+    });
+  }
+
+  {
+    fwrite_fmt(stderr, "-- push parser\n");
+    // Every way of splitting the input into two pieces, and one byte at a time
+    auto parse_pieces = [&](const string& data, size_t piece_size, size_t first_piece_size, bool disable_extensions) -> vector<JSON> {
+      JSONPushParser p(disable_extensions);
+      vector<JSON> ret;
+      for (size_t offset = 0; offset < data.size();) {
+        size_t size = min<size_t>(offset ? piece_size : first_piece_size, data.size() - offset);
+        p.feed(data.data() + offset, size);
+        offset += size;
+        while (p.has_value()) {
+          ret.emplace_back(p.get_value());
+        }
+      }
+      p.finish();
+      while (p.has_value()) {
+        ret.emplace_back(p.get_value());
+      }
+      expect_eq(p.bytes_consumed(), data.size());
+      return ret;
+    };
+    for (const auto& data : {root.serialize(), root.serialize(JSON::SerializeOption::FORMAT)}) {
+      for (size_t z = 1; z <= data.size(); z++) {
+        auto values = parse_pieces(data, data.size(), z, false);
+        expect_eq(values.size(), 1);
+        expect_eq(values[0], root);
+      }
+      auto values = parse_pieces(data, 1, 1, true);
+      expect_eq(values.size(), 1);
+      expect_eq(values[0], root);
+    }
+
+    string stream = "{\"a\": [1, \"two\\\"\", {}], // comment\n \"b\": n, \"c\": [],}[2]3 \"four\"true\n-5.5e1\t[]";
+    auto values = parse_pieces(stream, 1, 1, false);
+    expect_eq(values.size(), 7);
+    expect_eq(values[0], JSON::dict({{"a", JSON::list({1, "two\"", JSON::dict()})}, {"b", nullptr}, {"c", JSON::list()}}));
+    expect_eq(values[1], JSON::list({2}));
+    expect_eq(values[2], 3);
+    expect_eq(values[3], "four");
+    expect_eq(values[4], true);
+    expect_eq(values[5], -55.0);
+    expect_eq(values[6], JSON::list());
+    expect_eq(parse_pieces(stream, 7, 3, false), values);
+
+    // Numbers aren't complete until the parser sees the end of the input
+    JSONPushParser p;
+    p.feed("12");
+    expect(!p.has_value());
+    expect(p.in_value());
+    p.feed("34 ");
+    expect(p.has_value());
+    expect(!p.in_value());
+    expect_eq(p.get_value(), 1234);
+    p.feed("5");
+    p.finish();
+    expect_eq(p.get_value(), 5);
+    expect_raises(out_of_range, [&]() {
+      p.get_value();
+    });
+
+    p.feed("[1, {\"a\": ");
+    expect(p.in_value());
+    expect_raises(JSON::parse_error, [&]() {
+      p.finish();
+    });
+    p.reset();
+    expect(!p.in_value());
+    expect_eq(p.bytes_consumed(), 0);
+
+    for (const char* data : {"[1 2]", "[1,,2]", "{\"a\" 1}", "{1:2}", "{\"a\":1 \"b\"}", "1x", "nulll", "]", "/x", "[1", "\"abc"}) {
+      expect_raises(JSON::parse_error, [&]() {
+        parse_pieces(data, 1, 1, false);
+      });
+    }
+    for (const char* data : {"[1,]", "{\"a\":1,}", "// comment\n1", "0x1F", "n"}) {
+      expect_eq(parse_pieces(data, 1, 1, false).size(), 1);
+      expect_raises(JSON::parse_error, [&]() {
+        parse_pieces(data, 1, 1, true);
+      });
+    }
+  }
+
+  {
+    fwrite_fmt(stderr, "-- lazy views\n");
+    string serialized = root.serialize(JSON::SerializeOption::FORMAT);
+    JSONView view(serialized);
+    expect(view.is_dict());
+    expect_eq(view.size(), root.size());
+    expect_eq(view.to_json(), root);
+    expect(view.at("null").is_null());
+    expect_eq(view.get_bool("true"), true);
+    expect_eq(view.get_bool("missing", true), true);
+    expect_eq(view.get_int("int2"), -3214);
+    expect(view.at("int2").is_int());
+    expect_eq(view.get_float("float2"), -10.5);
+    expect(view.at("float2").is_float());
+    expect_eq(view.get_float("int1"), 134.0);
+    expect_eq(view.get_string("string3"), "omg \"\'\\\t\n");
+    expect_eq(view.at("string2").as_string_view(), "no special chars");
+    expect_eq(view.get_string("missing", "def"), "def");
+    expect_eq(view.at("list1").at(0).as_int(), 1);
+    expect(view.at("list0").empty());
+    expect_eq(view.at("dict1").to_json(), JSON::dict({{"one", 1}}));
+    expect(view.contains("dict0"));
+    expect(!view.contains("dict2"));
+    expect_eq(view.find("int1")->as_int(), 134);
+    expect(!view.find("missing").has_value());
+    expect_eq(view.at("list1").find(0)->as_int(), 1);
+    expect(!view.at("list1").find(1).has_value());
+    expect_eq(view.dict_items().size(), root.size());
+    expect_raises(JSON::type_error, [&]() {
+      view.at("string3").as_string_view();
+    });
+    expect_raises(JSON::type_error, [&]() {
+      view.at("string3").as_int();
+    });
+    expect_raises(JSON::type_error, [&]() {
+      view.at(0);
+    });
+    expect_raises(out_of_range, [&]() {
+      view.at("missing");
+    });
+    expect_raises(out_of_range, [&]() {
+      view.at("list1").at(1);
+    });
+
+    string list_data = "[1, [2, [3]], {\"a\\u0062\": 4, \"ab\": 5}, \"x\", // comment\n n,]";
+    JSONView list_view(list_data);
+    expect_eq(list_view.size(), 5);
+    expect_eq(list_view.at(1).at(1).at(0).as_int(), 3);
+    expect_eq(list_view.at(2).get_int("ab"), 4);
+    expect_eq(list_view.at(3).as_string_view(), "x");
+    expect(list_view.at(4).is_null());
+    auto items = list_view.list_items();
+    expect_eq(items.size(), 5);
+    expect_eq(items[1].to_json(), JSON::list({2, JSON::list({3})}));
+    expect_eq(list_view.to_json(), JSON::parse("[1, [2, [3]], {\"ab\": 4}, \"x\", null]"));
+
+    // Malformed structure is detected up front, but malformed scalars are only
+    // detected when they're accessed
+    for (const char* malformed : {"", "[", "[1 2]", "[1,,2]", "{\"a\" 1}", "{1: 2}", "[]]", "{]", "[1,]"}) {
+      expect_raises(JSON::parse_error, [&]() {
+        JSONView(malformed, strlen(malformed), true);
+      });
+    }
+    string bad_scalars_data = "[1x, \"\\q\", 3]";
+    JSONView bad_scalars(bad_scalars_data);
+    expect_eq(bad_scalars.at(2).as_int(), 3);
+    expect_raises(JSON::parse_error, [&]() {
+      bad_scalars.at(0).as_int();
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      bad_scalars.at(1).as_string();
+    });
+  }
+
+  {
+    fwrite_fmt(stderr, "-- paths\n");
+    string path_data = "{\"store\": {\"books\": [{\"title\": \"A\", \"type\": \"novel\", \"price\": 8},"
+                       " {\"title\": \"B\", \"type\": \"reference\", \"price\": 20},"
+                       " {\"title\": \"C\", \"type\": \"novel\"}]},"
+                       " \"a/b\": 1, \"m~n\": 2, \"\": 3, \"01\": 4, \"*\": 5}";
+    JSON path_json = JSON::parse(path_data);
+    JSONView path_view(path_data);
+
+    // Examples from RFC 6901, plus some edge cases
+    for (const auto& [path_str, expected] : vector<pair<const char*, JSON>>{
+             {"", path_json},
+             {"/store/books/1/title", "B"},
+             {"/store/books/0/price", 8},
+             {"/a~1b", 1},
+             {"/m~0n", 2},
+             {"/", 3},
+             {"/01", 4},
+             {"/*", 5},
+         }) {
+      JSONPath path(path_str);
+      expect_eq(path.str(), path_str);
+      expect(!path.has_selectors());
+      expect_eq(path.at(path_json), expected);
+      expect_eq(path.at(path_view).to_json(), expected);
+    }
+    for (const char* path_str : {"/missing", "/store/books/3", "/store/books/01", "/store/books/-",
+             "/store/books/x", "/store/books/0/title/x", "/a~1b/0"}) {
+      JSONPath path(path_str);
+      expect_eq(path.find(path_json), nullptr);
+      expect(!path.find(path_view).has_value());
+      expect(path.find_all(path_json).empty());
+      expect_raises(out_of_range, [&]() {
+        path.at(path_json);
+      });
+    }
+    for (const char* path_str : {"missing_slash", "/a~2", "/a~"}) {
+      expect_raises(invalid_argument, [&]() {
+        JSONPath path(path_str);
+      });
+    }
+
+    // find returns a reference into the value, which can be modified
+    JSON modified_json = path_json;
+    JSONPath price_path("/store/books/1/price");
+    *price_path.find(modified_json) = 25;
+    expect_eq(modified_json.at("store").at("books").at(1).at("price"), 25);
+    expect_eq(price_path.find(static_cast<const JSON&>(modified_json)), &modified_json.at("store").at("books").at(1).at("price"));
+
+    // Selectors
+    auto titles = [&](const char* path_str) -> vector<string> {
+      JSONPath path(path_str, true);
+      vector<string> ret;
+      for (const JSON* v : path.find_all(path_json)) {
+        ret.emplace_back(v->as_string());
+      }
+      vector<string> view_ret;
+      for (const auto& v : path.find_all(path_view)) {
+        view_ret.emplace_back(v.as_string());
+      }
+      expect_eq(ret, view_ret);
+      return ret;
+    };
+    expect_eq(titles("/store/books/*/title"), vector<string>({"A", "B", "C"}));
+    expect_eq(titles("/store/books/?price/title"), vector<string>({"A", "B"}));
+    expect_eq(titles("/store/books/?type=\"novel\"/title"), vector<string>({"A", "C"}));
+    expect_eq(titles("/store/books/?price=20/title"), vector<string>({"B"}));
+    expect_eq(titles("/store/books/?price=21/title"), vector<string>());
+    expect_eq(titles("/*/books/2/title"), vector<string>({"C"}));
+    expect_eq(JSONPath("/*", true).find_all(path_json).size(), 6);
+    expect_eq(*JSONPath("/*").find(path_json), 5);
+    expect(JSONPath("/*", true).has_selectors());
+    expect_raises(logic_error, [&]() {
+      JSONPath("/store/*", true).find(path_json);
+    });
+  }
+
+  {
+    fwrite_fmt(stderr, "-- diff and patch\n");
+    expect_eq(root.diff(root), JSON::list());
+    expect_eq(JSON(1).diff(1.0), JSON::list());
+    expect_eq(JSON(1).diff("x"), JSON::list({JSON::dict({{"op", "replace"}, {"path", ""}, {"value", "x"}})}));
+
+    // Inserting or removing items in the middle of a list only generates
+    // operations for those items
+    JSON from_list = JSON::list({1, 2, 3, 4, 5});
+    expect_eq(from_list.diff(JSON::list({1, 2, 7, 8, 3, 4, 5})), JSON::list({
+        JSON::dict({{"op", "add"}, {"path", "/2"}, {"value", 7}}),
+        JSON::dict({{"op", "add"}, {"path", "/3"}, {"value", 8}}),
+    }));
+    expect_eq(from_list.diff(JSON::list({1, 5})), JSON::list({
+        JSON::dict({{"op", "remove"}, {"path", "/3"}}),
+        JSON::dict({{"op", "remove"}, {"path", "/2"}}),
+        JSON::dict({{"op", "remove"}, {"path", "/1"}}),
+    }));
+    expect_eq(from_list.diff(JSON::list({1, 2, 9, 4, 5})), JSON::list({
+        JSON::dict({{"op", "replace"}, {"path", "/2"}, {"value", 9}}),
+    }));
+    expect_eq(JSON::dict({{"a/b~", 1}}).diff(JSON::dict()), JSON::list({
+        JSON::dict({{"op", "remove"}, {"path", "/a~1b~0"}}),
+    }));
+
+    JSON modified = root;
+    modified.erase("list1");
+    modified.emplace("new/key", JSON::list({JSON::dict({{"x", 1}})}));
+    modified.at("dict1").emplace("two", 2);
+    modified.at("dict1").at("one") = "one";
+    modified.at("list0").emplace_back(JSON::list());
+    JSON patch = root.diff(modified);
+    expect_eq(patch.size(), 5);
+    JSON patched = root;
+    patched.apply_patch(patch);
+    expect_eq(patched, modified);
+    patched = root;
+    patched.apply_patch(std::move(patch));
+    expect_eq(patched, modified);
+    expect_eq(modified.diff(root).size(), 5);
+    patched.apply_patch(modified.diff(root));
+    expect_eq(patched, root);
+
+    // Operations that diff doesn't generate
+    JSON v = JSON::parse("{\"a\": [1, 2], \"b\": {\"c\": 3}}");
+    v.apply_patch(JSON::parse("["
+                              "{\"op\": \"test\", \"path\": \"/b/c\", \"value\": 3.0},"
+                              "{\"op\": \"add\", \"path\": \"/a/-\", \"value\": 3},"
+                              "{\"op\": \"move\", \"from\": \"/b/c\", \"path\": \"/a/0\"},"
+                              "{\"op\": \"copy\", \"from\": \"/a\", \"path\": \"/b/d\"},"
+                              "{\"op\": \"add\", \"path\": \"/b/d/1\", \"value\": null}"
+                              "]"));
+    expect_eq(v, JSON::parse("{\"a\": [3, 1, 2, 3], \"b\": {\"d\": [3, null, 1, 2, 3]}}"));
+    v.apply_patch(JSON::parse("[{\"op\": \"replace\", \"path\": \"\", \"value\": 7}]"));
+    expect_eq(v, 7);
+
+    v = JSON::parse("{\"a\": [1, 2], \"b\": {\"c\": 3}}");
+    expect_raises(runtime_error, [&]() {
+      v.apply_patch(JSON::parse("[{\"op\": \"test\", \"path\": \"/b/c\", \"value\": 4}]"));
+    });
+    expect_raises(out_of_range, [&]() {
+      v.apply_patch(JSON::parse("[{\"op\": \"remove\", \"path\": \"/b/d\"}]"));
+    });
+    expect_raises(out_of_range, [&]() {
+      v.apply_patch(JSON::parse("[{\"op\": \"add\", \"path\": \"/a/3\", \"value\": 0}]"));
+    });
+    expect_raises(out_of_range, [&]() {
+      v.apply_patch(JSON::parse("[{\"op\": \"replace\", \"path\": \"/x/y\", \"value\": 0}]"));
+    });
+    expect_raises(invalid_argument, [&]() {
+      v.apply_patch(JSON::parse("[{\"op\": \"move\", \"from\": \"/b\", \"path\": \"/b/e\"}]"));
+    });
+    expect_raises(invalid_argument, [&]() {
+      v.apply_patch(JSON::parse("[{\"op\": \"frobnicate\", \"path\": \"/b\"}]"));
+    });
+    expect_raises(invalid_argument, [&]() {
+      v.apply_patch(JSON::parse("[{\"op\": \"add\", \"path\": \"/b/e\"}]"));
+    });
+    expect_eq(v, JSON::parse("{\"a\": [1, 2], \"b\": {\"c\": 3}}"));
+  }
+
+  {
+    fwrite_fmt(stderr, "-- arena documents\n");
+    string serialized = root.serialize();
+    JSON copied_value;
+    {
+      JSONDocument doc(serialized);
+      expect_eq(doc.root(), root);
+      expect_gt(doc.arena().bytes_allocated(), 0);
+      expect_eq(JSONArena::active(), nullptr);
+
+      // Objects created outside the arena can be mixed into the document
+      doc.root().emplace("mixed_item", JSON::list({1, 2, 3}));
+      doc.root().erase("dict1");
+      expect_eq(doc.root().at("mixed_item"), JSON::list({1, 2, 3}));
+      copied_value = doc.root().at("list1");
+
+      JSONDocument moved_doc = std::move(doc);
+      expect_eq(moved_doc.root().at("string3"), "omg \"\'\\\t\n");
+      moved_doc = JSONDocument("[1, 2, {\"three\": 3}]");
+      expect_eq(moved_doc.root(), JSON::list({1, 2, JSON::dict({{"three", 3}})}));
+    }
+    expect_eq(copied_value, JSON::list({1}));
+
+    JSONArena arena(0x100);
+    {
+      JSONArena::Scope scope(arena);
+      expect_eq(JSONArena::active(), &arena);
+      JSON l = JSON::list();
+      for (size_t z = 0; z < 100; z++) {
+        l.emplace_back(z);
+      }
+      expect_eq(l.size(), 100);
+      expect_eq(l.at(99), 99);
+    }
+    expect_eq(JSONArena::active(), nullptr);
+    expect_gt(arena.block_count(), 1);
+  }
+
+  {
+    fwrite_fmt(stderr, "-- documents with retained sources\n");
+    auto source = make_shared<const string>(root.serialize());
+    JSON copied_value;
+    {
+      JSONDocument doc(source);
+      expect_eq(doc.source(), source);
+      expect_eq(doc.root(), root);
+      expect_eq(JSON::parse(doc.root().serialize()), root);
+      expect_eq(JSON::parse_binary(doc.root().serialize_binary(true)), root);
+
+      // Unescaped strings refer to the source; escaped strings are copied
+      const JSON& const_root = doc.root();
+      string_view borrowed = const_root.get_string_view("string2");
+      expect_eq(borrowed, "no special chars");
+      expect_ge(borrowed.data(), source->data());
+      expect_le(borrowed.data() + borrowed.size(), source->data() + source->size());
+      expect_eq(const_root.get_string("string3"), "omg \"\'\\\t\n");
+      // The const as_string copies a borrowed string the first time it's
+      // called, and returns the same copy after that
+      const string& borrowed_as_string = const_root.at("string2").as_string();
+      expect_eq(borrowed_as_string, "no special chars");
+      expect_eq(&const_root.at("string2").as_string(), &borrowed_as_string);
+      expect_eq(&const_root.get_string("string2"), &borrowed_as_string);
+      expect_eq(const_root.get_string_view("string2").data(), borrowed.data());
+      expect_eq(const_root.at("string2"), "no special chars");
+      expect_eq(const_root.at("string2"), string("no special chars"));
+      expect_eq(const_root.at("string2"), JSON("no special chars"));
+      expect_lt(const_root.at("string2"), JSON("no special chars!"));
+      expect_raises(JSON::type_error, [&]() {
+        const_root.at("int0").as_string_view();
+      });
+
+      expect_eq(const_root.get_string("string2", "def"), "no special chars");
+      expect_eq(const_root.get_string("string1"), "v");
+
+      // The non-const accessor converts the value to an owned string
+      doc.root().at("string2").as_string() += "!";
+      expect_eq(const_root.get_string("string2"), "no special chars!");
+
+      copied_value = const_root.at("list1");
+      copied_value.emplace_back(JSON(const_root.at("string1")));
+    }
+
+    const JSONDocument enum_doc(make_shared<const string>("{\"name\": \"abc\", \"enums\": [\"ONE\", \"THREE\"]}"));
+    expect_eq(enum_doc.root().get_string("name"), "abc");
+    expect_eq(enum_doc.root().at("enums").get_enum<JSONTestEnum>(1), JSONTestEnum::THREE);
+    expect_eq(enum_doc.root().at("enums").get_enum(0, JSONTestEnum::TWO), JSONTestEnum::ONE);
+    expect_eq(enum_doc.root().get_enum("missing", JSONTestEnum::TWO), JSONTestEnum::TWO);
+    source.reset();
+    expect_eq(copied_value, JSON::list({1, "v"}));
+    expect_eq(copied_value.at(1).as_string(), "v");
+  }
+
+  {
+    fwrite_fmt(stderr, "-- typed structs\n");
+    string text = "{\"name\": \"first\\trecord\", \"id\": 3, \"level\": 7, \"active\": true, \"pos\": {\"y\": -2.5, \"x\": 1},\n"
+                  "  // extensions work too\n"
+                  "  \"unknown\": [1, {\"a\": \"\\\"]}\"}, [], null], \"tags\": [\"a\", \"b\",], \"paths\": {\"p\": [{\"x\": 0, \"y\": 1}]},\n"
+                  "  \"extra\": {\"any\": [\"value\"]}, \"par\\u0065nt_id\": 9}";
+    auto record = parse_json_struct<JSONTestRecord>(text);
+    expect_eq(record.id, 3);
+    expect_eq(record.level, 7);
+    expect_eq(record.name, "first\trecord");
+    expect(record.active);
+    expect(record.position == (JSONTestPosition{1.0, -2.5}));
+    expect_eq(record.tags, (vector<string>{"a", "b"}));
+    expect_eq(record.parent_id, 9);
+    expect_eq(record.paths.size(), 1);
+    expect(record.paths.at("p") == (vector<JSONTestPosition>{{0.0, 1.0}}));
+    expect_eq(record.extra, JSON::dict({{"any", JSON::list({"value"})}}));
+
+    // The struct produces the same JSON as the equivalent JSON object, and
+    // parses back to the same struct
+    JSON expected = JSON::dict({
+        {"id", 3},
+        {"level", 7},
+        {"name", "first\trecord"},
+        {"active", true},
+        {"pos", JSON::dict({{"x", 1.0}, {"y", -2.5}})},
+        {"tags", JSON::list({"a", "b"})},
+        {"parent_id", 9},
+        {"paths", JSON::dict({{"p", JSON::list({JSON::dict({{"x", 0.0}, {"y", 1.0}})})}})},
+        {"extra", JSON::dict({{"any", JSON::list({"value"})}})},
+    });
+    string serialized = serialize_json_struct(record);
+    expect_eq(JSON::parse(serialized), expected);
+    expect(parse_json_struct<JSONTestRecord>(serialized) == record);
+    expect_eq(serialize_json_struct(record.position), "{\"x\":1.0,\"y\":-2.5}");
+    expect_eq(serialize_json_struct(record.tags, JSON::SerializeOption::ONE_CHARACTER_TRIVIAL_CONSTANTS), "[\"a\",\"b\"]");
+    expect_eq(serialize_json_struct(vector<optional<int64_t>>{16, nullopt}, JSON::SerializeOption::HEX_INTEGERS | JSON::SerializeOption::ONE_CHARACTER_TRIVIAL_CONSTANTS), "[0x10,n]");
+
+    // Missing or null optional fields are reset, and omitted when serialized
+    record.parent_id.reset();
+    serialized = serialize_json_struct(record);
+    expect(!JSON::parse(serialized).contains("parent_id"));
+    record.parent_id = 4;
+    parse_json_struct(record, serialized.data(), serialized.size());
+    expect(!record.parent_id.has_value());
+    record.parent_id = 4;
+    string null_parent_text = serialized.substr(0, serialized.size() - 1) + ",\"parent_id\":null}";
+    parse_json_struct(record, null_parent_text.data(), null_parent_text.size());
+    expect(!record.parent_id.has_value());
+
+    // Top-level lists and maps work too
+    auto positions = parse_json_struct<vector<JSONTestPosition>>("[{\"x\": 1, \"y\": 2}, {\"x\": 3.5, \"y\": 4}]");
+    expect(positions == (vector<JSONTestPosition>{{1.0, 2.0}, {3.5, 4.0}}));
+    expect_eq(serialize_json_struct(positions), "[{\"x\":1.0,\"y\":2.0},{\"x\":3.5,\"y\":4.0}]");
+    auto counts = parse_json_struct<unordered_map<string, int64_t>>("{\"a\": 1, \"b\": -2}");
+    expect_eq(counts.size(), 2);
+    expect_eq(counts.at("b"), -2);
+    expect(parse_json_struct<vector<int64_t>>("[]").empty());
+    auto flags = parse_json_struct<vector<bool>>("[true, false, true]");
+    expect_eq(flags, (vector<bool>{true, false, true}));
+    expect_eq(serialize_json_struct(flags), "[true,false,true]");
+    auto optional_flags = parse_json_struct<optional<vector<bool>>>("[false]");
+    expect(optional_flags == (vector<bool>{false}));
+
+    // Missing required fields, wrong types, out-of-range integers, and
+    // malformed JSON are all parse errors
+    expect_raises(JSON::parse_error, [&]() {
+      parse_json_struct<JSONTestPosition>("{\"x\": 1}");
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      parse_json_struct<JSONTestPosition>("{\"x\": 1, \"y\": \"2\"}");
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      parse_json_struct<JSONTestPosition>("[1, 2]");
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      parse_json_struct<vector<int64_t>>("[1, 2.5]");
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      parse_json_struct<vector<uint8_t>>("[1, 256]");
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      parse_json_struct<vector<int64_t>>("[1 2]");
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      parse_json_struct<vector<int64_t>>(string("[1, 2,]"), true);
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      parse_json_struct<vector<int64_t>>("[1, 2] 3");
+    });
+    expect_raises(JSON::parse_error, [&]() {
+      parse_json_struct<JSONTestPosition>("{\"x\": 1, \"y\" 2}");
+    });
+
+    // Truncated input throws out_of_range, as it does for JSON::parse
+    expect_raises(out_of_range, [&]() {
+      parse_json_struct<JSONTestPosition>("{\"x\": 1");
+    });
+    expect_raises(out_of_range, [&]() {
+      parse_json_struct<JSONTestRecord>("{\"unknown\": [\"abc");
+    });
+  }
 
   fwrite_fmt(stderr, "JSONTest: all tests passed\n");
   return 0;
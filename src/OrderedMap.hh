@@ -0,0 +1,256 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <bit>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace phosg {
+
+// A map that keeps its items in insertion order in a single contiguous vector.
+// Small maps (up to INDEX_THRESHOLD items) are searched linearly, which is
+// faster than hashing for short keys and doesn't require any additional
+// allocations. Larger maps also maintain an open-addressing hash index over
+// the vector, so lookups remain constant-time.
+//
+// The interface is a subset of std::unordered_map's, with a few differences:
+// - Iteration order is insertion order.
+// - Iterators and references are invalidated by any insertion or erasure
+//   (like std::vector's).
+// - Erasing an item is linear in the map's size, since the following items
+//   have to be moved to preserve order.
+// - value_type is std::pair<KeyT, ValueT> rather than
+//   std::pair<const KeyT, ValueT>, since items must be movable. Callers must
+//   not modify keys via iterators.
+// - If HashT has an is_transparent member type, lookup functions accept any
+//   type that HashT can hash and that can be compared to KeyT with ==, so
+//   looking up a key doesn't require constructing a KeyT.
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>>
+class OrderedMap {
+public:
+  using key_type = KeyT;
+  using mapped_type = ValueT;
+  using value_type = std::pair<KeyT, ValueT>;
+  using size_type = size_t;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  static constexpr size_t INDEX_THRESHOLD = 16;
+  static constexpr bool HAS_TRANSPARENT_HASH = requires { typename HashT::is_transparent; };
+
+  OrderedMap() = default;
+  OrderedMap(const OrderedMap&) = default;
+  OrderedMap(OrderedMap&&) = default;
+  OrderedMap& operator=(const OrderedMap&) = default;
+  OrderedMap& operator=(OrderedMap&&) = default;
+  ~OrderedMap() = default;
+
+  inline iterator begin() {
+    return this->items.begin();
+  }
+  inline iterator end() {
+    return this->items.end();
+  }
+  inline const_iterator begin() const {
+    return this->items.begin();
+  }
+  inline const_iterator end() const {
+    return this->items.end();
+  }
+  inline const_iterator cbegin() const {
+    return this->items.cbegin();
+  }
+  inline const_iterator cend() const {
+    return this->items.cend();
+  }
+
+  inline size_t size() const {
+    return this->items.size();
+  }
+  inline bool empty() const {
+    return this->items.empty();
+  }
+  inline void reserve(size_t count) {
+    this->items.reserve(count);
+  }
+  void clear() {
+    this->items.clear();
+    this->slots.clear();
+  }
+  void swap(OrderedMap& other) {
+    this->items.swap(other.items);
+    this->slots.swap(other.slots);
+  }
+
+  iterator find(const KeyT& key) {
+    return this->items.begin() + this->find_item_index(key);
+  }
+  const_iterator find(const KeyT& key) const {
+    return this->items.begin() + this->find_item_index(key);
+  }
+  template <typename LookupKeyT>
+    requires HAS_TRANSPARENT_HASH
+  iterator find(const LookupKeyT& key) {
+    return this->items.begin() + this->find_item_index(key);
+  }
+  template <typename LookupKeyT>
+    requires HAS_TRANSPARENT_HASH
+  const_iterator find(const LookupKeyT& key) const {
+    return this->items.begin() + this->find_item_index(key);
+  }
+
+  inline size_t count(const KeyT& key) const {
+    return this->contains(key) ? 1 : 0;
+  }
+  template <typename LookupKeyT>
+    requires HAS_TRANSPARENT_HASH
+  inline size_t count(const LookupKeyT& key) const {
+    return this->contains(key) ? 1 : 0;
+  }
+  inline bool contains(const KeyT& key) const {
+    return this->find_item_index(key) != this->items.size();
+  }
+  template <typename LookupKeyT>
+    requires HAS_TRANSPARENT_HASH
+  inline bool contains(const LookupKeyT& key) const {
+    return this->find_item_index(key) != this->items.size();
+  }
+
+  ValueT& at(const KeyT& key) {
+    return this->items[this->find_existing_item_index(key)].second;
+  }
+  const ValueT& at(const KeyT& key) const {
+    return this->items[this->find_existing_item_index(key)].second;
+  }
+  template <typename LookupKeyT>
+    requires HAS_TRANSPARENT_HASH
+  ValueT& at(const LookupKeyT& key) {
+    return this->items[this->find_existing_item_index(key)].second;
+  }
+  template <typename LookupKeyT>
+    requires HAS_TRANSPARENT_HASH
+  const ValueT& at(const LookupKeyT& key) const {
+    return this->items[this->find_existing_item_index(key)].second;
+  }
+  ValueT& operator[](const KeyT& key) {
+    return this->emplace(key).first->second;
+  }
+
+  // Like std::unordered_map::emplace, this constructs the key and value before
+  // checking if the key already exists, and if it does, the map is not
+  // modified and the constructed value is destroyed.
+  template <typename KeyArgT, typename... ValueArgTs>
+  std::pair<iterator, bool> emplace(KeyArgT&& key_arg, ValueArgTs&&... value_args) {
+    KeyT key(std::forward<KeyArgT>(key_arg));
+    ValueT value(std::forward<ValueArgTs>(value_args)...);
+    size_t index = this->find_item_index(key);
+    if (index != this->items.size()) {
+      return std::make_pair(this->items.begin() + index, false);
+    }
+    this->items.emplace_back(std::move(key), std::move(value));
+    this->on_item_added();
+    return std::make_pair(this->items.end() - 1, true);
+  }
+
+  size_t erase(const KeyT& key) {
+    return this->erase_key(key);
+  }
+  template <typename LookupKeyT>
+    requires(HAS_TRANSPARENT_HASH && !std::is_convertible_v<const LookupKeyT&, const_iterator>)
+  size_t erase(const LookupKeyT& key) {
+    return this->erase_key(key);
+  }
+  iterator erase(const_iterator it) {
+    size_t index = it - this->items.cbegin();
+    this->items.erase(it);
+    this->rebuild_index();
+    return this->items.begin() + index;
+  }
+
+private:
+  static constexpr uint32_t EMPTY_SLOT = 0xFFFFFFFF;
+
+  std::vector<value_type> items;
+  // Indexes into items, or EMPTY_SLOT. This is empty if there are
+  // INDEX_THRESHOLD or fewer items; otherwise, it's a power of 2 in size and
+  // no more than half full.
+  std::vector<uint32_t> slots;
+
+  // Returns items.size() if the key isn't present
+  template <typename LookupKeyT>
+  size_t find_item_index(const LookupKeyT& key) const {
+    if (this->slots.empty()) {
+      size_t index = 0;
+      for (; index < this->items.size(); index++) {
+        if (this->items[index].first == key) {
+          break;
+        }
+      }
+      return index;
+    }
+
+    size_t mask = this->slots.size() - 1;
+    for (size_t z = HashT()(key) & mask; this->slots[z] != EMPTY_SLOT; z = (z + 1) & mask) {
+      if (this->items[this->slots[z]].first == key) {
+        return this->slots[z];
+      }
+    }
+    return this->items.size();
+  }
+
+  template <typename LookupKeyT>
+  size_t find_existing_item_index(const LookupKeyT& key) const {
+    size_t index = this->find_item_index(key);
+    if (index == this->items.size()) {
+      throw std::out_of_range("key not present in map");
+    }
+    return index;
+  }
+
+  template <typename LookupKeyT>
+  size_t erase_key(const LookupKeyT& key) {
+    size_t index = this->find_item_index(key);
+    if (index == this->items.size()) {
+      return 0;
+    }
+    this->erase(this->items.begin() + index);
+    return 1;
+  }
+
+  void add_to_index(size_t index) {
+    size_t mask = this->slots.size() - 1;
+    size_t z = HashT()(this->items[index].first) & mask;
+    while (this->slots[z] != EMPTY_SLOT) {
+      z = (z + 1) & mask;
+    }
+    this->slots[z] = index;
+  }
+
+  void rebuild_index() {
+    if (this->items.size() <= INDEX_THRESHOLD) {
+      this->slots.clear();
+      return;
+    }
+    this->slots.assign(std::bit_ceil(this->items.size() * 2), EMPTY_SLOT);
+    for (size_t z = 0; z < this->items.size(); z++) {
+      this->add_to_index(z);
+    }
+  }
+
+  void on_item_added() {
+    if (this->items.size() <= INDEX_THRESHOLD) {
+      return;
+    }
+    if (this->items.size() * 2 > this->slots.size()) {
+      this->rebuild_index();
+    } else {
+      this->add_to_index(this->items.size() - 1);
+    }
+  }
+};
+
+} // namespace phosg
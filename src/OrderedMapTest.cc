@@ -0,0 +1,135 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "OrderedMap.hh"
+#include "SharedString.hh"
+#include "UnitTest.hh"
+
+using namespace std;
+using namespace phosg;
+
+// Forces every key into the same bucket, so lookups on indexed maps have to
+// probe past other items
+struct CollidingHash {
+  size_t operator()(const string&) const {
+    return 7;
+  }
+};
+
+template <typename HashT>
+void run_tests(const char* name) {
+  fwrite_fmt(stderr, "-- {}\n", name);
+
+  OrderedMap<string, int, HashT> m;
+  expect_eq(m.size(), 0);
+  expect(m.empty());
+  expect_raises(out_of_range, [&]() {
+    m.at("missing");
+  });
+  expect(m.find("missing") == m.end());
+
+  // Insert enough items to cross the index threshold, checking lookups in
+  // both the unindexed and indexed states
+  unordered_map<string, int> expected;
+  for (int z = 0; z < 100; z++) {
+    string key = std::format("key{}", (z * 37) % 100);
+    auto [it, inserted] = m.emplace(key, z);
+    expect(inserted);
+    expect_eq(it->first, key);
+    expect_eq(it->second, z);
+    expected.emplace(key, z);
+    for (const auto& [k, v] : expected) {
+      expect_eq(m.at(k), v);
+    }
+    expect(!m.contains("missing"));
+  }
+  expect_eq(m.size(), 100);
+
+  // Emplacing an existing key doesn't overwrite it
+  auto [it, inserted] = m.emplace("key0", 1000);
+  expect(!inserted);
+  expect_eq(it->second, 0);
+
+  // Iteration is in insertion order
+  int expected_value = 0;
+  for (const auto& [k, v] : m) {
+    expect_eq(v, expected_value++);
+  }
+
+  // Erasing items preserves the order of the remaining items and removes them
+  // from the index
+  for (int z = 0; z < 100; z += 2) {
+    expect_eq(m.erase(std::format("key{}", (z * 37) % 100)), 1);
+  }
+  expect_eq(m.erase("key0"), 0);
+  expect_eq(m.size(), 50);
+  expected_value = 1;
+  for (const auto& [k, v] : m) {
+    expect_eq(v, expected_value);
+    expect_eq(m.at(k), expected_value);
+    expected_value += 2;
+  }
+  while (m.size() > 5) {
+    m.erase(m.begin());
+  }
+  expect_eq(m.begin()->second, 91);
+  expect_eq(m.at("key67"), 91);
+  expect(!m.contains("key30"));
+
+  m["key67"] = 5;
+  m["new_key"] = 6;
+  expect_eq(m.at("key67"), 5);
+  expect_eq(m.at("new_key"), 6);
+  expect_eq(m.size(), 6);
+
+  OrderedMap<string, int, HashT> copied = m;
+  m.clear();
+  expect(m.empty());
+  expect_eq(copied.size(), 6);
+  expect_eq(copied.at("new_key"), 6);
+
+  // Move-only values work, and values constructed for existing keys are
+  // destroyed
+  OrderedMap<string, unique_ptr<int>, HashT> pm;
+  for (int z = 0; z < 20; z++) {
+    pm.emplace(std::format("{}", z), new int(z));
+  }
+  expect(!pm.emplace("5", new int(7)).second);
+  expect_eq(*pm.at("5"), 5);
+}
+
+void run_heterogeneous_lookup_tests() {
+  fwrite_fmt(stderr, "-- heterogeneous lookup\n");
+  // Check both the unindexed and indexed states
+  for (size_t count : {5, 50}) {
+    OrderedMap<SharedString, int, SharedStringHash> m;
+    for (size_t z = 0; z < count; z++) {
+      m.emplace(std::format("key{}", z), z);
+    }
+    expect_eq(m.at("key3"), 3);
+    expect_eq(m.at(string("key3")), 3);
+    expect_eq(m.at(string_view("key3")), 3);
+    expect_eq(m.at(SharedString("key3")), 3);
+    expect(m.find(string("key4")) != m.end());
+    expect(m.find(string("missing")) == m.end());
+    expect(m.contains(string_view("key2")));
+    expect_eq(m.count(string("missing")), 0);
+    expect_eq(m.erase(string("key2")), 1);
+    expect(!m.contains("key2"));
+    expect_eq(m.size(), count - 1);
+    m.erase(m.begin());
+    expect(!m.contains("key0"));
+    expect_eq(m.at("key1"), 1);
+  }
+}
+
+int main(int, char**) {
+  run_tests<hash<string>>("std::hash");
+  run_tests<CollidingHash>("colliding hash");
+  run_heterogeneous_lookup_tests();
+  fwrite_fmt(stderr, "OrderedMapTest: all tests passed\n");
+  return 0;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <compare>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace phosg {
+
+// An immutable, reference-counted string. Copying a SharedString doesn't copy
+// the string's contents, so many copies of the same string (for example, the
+// same key in thousands of dicts) only use memory for one copy. The string's
+// hash is computed once at construction time, and comparing two SharedStrings
+// that share the same contents object doesn't need to look at the contents.
+//
+// Constructing a SharedString from a std::string always allocates a new
+// contents object; to make equal strings share contents, use
+// SharedStringTable.
+class SharedString {
+public:
+  SharedString() = default;
+  explicit SharedString(const char* s) : SharedString(std::string(s)) {}
+  explicit SharedString(std::string_view s) : SharedString(std::string(s)) {}
+  explicit SharedString(std::string&& s)
+      : data(std::make_shared<const Data>(std::hash<std::string_view>()(s), std::move(s))) {}
+  SharedString(const SharedString&) = default;
+  SharedString(SharedString&&) = default;
+  SharedString& operator=(const SharedString&) = default;
+  SharedString& operator=(SharedString&&) = default;
+  ~SharedString() = default;
+
+  inline const std::string& str() const {
+    return this->data ? this->data->s : empty_string();
+  }
+  inline operator const std::string&() const {
+    return this->str();
+  }
+  inline const char* c_str() const {
+    return this->str().c_str();
+  }
+  inline size_t size() const {
+    return this->str().size();
+  }
+  inline bool empty() const {
+    return this->str().empty();
+  }
+  inline size_t hash() const {
+    return this->data ? this->data->hash : std::hash<std::string_view>()("");
+  }
+  // Returns true if this and other use the same contents object
+  inline bool shares_data_with(const SharedString& other) const {
+    return this->data == other.data;
+  }
+
+  inline friend bool operator==(const SharedString& a, const SharedString& b) {
+    return (a.data == b.data) || ((a.hash() == b.hash()) && (a.str() == b.str()));
+  }
+  inline friend bool operator==(const SharedString& a, std::string_view b) {
+    return a.str() == b;
+  }
+  inline friend std::strong_ordering operator<=>(const SharedString& a, const SharedString& b) {
+    return (a.data == b.data) ? std::strong_ordering::equal : (a.str() <=> b.str());
+  }
+  inline friend std::strong_ordering operator<=>(const SharedString& a, std::string_view b) {
+    return std::string_view(a.str()) <=> b;
+  }
+
+private:
+  struct Data {
+    size_t hash;
+    std::string s;
+
+    Data(size_t hash, std::string&& s) : hash(hash), s(std::move(s)) {}
+  };
+  std::shared_ptr<const Data> data;
+
+  static const std::string& empty_string() {
+    static const std::string ret;
+    return ret;
+  }
+};
+
+// Hashes SharedStrings using their precomputed hashes. This also supports
+// heterogeneous lookup, so containers using this hash can be searched with
+// std::strings or std::string_views without constructing a SharedString.
+struct SharedStringHash {
+  using is_transparent = void;
+
+  inline size_t operator()(const SharedString& s) const {
+    return s.hash();
+  }
+  inline size_t operator()(std::string_view s) const {
+    return std::hash<std::string_view>()(s);
+  }
+  inline size_t operator()(const std::string& s) const {
+    return std::hash<std::string_view>()(s);
+  }
+  inline size_t operator()(const char* s) const {
+    return std::hash<std::string_view>()(s);
+  }
+};
+
+// Interns strings: get() returns a SharedString that shares its contents with
+// all other SharedStrings returned by the same table for equal strings. The
+// table holds a reference to every string it has returned, so it should
+// generally be short-lived (for example, one table per parsed document).
+class SharedStringTable {
+public:
+  SharedStringTable() = default;
+  ~SharedStringTable() = default;
+
+  SharedString get(std::string_view s) {
+    auto it = this->strings.find(s);
+    if (it != this->strings.end()) {
+      return it->second;
+    }
+    SharedString ret(s);
+    this->strings.emplace(ret.str(), ret);
+    return ret;
+  }
+  SharedString get(std::string&& s) {
+    auto it = this->strings.find(s);
+    if (it != this->strings.end()) {
+      return it->second;
+    }
+    SharedString ret(std::move(s));
+    this->strings.emplace(ret.str(), ret);
+    return ret;
+  }
+
+  inline size_t size() const {
+    return this->strings.size();
+  }
+  inline void clear() {
+    this->strings.clear();
+  }
+
+private:
+  // Keys point to the contents of the corresponding values
+  std::unordered_map<std::string_view, SharedString> strings;
+};
+
+} // namespace phosg
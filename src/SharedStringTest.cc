@@ -0,0 +1,67 @@
+#include <stdio.h>
+
+#include <string>
+
+#include "SharedString.hh"
+#include "UnitTest.hh"
+
+using namespace std;
+using namespace phosg;
+
+int main(int, char**) {
+  {
+    fwrite_fmt(stderr, "-- SharedString\n");
+    SharedString empty;
+    expect(empty.empty());
+    expect_eq(empty.str(), "");
+    expect_eq(empty, SharedString(""));
+    expect_eq(empty.hash(), SharedString("").hash());
+
+    SharedString a("some string");
+    SharedString b = a;
+    SharedString c(string("some string"));
+    expect(a.shares_data_with(b));
+    expect(!a.shares_data_with(c));
+    expect_eq(a, b);
+    expect_eq(a, c);
+    expect_eq(a.hash(), c.hash());
+    expect_eq(a, "some string");
+    expect_eq(a, string("some string"));
+    expect_ne(a, "some other string");
+    expect_eq(a.size(), 11);
+    const string& s = a;
+    expect_eq(s, "some string");
+
+    expect_lt(SharedString("abc"), SharedString("abd"));
+    expect_gt(SharedString("abc"), SharedString("ab"));
+    expect_lt(SharedString("abc"), string_view("abd"));
+
+    SharedStringHash h;
+    expect_eq(h(a), h(string_view("some string")));
+    expect_eq(h(a), h(string("some string")));
+    expect_eq(h(a), h("some string"));
+  }
+
+  {
+    fwrite_fmt(stderr, "-- SharedStringTable\n");
+    SharedStringTable table;
+    SharedString a = table.get(string_view("key"));
+    SharedString b = table.get(string("key"));
+    SharedString c = table.get(string_view("other key"));
+    expect(a.shares_data_with(b));
+    expect(!a.shares_data_with(c));
+    expect_eq(a, "key");
+    expect_eq(c, "other key");
+    expect_eq(table.size(), 2);
+
+    // Strings remain valid after the table is cleared or destroyed
+    table.clear();
+    expect_eq(table.size(), 0);
+    SharedString d = table.get(string_view("key"));
+    expect(!a.shares_data_with(d));
+    expect_eq(a, d);
+  }
+
+  fwrite_fmt(stderr, "SharedStringTest: all tests passed\n");
+  return 0;
+}
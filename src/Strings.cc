@@ -1,7 +1,9 @@
 #include "Strings.hh"
 
 #define _STDC_FORMAT_MACROS
+#include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -1231,6 +1233,12 @@ BitReader::BitReader(shared_ptr<string> data, size_t offset)
       length(data->size() * 8),
       offset(offset) {}
 
+BitReader::BitReader(shared_ptr<const void> owner, const void* data, size_t size, size_t offset)
+    : owned_data(std::move(owner)),
+      data(reinterpret_cast<const uint8_t*>(data)),
+      length(size),
+      offset(offset) {}
+
 BitReader::BitReader(const void* data, size_t size, size_t offset)
     : data(reinterpret_cast<const uint8_t*>(data)),
       length(size),
@@ -1275,10 +1283,25 @@ uint64_t BitReader::pread(size_t start_offset, uint8_t size) {
     throw logic_error("BitReader cannot return more than 64 bits at once");
   }
 
-  uint64_t ret = 0;
-  for (uint8_t ret_bits = 0; ret_bits < size; ret_bits++) {
-    size_t bit_offset = start_offset + ret_bits;
-    ret = (ret << 1) | ((this->data[bit_offset >> 3] >> (7 - (bit_offset & 7))) & 1);
+  if (size == 0) {
+    return 0;
+  }
+
+  // Take the remaining bits from the first byte, then whole bytes, then the
+  // beginning of the last byte. This never reads bytes past the last one that
+  // contains any of the requested bits.
+  const uint8_t* p = this->data + (start_offset >> 3);
+  uint8_t ret_bits = 8 - (start_offset & 7);
+  uint64_t ret = *(p++) & (0xFF >> (start_offset & 7));
+  if (ret_bits >= size) {
+    return ret >> (ret_bits - size);
+  }
+  for (; ret_bits + 8 <= size; ret_bits += 8) {
+    ret = (ret << 8) | *(p++);
+  }
+  if (ret_bits < size) {
+    uint8_t last_bits = size - ret_bits;
+    ret = (ret << last_bits) | (*p >> (8 - last_bits));
   }
   return ret;
 }
@@ -1291,40 +1314,105 @@ uint64_t BitReader::read(uint8_t size, bool advance) {
   return ret;
 }
 
-BitWriter::BitWriter() : last_byte_unset_bits(0) {}
+void BufferedBitReader::go(size_t offset) {
+  if (offset > this->length) {
+    throw out_of_range("offset is beyond end of bit stream");
+  }
+  this->byte_offset = offset >> 3;
+  this->buffer = 0;
+  this->buffer_bits = 0;
+  this->consume(offset & 7);
+}
+
+void BufferedBitReader::throw_refill_error(uint8_t min_bits) {
+  if (min_bits > MAX_PEEK_BITS) {
+    throw logic_error("BufferedBitReader cannot peek at more than 57 bits at once");
+  }
+  throw out_of_range("end of bit stream");
+}
+
+void BufferedBitReader::throw_read_size_error() {
+  throw logic_error("BufferedBitReader cannot return more than 64 bits at once");
+}
+
+BitWriter::BitWriter()
+    : str_bytes(0),
+      buffer(0),
+      buffer_bits(0) {}
 
 size_t BitWriter::size() const {
-  return this->data.size() * 8 - this->last_byte_unset_bits;
+  return (this->data.size() - this->str_bytes) * 8 + this->buffer_bits;
 }
 
 void BitWriter::reset() {
   this->data.clear();
-  this->last_byte_unset_bits = 0;
+  this->str_bytes = 0;
+  this->buffer = 0;
+  this->buffer_bits = 0;
+}
+
+void BitWriter::remove_str_bytes() {
+  this->data.resize(this->data.size() - this->str_bytes);
+  this->str_bytes = 0;
+}
+
+void BitWriter::write_buffer() {
+  this->remove_str_bytes();
+  be_uint64_t v = this->buffer;
+  this->data.append(reinterpret_cast<const char*>(&v), sizeof(v));
 }
 
 void BitWriter::truncate(size_t size) {
-  if (size > ((this->data.size() * 8) - this->last_byte_unset_bits)) {
+  if (size > this->size()) {
     throw logic_error("cannot extend a BitWriter via truncate()");
   }
-  this->data.resize((size + 7) / 8);
-  this->last_byte_unset_bits = (8 - (size & 7)) & 7;
-  // The if statement is important here (we can't just let the & become
-  // degenerate) because this->data could now be empty
-  if (this->last_byte_unset_bits) {
-    this->data[this->data.size() - 1] &= (0xFF << this->last_byte_unset_bits);
+  this->remove_str_bytes();
+
+  size_t data_bits = this->data.size() * 8;
+  if (size < data_bits) {
+    // Move the bits from the last (now incomplete) byte back into the buffer
+    this->data.resize((size + 7) / 8);
+    this->buffer = 0;
+    this->buffer_bits = size & 7;
+    if (this->buffer_bits) {
+      this->buffer = static_cast<uint64_t>(static_cast<uint8_t>(this->data.back())) << 56;
+      this->data.pop_back();
+    }
+  } else {
+    this->buffer_bits = size - data_bits;
+  }
+  // The if statement is important here because shifting by 64 is undefined
+  if (this->buffer_bits) {
+    this->buffer &= (0xFFFFFFFFFFFFFFFF << (64 - this->buffer_bits));
+  } else {
+    this->buffer = 0;
   }
 }
 
-void BitWriter::write(bool v) {
-  if (this->last_byte_unset_bits > 0) {
-    this->last_byte_unset_bits--;
-    if (v) {
-      this->data[this->data.size() - 1] |= (1 << this->last_byte_unset_bits);
-    }
+const string& BitWriter::str() {
+  this->remove_str_bytes();
+  be_uint64_t v = this->buffer;
+  this->str_bytes = (this->buffer_bits + 7) / 8;
+  this->data.append(reinterpret_cast<const char*>(&v), this->str_bytes);
+  return this->data;
+}
+
+void BitWriter::flush_to(StringWriter& w, bool include_partial_byte) {
+  this->remove_str_bytes();
+  w.write(this->data);
+  this->data.clear();
+
+  // Write the complete bytes in the buffer, and the incomplete byte if
+  // requested
+  be_uint64_t v = this->buffer;
+  size_t buffer_bytes = include_partial_byte ? ((this->buffer_bits + 7) / 8) : (this->buffer_bits / 8);
+  w.write(&v, buffer_bytes);
+  if (buffer_bytes == 8) {
+    this->buffer = 0;
   } else {
-    this->data.push_back(v ? 0x80 : 0x00);
-    this->last_byte_unset_bits = 7;
+    this->buffer <<= (buffer_bytes * 8);
   }
+  this->buffer_bits -= min<size_t>(this->buffer_bits, buffer_bytes * 8);
 }
 
 StringReader::StringReader()
@@ -1339,6 +1427,17 @@ StringReader::StringReader(shared_ptr<string> data, size_t offset)
       length(data->size()),
       offset(offset) {}
 
+StringReader::StringReader(shared_ptr<const void> owner, const void* data, size_t size, size_t offset)
+    : owned_data(std::move(owner)),
+      data(reinterpret_cast<const uint8_t*>(data)),
+      length(size),
+      offset(offset) {}
+
+#ifndef PHOSG_WINDOWS
+StringReader::StringReader(shared_ptr<const MappedFile> file, size_t offset)
+    : StringReader(file, file->data(), file->size(), offset) {}
+#endif
+
 StringReader::StringReader(const void* data, size_t size, size_t offset)
     : data(reinterpret_cast<const uint8_t*>(data)),
       length(size),
@@ -1400,6 +1499,7 @@ StringReader StringReader::sub(size_t offset) const {
     return StringReader();
   }
   return StringReader(
+      this->owned_data,
       reinterpret_cast<const char*>(this->data) + offset,
       this->length - offset);
 }
@@ -1410,10 +1510,11 @@ StringReader StringReader::sub(size_t offset, size_t size) const {
   }
   if (offset + size > this->length) {
     return StringReader(
+        this->owned_data,
         reinterpret_cast<const char*>(this->data) + offset,
         this->length - offset);
   }
-  return StringReader(reinterpret_cast<const char*>(this->data) + offset, size);
+  return StringReader(this->owned_data, reinterpret_cast<const char*>(this->data) + offset, size);
 }
 
 StringReader StringReader::subx(size_t offset) const {
@@ -1421,6 +1522,7 @@ StringReader StringReader::subx(size_t offset) const {
     throw out_of_range("sub-reader begins beyond end of data");
   }
   return StringReader(
+      this->owned_data,
       reinterpret_cast<const char*>(this->data) + offset,
       this->length - offset);
 }
@@ -1429,7 +1531,7 @@ StringReader StringReader::subx(size_t offset, size_t size) const {
   if (offset + size > this->length) {
     throw out_of_range("sub-reader begins or extends beyond end of data");
   }
-  return StringReader(reinterpret_cast<const char*>(this->data) + offset, size);
+  return StringReader(this->owned_data, reinterpret_cast<const char*>(this->data) + offset, size);
 }
 
 BitReader StringReader::sub_bits(size_t offset) const {
@@ -1437,6 +1539,7 @@ BitReader StringReader::sub_bits(size_t offset) const {
     return BitReader();
   }
   return BitReader(
+      this->owned_data,
       reinterpret_cast<const char*>(this->data) + offset,
       (this->length - offset) * 8);
 }
@@ -1447,10 +1550,11 @@ BitReader StringReader::sub_bits(size_t offset, size_t size) const {
   }
   if (offset + size > this->length) {
     return BitReader(
+        this->owned_data,
         reinterpret_cast<const char*>(this->data) + offset,
         (this->length - offset) * 8);
   }
-  return BitReader(reinterpret_cast<const char*>(this->data) + offset, size * 8);
+  return BitReader(this->owned_data, reinterpret_cast<const char*>(this->data) + offset, size * 8);
 }
 
 BitReader StringReader::subx_bits(size_t offset) const {
@@ -1458,6 +1562,7 @@ BitReader StringReader::subx_bits(size_t offset) const {
     throw out_of_range("sub-reader begins beyond end of data");
   }
   return BitReader(
+      this->owned_data,
       reinterpret_cast<const char*>(this->data) + offset,
       (this->length - offset) * 8);
 }
@@ -1466,7 +1571,7 @@ BitReader StringReader::subx_bits(size_t offset, size_t size) const {
   if (offset + size > this->length) {
     throw out_of_range("sub-reader begins or extends beyond end of data");
   }
-  return BitReader(reinterpret_cast<const char*>(this->data) + offset, size * 8);
+  return BitReader(this->owned_data, reinterpret_cast<const char*>(this->data) + offset, size * 8);
 }
 
 const char* StringReader::peek(size_t size) {
@@ -1607,6 +1712,202 @@ void StringWriter::write(const string& data) {
   this->contents.append(data);
 }
 
+ChunkedStringWriter::ChunkedStringWriter(size_t block_size)
+    : block_size(block_size),
+      tail_size(0),
+      flushed_bytes(0),
+      total_size(0) {
+  if (this->block_size == 0) {
+    throw invalid_argument("block size must not be zero");
+  }
+}
+
+void ChunkedStringWriter::reset() {
+  this->blocks.clear();
+  this->tail_size = 0;
+  this->flushed_bytes = 0;
+  this->total_size = 0;
+}
+
+void ChunkedStringWriter::append(const void* data, size_t size, char fill_v) {
+  const char* src = reinterpret_cast<const char*>(data);
+  while (size > 0) {
+    if (this->blocks.empty() || (this->tail_size == this->block_size)) {
+      this->blocks.emplace_back(make_unique_for_overwrite<char[]>(this->block_size));
+      this->tail_size = 0;
+    }
+    size_t chunk_size = min<size_t>(size, this->block_size - this->tail_size);
+    char* dest = this->blocks.back().get() + this->tail_size;
+    if (src) {
+      memcpy(dest, src, chunk_size);
+      src += chunk_size;
+    } else {
+      memset(dest, fill_v, chunk_size);
+    }
+    this->tail_size += chunk_size;
+    this->total_size += chunk_size;
+    size -= chunk_size;
+  }
+}
+
+void ChunkedStringWriter::extend_to(size_t size, char v) {
+  if (size >= this->total_size) {
+    this->append(nullptr, size - this->total_size, v);
+    return;
+  }
+  if (size < this->flushed_bytes) {
+    throw out_of_range("cannot truncate data that has already been flushed");
+  }
+  size_t unflushed_size = size - this->flushed_bytes;
+  size_t num_blocks = (unflushed_size + this->block_size - 1) / this->block_size;
+  this->blocks.resize(num_blocks);
+  this->tail_size = num_blocks ? (unflushed_size - (num_blocks - 1) * this->block_size) : 0;
+  this->total_size = size;
+}
+
+void ChunkedStringWriter::pwrite(size_t offset, const void* data, size_t size) {
+  if (offset < this->flushed_bytes) {
+    throw out_of_range("cannot modify data that has already been flushed");
+  }
+  if (offset + size > this->total_size) {
+    this->extend_to(offset + size);
+  }
+  const char* src = reinterpret_cast<const char*>(data);
+  size_t block_index = (offset - this->flushed_bytes) / this->block_size;
+  size_t block_offset = (offset - this->flushed_bytes) % this->block_size;
+  while (size > 0) {
+    size_t chunk_size = min<size_t>(size, this->block_size - block_offset);
+    memcpy(this->blocks[block_index].get() + block_offset, src, chunk_size);
+    src += chunk_size;
+    size -= chunk_size;
+    block_index++;
+    block_offset = 0;
+  }
+}
+
+vector<struct iovec> ChunkedStringWriter::iovs() const {
+  vector<struct iovec> ret;
+  ret.reserve(this->blocks.size());
+  for (size_t z = 0; z < this->blocks.size(); z++) {
+    auto& iov = ret.emplace_back();
+    iov.iov_base = this->blocks[z].get();
+    iov.iov_len = (z == this->blocks.size() - 1) ? this->tail_size : this->block_size;
+  }
+  return ret;
+}
+
+string ChunkedStringWriter::linearize() const {
+  string ret;
+  ret.reserve(this->total_size - this->flushed_bytes);
+  for (const auto& iov : this->iovs()) {
+    ret.append(reinterpret_cast<const char*>(iov.iov_base), iov.iov_len);
+  }
+  return ret;
+}
+
+#ifndef PHOSG_WINDOWS
+void ChunkedStringWriter::flush(int fd) {
+  auto iovs = this->iovs();
+  size_t iov_index = 0;
+  while (iov_index < iovs.size()) {
+    ssize_t bytes_written = writev(fd, &iovs[iov_index], min<size_t>(iovs.size() - iov_index, IOV_MAX));
+    if (bytes_written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw io_error(fd);
+    }
+    // writev may write only part of the data; skip the iovecs that were
+    // written completely and adjust the one that was written partially
+    size_t remaining_bytes = bytes_written;
+    while ((iov_index < iovs.size()) && (remaining_bytes >= iovs[iov_index].iov_len)) {
+      remaining_bytes -= iovs[iov_index].iov_len;
+      iov_index++;
+    }
+    if (remaining_bytes) {
+      iovs[iov_index].iov_base = reinterpret_cast<char*>(iovs[iov_index].iov_base) + remaining_bytes;
+      iovs[iov_index].iov_len -= remaining_bytes;
+    }
+  }
+
+  this->blocks.clear();
+  this->tail_size = 0;
+  this->flushed_bytes = this->total_size;
+}
+#endif
+
+#ifndef PHOSG_WINDOWS
+static int flush_and_get_fd(FILE* f) {
+  if (fflush(f)) {
+    throw io_error(fileno(f));
+  }
+  return fileno(f);
+}
+
+FileStringWriter::FileStringWriter(int fd, size_t buffer_size)
+    : fd(fd),
+      buffer_size(buffer_size),
+      base_offset(lseek(fd, 0, SEEK_CUR)),
+      flushed_bytes(0) {
+  this->buffer.reserve(this->buffer_size);
+}
+
+FileStringWriter::FileStringWriter(FILE* f, size_t buffer_size)
+    : FileStringWriter(flush_and_get_fd(f), buffer_size) {}
+
+FileStringWriter::~FileStringWriter() {
+  try {
+    this->flush();
+  } catch (const exception&) {
+  }
+}
+
+void FileStringWriter::pwrite(size_t offset, const void* data, size_t size) {
+  if (offset + size > this->size()) {
+    this->buffer.resize(offset + size - this->flushed_bytes, '\0');
+  }
+
+  const char* src = reinterpret_cast<const char*>(data);
+  if (offset < this->flushed_bytes) {
+    if (this->base_offset < 0) {
+      throw out_of_range("cannot modify data that has already been written to a non-seekable fd");
+    }
+    size_t flushed_size = min<size_t>(size, this->flushed_bytes - offset);
+    pwritex(this->fd, src, flushed_size, this->base_offset + offset);
+    src += flushed_size;
+    offset += flushed_size;
+    size -= flushed_size;
+  }
+  if (size > 0) {
+    memcpy(this->buffer.data() + (offset - this->flushed_bytes), src, size);
+  }
+
+  this->flush_if_full();
+}
+
+void FileStringWriter::flush() {
+  // write() may write only part of the data (e.g. if fd is a pipe), so this
+  // can't just use writex
+  const char* data = this->buffer.data();
+  size_t remaining = this->buffer.size();
+  while (remaining > 0) {
+    ssize_t bytes_written = ::write(this->fd, data, remaining);
+    if (bytes_written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Keep the data that wasn't written, so flush() can be retried
+      this->buffer.erase(0, data - this->buffer.data());
+      throw io_error(this->fd);
+    }
+    data += bytes_written;
+    remaining -= bytes_written;
+    this->flushed_bytes += bytes_written;
+  }
+  this->buffer.clear();
+}
+#endif
+
 size_t count_zeroes(const void* vdata, size_t size, size_t stride) {
   const uint8_t* data = reinterpret_cast<const uint8_t*>(vdata);
   size_t zero_count = 0;
@@ -393,6 +393,8 @@ class BitReader {
 public:
   BitReader();
   explicit BitReader(std::shared_ptr<std::string> data, size_t offset = 0);
+  // The reader holds a reference to owner, which should own the data
+  BitReader(std::shared_ptr<const void> owner, const void* data, size_t size, size_t offset = 0);
   BitReader(const void* data, size_t size, size_t offset = 0);
   BitReader(const std::string& data, size_t offset = 0);
   virtual ~BitReader() = default;
@@ -409,15 +411,193 @@ public:
   uint64_t read(uint8_t size = 1, bool advance = true);
 
 private:
-  std::shared_ptr<std::string> owned_data;
+  std::shared_ptr<const void> owned_data;
   const uint8_t* data;
   size_t length;
   size_t offset;
 };
 
+enum class BitOrder {
+  // The first bit of each byte is its most-significant bit, and multi-bit
+  // values are stored with their most-significant bit first (this is the
+  // order that BitReader and BitWriter use)
+  MSB_FIRST = 0,
+  // The first bit of each byte is its least-significant bit, and multi-bit
+  // values are stored with their least-significant bit first (for example,
+  // as in DEFLATE streams)
+  LSB_FIRST,
+};
+
+// A faster bit reader for decoding bitstreams. Instead of assembling each
+// value one bit at a time like BitReader, this keeps up to 64 bits in a
+// buffer, which is refilled with a single unaligned 8-byte load when possible.
+// Bounds are only checked when the buffer is refilled. Use peek() to look at
+// the next few bits without advancing (e.g. for table-driven Huffman
+// decoding), then consume() to advance past the bits that were used.
+//
+// As with BitReader, sizes and offsets are in bits.
+class BufferedBitReader {
+public:
+  // The largest value that can be passed to peek() or consume(); read() can
+  // read up to 64 bits at once
+  static constexpr uint8_t MAX_PEEK_BITS = 57;
+
+  // The constructors and all the reading functions are inline, and nothing
+  // passes this to a non-inline function, so the compiler can keep the
+  // reader's state in registers in decoding loops
+  inline BufferedBitReader() : BufferedBitReader(nullptr, 0) {}
+  inline BufferedBitReader(const void* data, size_t size, BitOrder order = BitOrder::MSB_FIRST)
+      : data(reinterpret_cast<const uint8_t*>(data)),
+        length(size),
+        bit_order(order),
+        byte_offset(0),
+        buffer(0),
+        buffer_bits(0) {}
+  inline explicit BufferedBitReader(const std::string& data, BitOrder order = BitOrder::MSB_FIRST)
+      : BufferedBitReader(data.data(), data.size() * 8, order) {}
+  ~BufferedBitReader() = default;
+
+  inline size_t where() const {
+    return std::min<size_t>(this->byte_offset << 3, this->length) - this->buffer_bits;
+  }
+  inline size_t size() const {
+    return this->length;
+  }
+  inline size_t remaining() const {
+    return this->length - this->where();
+  }
+  inline bool eof() const {
+    return (this->buffer_bits == 0) && ((this->byte_offset << 3) >= this->length);
+  }
+  inline BitOrder order() const {
+    return this->bit_order;
+  }
+  void go(size_t offset);
+  inline void skip(size_t bits) {
+    this->go(this->where() + bits);
+  }
+
+  // Returns the next size bits without advancing. Throws std::out_of_range if
+  // there aren't enough bits left.
+  inline uint64_t peek(uint8_t size) {
+    if ((size > MAX_PEEK_BITS) || (this->buffer_bits < size)) {
+      this->refill(size);
+    }
+    if (this->bit_order == BitOrder::MSB_FIRST) {
+      // The shift is split so that size == 0 doesn't shift by 64
+      return (this->buffer >> 1) >> (63 - size);
+    } else {
+      return this->buffer & ((1ULL << size) - 1);
+    }
+  }
+  inline void consume(uint8_t size) {
+    if ((size > MAX_PEEK_BITS) || (this->buffer_bits < size)) {
+      this->refill(size);
+    }
+    if (this->bit_order == BitOrder::MSB_FIRST) {
+      this->buffer <<= size;
+    } else {
+      this->buffer >>= size;
+    }
+    this->buffer_bits -= size;
+  }
+  inline uint64_t read(uint8_t size = 1) {
+    if (size <= MAX_PEEK_BITS) {
+      uint64_t ret = this->peek(size);
+      this->consume(size);
+      return ret;
+    }
+
+    // Values longer than MAX_PEEK_BITS are read in two parts
+    if (size > 64) {
+      throw_read_size_error();
+    }
+    if (this->remaining() < size) {
+      throw_refill_error(size);
+    }
+    uint8_t high_bits = size - 32;
+    uint64_t first = this->peek(32);
+    this->consume(32);
+    uint64_t second = this->peek(high_bits);
+    this->consume(high_bits);
+    if (this->bit_order == BitOrder::MSB_FIRST) {
+      return (first << high_bits) | second;
+    } else {
+      return first | (second << 32);
+    }
+  }
+
+private:
+  const uint8_t* data;
+  size_t length;
+  BitOrder bit_order;
+  // Offset of the next byte to load into the buffer
+  size_t byte_offset;
+  // The next buffer_bits bits in the stream. In MSB_FIRST order, the next bit
+  // is the buffer's most-significant bit; in LSB_FIRST order, it's the
+  // least-significant bit. The rest of the buffer may contain bits that will
+  // be loaded again by the next refill.
+  uint64_t buffer;
+  uint8_t buffer_bits;
+
+  // Loads at least min_bits bits into the buffer, or throws if there aren't
+  // enough bits left
+  inline void refill(uint8_t min_bits) {
+    if (min_bits > MAX_PEEK_BITS) {
+      throw_refill_error(min_bits);
+    }
+    size_t byte_length = (this->length + 7) >> 3;
+    if (this->byte_offset + 8 <= byte_length) {
+      // Load 8 bytes, and keep as many whole bytes as fit in the buffer. This
+      // never keeps the last byte of the data, so all the kept bits are
+      // within the stream even if its size isn't a multiple of 8.
+      if (this->bit_order == BitOrder::MSB_FIRST) {
+        be_uint64_t v;
+        memcpy(&v, this->data + this->byte_offset, sizeof(v));
+        this->buffer |= v.load() >> this->buffer_bits;
+      } else {
+        le_uint64_t v;
+        memcpy(&v, this->data + this->byte_offset, sizeof(v));
+        this->buffer |= v.load() << this->buffer_bits;
+      }
+      size_t bytes_loaded = (63 - this->buffer_bits) >> 3;
+      this->byte_offset += bytes_loaded;
+      this->buffer_bits += bytes_loaded << 3;
+      if (this->buffer_bits >= min_bits) {
+        return;
+      }
+    }
+
+    // Load one byte at a time. This happens near the end of the data, and when
+    // the buffer was byte-aligned before the 8-byte load above (which then
+    // only fills 56 bits) but more than 56 bits were requested.
+    while ((this->buffer_bits <= 56) && (this->byte_offset < byte_length)) {
+      uint64_t v = this->data[this->byte_offset];
+      if (this->bit_order == BitOrder::MSB_FIRST) {
+        this->buffer |= v << (56 - this->buffer_bits);
+      } else {
+        this->buffer |= v << this->buffer_bits;
+      }
+      this->buffer_bits += std::min<size_t>(8, this->length - (this->byte_offset << 3));
+      this->byte_offset++;
+    }
+    if (this->buffer_bits < min_bits) {
+      throw_refill_error(min_bits);
+    }
+  }
+  [[noreturn]] static void throw_refill_error(uint8_t min_bits);
+  [[noreturn]] static void throw_read_size_error();
+};
+
+class StringWriter;
+
 // This class exists because apparently vector<bool> isn't required to store its
 // elements continguously, and in many reverse-engineering situations we
-// definitely want the bits to all be contiguous.
+// definitely want the bits to all be contiguous. Bits are written in MSB_FIRST
+// order (the order that BitReader reads them in). They're accumulated in a
+// 64-bit buffer and appended to the output 8 bytes at a time, so writing
+// multi-bit values with write(value, bits) is much faster than writing them
+// one bit at a time.
 class BitWriter {
 public:
   BitWriter();
@@ -428,21 +608,140 @@ public:
 
   void truncate(size_t bits);
 
-  void write(bool v);
-
-  inline const std::string& str() {
-    return this->data;
+  inline void write(bool v) {
+    this->write(v ? 1 : 0, 1);
   }
+  // Writes the low bits bits of value, most-significant bit first. Bits in
+  // value above the low bits bits are ignored.
+  inline void write(uint64_t value, uint8_t bits) {
+    if (bits == 0) {
+      return;
+    }
+    if (bits > 64) {
+      throw std::logic_error("BitWriter cannot write more than 64 bits at once");
+    }
+    value &= (0xFFFFFFFFFFFFFFFF >> (64 - bits));
+    if (this->buffer_bits + bits < 64) {
+      this->buffer |= value << (64 - this->buffer_bits - bits);
+      this->buffer_bits += bits;
+    } else {
+      // Fill the buffer, write it out, and put the remaining bits (if any) at
+      // the beginning of the now-empty buffer
+      uint8_t remaining_bits = this->buffer_bits + bits - 64;
+      this->buffer |= value >> remaining_bits;
+      this->write_buffer();
+      // The shift is split so that remaining_bits == 0 doesn't shift by 64
+      this->buffer = (value << 1) << (63 - remaining_bits);
+      this->buffer_bits = remaining_bits;
+    }
+  }
+
+  // Returns all the data written so far. If the number of bits written isn't
+  // a multiple of 8, the last byte is padded with zero bits.
+  const std::string& str();
+
+  // Appends all complete bytes to w and removes them from this BitWriter. If
+  // include_partial_byte is true, the last incomplete byte (if any) is also
+  // appended, padded with zero bits, so the BitWriter will be empty. Otherwise,
+  // the incomplete byte's bits remain in the BitWriter. After this, size() and
+  // offsets passed to truncate() are relative to the remaining bits.
+  void flush_to(StringWriter& w, bool include_partial_byte = false);
 
 private:
+  // Complete bytes that have been written. If str() was called, this also
+  // contains copies of the bytes in the buffer (str_bytes of them), which are
+  // removed before anything else is appended to data.
   std::string data;
-  uint8_t last_byte_unset_bits;
+  size_t str_bytes;
+  // The next bit goes at bit (63 - buffer_bits) of buffer; the bits below it
+  // are always zero
+  uint64_t buffer;
+  uint8_t buffer_bits;
+
+  void remove_str_bytes();
+  void write_buffer();
+};
+
+// A cursor over data whose bounds have already been checked, returned by
+// StringReader::get_span. Reads from a span don't check bounds, so decoders
+// can check once for a block of data (e.g. a row of pixels) instead of once
+// for each value. Reading more than size() bytes in total from a span is
+// undefined behavior.
+class StringReaderSpan {
+public:
+  StringReaderSpan(const void* data, size_t size)
+      : data(reinterpret_cast<const uint8_t*>(data)),
+        length(size),
+        offset(0) {}
+  ~StringReaderSpan() = default;
+
+  inline size_t where() const {
+    return this->offset;
+  }
+  inline size_t size() const {
+    return this->length;
+  }
+  inline size_t remaining() const {
+    return this->length - this->offset;
+  }
+  inline bool eof() const {
+    return (this->offset >= this->length);
+  }
+  inline void skip(size_t bytes) {
+    this->offset += bytes;
+  }
+
+  inline const void* getv(size_t size) {
+    const void* ret = this->data + this->offset;
+    this->offset += size;
+    return ret;
+  }
+  template <typename T>
+  const T& get() {
+    return *reinterpret_cast<const T*>(this->getv(sizeof(T)));
+  }
+  template <typename T>
+  void read_array(loaded_type_t<T>* dest, size_t count) {
+    load_array<T>(dest, this->getv(count * sizeof(T)), count);
+  }
+
+  inline uint8_t get_u8() { return this->get<uint8_t>(); }
+  inline int8_t get_s8() { return this->get<int8_t>(); }
+  inline uint16_t get_u16b() { return this->get<be_uint16_t>(); }
+  inline uint16_t get_u16l() { return this->get<le_uint16_t>(); }
+  inline int16_t get_s16b() { return this->get<be_int16_t>(); }
+  inline int16_t get_s16l() { return this->get<le_int16_t>(); }
+  inline uint32_t get_u32b() { return this->get<be_uint32_t>(); }
+  inline uint32_t get_u32l() { return this->get<le_uint32_t>(); }
+  inline int32_t get_s32b() { return this->get<be_int32_t>(); }
+  inline int32_t get_s32l() { return this->get<le_int32_t>(); }
+  inline uint64_t get_u64b() { return this->get<be_uint64_t>(); }
+  inline uint64_t get_u64l() { return this->get<le_uint64_t>(); }
+  inline int64_t get_s64b() { return this->get<be_int64_t>(); }
+  inline int64_t get_s64l() { return this->get<le_int64_t>(); }
+  inline float get_f32b() { return this->get<be_float>(); }
+  inline float get_f32l() { return this->get<le_float>(); }
+  inline double get_f64b() { return this->get<be_double>(); }
+  inline double get_f64l() { return this->get<le_double>(); }
+
+private:
+  const uint8_t* data;
+  size_t length;
+  size_t offset;
 };
 
 class StringReader {
 public:
   StringReader();
   explicit StringReader(std::shared_ptr<std::string> data, size_t offset = 0);
+  // The reader holds a reference to owner, which should own the data. Sub-
+  // readers created with sub(), subx(), sub_bits(), and subx_bits() also hold
+  // a reference to it, so they remain valid after this reader is destroyed.
+  StringReader(std::shared_ptr<const void> owner, const void* data, size_t size, size_t offset = 0);
+#ifndef PHOSG_WINDOWS
+  // Reads directly from a memory-mapped file, without copying its contents
+  explicit StringReader(std::shared_ptr<const MappedFile> file, size_t offset = 0);
+#endif
   StringReader(const void* data, size_t size, size_t offset = 0);
   StringReader(const std::string& data, size_t offset = 0);
   virtual ~StringReader() = default;
@@ -504,6 +803,37 @@ public:
     return ret;
   }
 
+  // Checks that size bytes are available, then returns a span that can read
+  // them without further checks. Throws std::out_of_range if there isn't
+  // enough data.
+  inline StringReaderSpan pget_span(size_t offset, size_t size) const {
+    return StringReaderSpan(this->pgetv(offset, size), size);
+  }
+  inline StringReaderSpan get_span(size_t size, bool advance = true) {
+    return StringReaderSpan(this->getv(size, advance), size);
+  }
+
+  // Reads count values of type T, converting each one to its loaded type (so
+  // read_array<le_uint32_t> produces native uint32_ts). Throws
+  // std::out_of_range without reading anything if there isn't enough data.
+  template <typename T>
+  void read_array(loaded_type_t<T>* dest, size_t count, bool advance = true) {
+    if (count > this->remaining() / sizeof(T)) {
+      throw std::out_of_range("end of string");
+    }
+    load_array<T>(dest, this->getv(count * sizeof(T), advance), count);
+  }
+  template <typename T>
+  std::vector<loaded_type_t<T>> read_array(size_t count, bool advance = true) {
+    // Check before allocating, so a corrupt count can't cause a huge allocation
+    if (count > this->remaining() / sizeof(T)) {
+      throw std::out_of_range("end of string");
+    }
+    std::vector<loaded_type_t<T>> ret(count);
+    load_array<T>(ret.data(), this->getv(count * sizeof(T), advance), count);
+    return ret;
+  }
+
   inline uint8_t get_u8(bool advance = true) { return this->get<uint8_t>(advance); }
   inline int8_t get_s8(bool advance = true) { return this->get<int8_t>(advance); }
   inline uint8_t pget_u8(size_t offset) const { return this->pget<uint8_t>(offset); }
@@ -625,13 +955,100 @@ public:
   std::string pget_cstr(size_t offset) const;
 
 private:
-  std::shared_ptr<std::string> owned_data;
+  std::shared_ptr<const void> owned_data;
   const uint8_t* data;
   size_t length;
   size_t offset;
 };
 
-class StringWriter {
+// The put_* and pput_* functions shared by the writer classes below. WriterT
+// must derive from this class and define put<T> and pput<T>.
+template <typename WriterT>
+class WriterPutFunctions {
+public:
+  inline void put_u8(uint8_t v) { this->writer().template put<uint8_t>(v); }
+  inline void put_s8(int8_t v) { this->writer().template put<int8_t>(v); }
+  inline void put_u16(uint16_t v) { this->writer().template put<uint16_t>(v); }
+  inline void put_s16(int16_t v) { this->writer().template put<int16_t>(v); }
+  inline void put_u32(uint32_t v) { this->writer().template put<uint32_t>(v); }
+  inline void put_s32(int32_t v) { this->writer().template put<int32_t>(v); }
+  inline void put_u64(uint64_t v) { this->writer().template put<uint64_t>(v); }
+  inline void put_s64(int64_t v) { this->writer().template put<int64_t>(v); }
+  inline void put_f32(float v) { this->writer().template put<float>(v); }
+  inline void put_f64(double v) { this->writer().template put<double>(v); }
+
+  inline void put_u16r(uint16_t v) { this->writer().template put<re_uint16_t>(v); }
+  inline void put_s16r(int16_t v) { this->writer().template put<re_int16_t>(v); }
+  inline void put_u32r(uint32_t v) { this->writer().template put<re_uint32_t>(v); }
+  inline void put_s32r(int32_t v) { this->writer().template put<re_int32_t>(v); }
+  inline void put_u64r(uint64_t v) { this->writer().template put<re_uint64_t>(v); }
+  inline void put_s64r(int64_t v) { this->writer().template put<re_int64_t>(v); }
+  inline void put_f32r(float v) { this->writer().template put<re_float>(v); }
+  inline void put_f64r(double v) { this->writer().template put<re_double>(v); }
+
+  inline void put_u16b(uint16_t v) { this->writer().template put<be_uint16_t>(v); }
+  inline void put_s16b(int16_t v) { this->writer().template put<be_int16_t>(v); }
+  inline void put_u32b(uint32_t v) { this->writer().template put<be_uint32_t>(v); }
+  inline void put_s32b(int32_t v) { this->writer().template put<be_int32_t>(v); }
+  inline void put_u64b(uint64_t v) { this->writer().template put<be_uint64_t>(v); }
+  inline void put_s64b(int64_t v) { this->writer().template put<be_int64_t>(v); }
+  inline void put_f32b(float v) { this->writer().template put<be_float>(v); }
+  inline void put_f64b(double v) { this->writer().template put<be_double>(v); }
+
+  inline void put_u16l(uint16_t v) { this->writer().template put<le_uint16_t>(v); }
+  inline void put_s16l(int16_t v) { this->writer().template put<le_int16_t>(v); }
+  inline void put_u32l(uint32_t v) { this->writer().template put<le_uint32_t>(v); }
+  inline void put_s32l(int32_t v) { this->writer().template put<le_int32_t>(v); }
+  inline void put_u64l(uint64_t v) { this->writer().template put<le_uint64_t>(v); }
+  inline void put_s64l(int64_t v) { this->writer().template put<le_int64_t>(v); }
+  inline void put_f32l(float v) { this->writer().template put<le_float>(v); }
+  inline void put_f64l(double v) { this->writer().template put<le_double>(v); }
+
+  inline void pput_u8(size_t offset, uint8_t v) { this->writer().template pput<uint8_t>(offset, v); }
+  inline void pput_s8(size_t offset, int8_t v) { this->writer().template pput<int8_t>(offset, v); }
+  inline void pput_u16(size_t offset, uint16_t v) { this->writer().template pput<uint16_t>(offset, v); }
+  inline void pput_s16(size_t offset, int16_t v) { this->writer().template pput<int16_t>(offset, v); }
+  inline void pput_u32(size_t offset, uint32_t v) { this->writer().template pput<uint32_t>(offset, v); }
+  inline void pput_s32(size_t offset, int32_t v) { this->writer().template pput<int32_t>(offset, v); }
+  inline void pput_u64(size_t offset, uint64_t v) { this->writer().template pput<uint64_t>(offset, v); }
+  inline void pput_s64(size_t offset, int64_t v) { this->writer().template pput<int64_t>(offset, v); }
+  inline void pput_f32(size_t offset, float v) { this->writer().template pput<float>(offset, v); }
+  inline void pput_f64(size_t offset, double v) { this->writer().template pput<double>(offset, v); }
+
+  inline void pput_u16r(size_t offset, uint16_t v) { this->writer().template pput<re_uint16_t>(offset, v); }
+  inline void pput_s16r(size_t offset, int16_t v) { this->writer().template pput<re_int16_t>(offset, v); }
+  inline void pput_u32r(size_t offset, uint32_t v) { this->writer().template pput<re_uint32_t>(offset, v); }
+  inline void pput_s32r(size_t offset, int32_t v) { this->writer().template pput<re_int32_t>(offset, v); }
+  inline void pput_u64r(size_t offset, uint64_t v) { this->writer().template pput<re_uint64_t>(offset, v); }
+  inline void pput_s64r(size_t offset, int64_t v) { this->writer().template pput<re_int64_t>(offset, v); }
+  inline void pput_f32r(size_t offset, float v) { this->writer().template pput<re_float>(offset, v); }
+  inline void pput_f64r(size_t offset, double v) { this->writer().template pput<re_double>(offset, v); }
+
+  inline void pput_u16b(size_t offset, uint16_t v) { this->writer().template pput<be_uint16_t>(offset, v); }
+  inline void pput_s16b(size_t offset, int16_t v) { this->writer().template pput<be_int16_t>(offset, v); }
+  inline void pput_u32b(size_t offset, uint32_t v) { this->writer().template pput<be_uint32_t>(offset, v); }
+  inline void pput_s32b(size_t offset, int32_t v) { this->writer().template pput<be_int32_t>(offset, v); }
+  inline void pput_u64b(size_t offset, uint64_t v) { this->writer().template pput<be_uint64_t>(offset, v); }
+  inline void pput_s64b(size_t offset, int64_t v) { this->writer().template pput<be_int64_t>(offset, v); }
+  inline void pput_f32b(size_t offset, float v) { this->writer().template pput<be_float>(offset, v); }
+  inline void pput_f64b(size_t offset, double v) { this->writer().template pput<be_double>(offset, v); }
+
+  inline void pput_u16l(size_t offset, uint16_t v) { this->writer().template pput<le_uint16_t>(offset, v); }
+  inline void pput_s16l(size_t offset, int16_t v) { this->writer().template pput<le_int16_t>(offset, v); }
+  inline void pput_u32l(size_t offset, uint32_t v) { this->writer().template pput<le_uint32_t>(offset, v); }
+  inline void pput_s32l(size_t offset, int32_t v) { this->writer().template pput<le_int32_t>(offset, v); }
+  inline void pput_u64l(size_t offset, uint64_t v) { this->writer().template pput<le_uint64_t>(offset, v); }
+  inline void pput_s64l(size_t offset, int64_t v) { this->writer().template pput<le_int64_t>(offset, v); }
+  inline void pput_f32l(size_t offset, float v) { this->writer().template pput<le_float>(offset, v); }
+  inline void pput_f64l(size_t offset, double v) { this->writer().template pput<le_double>(offset, v); }
+
+private:
+  inline WriterT& writer() {
+    return *static_cast<WriterT*>(this);
+  }
+};
+
+class StringWriter : public WriterPutFunctions<StringWriter> {
 public:
   StringWriter() = default;
   ~StringWriter() = default;
@@ -661,81 +1078,18 @@ public:
     memcpy(this->contents.data() + offset, &v, sizeof(v));
   }
 
-  inline void put_u8(uint8_t v) { this->put<uint8_t>(v); }
-  inline void put_s8(int8_t v) { this->put<int8_t>(v); }
-  inline void put_u16(uint16_t v) { this->put<uint16_t>(v); }
-  inline void put_s16(int16_t v) { this->put<int16_t>(v); }
-  inline void put_u32(uint32_t v) { this->put<uint32_t>(v); }
-  inline void put_s32(int32_t v) { this->put<int32_t>(v); }
-  inline void put_u64(uint64_t v) { this->put<uint64_t>(v); }
-  inline void put_s64(int64_t v) { this->put<int64_t>(v); }
-  inline void put_f32(float v) { this->put<float>(v); }
-  inline void put_f64(double v) { this->put<double>(v); }
-
-  inline void put_u16r(uint16_t v) { this->put<re_uint16_t>(v); }
-  inline void put_s16r(int16_t v) { this->put<re_int16_t>(v); }
-  inline void put_u32r(uint32_t v) { this->put<re_uint32_t>(v); }
-  inline void put_s32r(int32_t v) { this->put<re_int32_t>(v); }
-  inline void put_u64r(uint64_t v) { this->put<re_uint64_t>(v); }
-  inline void put_s64r(int64_t v) { this->put<re_int64_t>(v); }
-  inline void put_f32r(float v) { this->put<re_float>(v); }
-  inline void put_f64r(double v) { this->put<re_double>(v); }
-
-  inline void put_u16b(uint16_t v) { this->put<be_uint16_t>(v); }
-  inline void put_s16b(int16_t v) { this->put<be_int16_t>(v); }
-  inline void put_u32b(uint32_t v) { this->put<be_uint32_t>(v); }
-  inline void put_s32b(int32_t v) { this->put<be_int32_t>(v); }
-  inline void put_u64b(uint64_t v) { this->put<be_uint64_t>(v); }
-  inline void put_s64b(int64_t v) { this->put<be_int64_t>(v); }
-  inline void put_f32b(float v) { this->put<be_float>(v); }
-  inline void put_f64b(double v) { this->put<be_double>(v); }
-
-  inline void put_u16l(uint16_t v) { this->put<le_uint16_t>(v); }
-  inline void put_s16l(int16_t v) { this->put<le_int16_t>(v); }
-  inline void put_u32l(uint32_t v) { this->put<le_uint32_t>(v); }
-  inline void put_s32l(int32_t v) { this->put<le_int32_t>(v); }
-  inline void put_u64l(uint64_t v) { this->put<le_uint64_t>(v); }
-  inline void put_s64l(int64_t v) { this->put<le_int64_t>(v); }
-  inline void put_f32l(float v) { this->put<le_float>(v); }
-  inline void put_f64l(double v) { this->put<le_double>(v); }
-
-  inline void pput_u8(size_t offset, uint8_t v) { this->pput<uint8_t>(offset, v); }
-  inline void pput_s8(size_t offset, int8_t v) { this->pput<int8_t>(offset, v); }
-  inline void pput_u16(size_t offset, uint16_t v) { this->pput<uint16_t>(offset, v); }
-  inline void pput_s16(size_t offset, int16_t v) { this->pput<int16_t>(offset, v); }
-  inline void pput_u32(size_t offset, uint32_t v) { this->pput<uint32_t>(offset, v); }
-  inline void pput_s32(size_t offset, int32_t v) { this->pput<int32_t>(offset, v); }
-  inline void pput_u64(size_t offset, uint64_t v) { this->pput<uint64_t>(offset, v); }
-  inline void pput_s64(size_t offset, int64_t v) { this->pput<int64_t>(offset, v); }
-  inline void pput_f32(size_t offset, float v) { this->pput<float>(offset, v); }
-  inline void pput_f64(size_t offset, double v) { this->pput<double>(offset, v); }
-
-  inline void pput_u16r(size_t offset, uint16_t v) { this->pput<re_uint16_t>(offset, v); }
-  inline void pput_s16r(size_t offset, int16_t v) { this->pput<re_int16_t>(offset, v); }
-  inline void pput_u32r(size_t offset, uint32_t v) { this->pput<re_uint32_t>(offset, v); }
-  inline void pput_s32r(size_t offset, int32_t v) { this->pput<re_int32_t>(offset, v); }
-  inline void pput_u64r(size_t offset, uint64_t v) { this->pput<re_uint64_t>(offset, v); }
-  inline void pput_s64r(size_t offset, int64_t v) { this->pput<re_int64_t>(offset, v); }
-  inline void pput_f32r(size_t offset, float v) { this->pput<re_float>(offset, v); }
-  inline void pput_f64r(size_t offset, double v) { this->pput<re_double>(offset, v); }
-
-  inline void pput_u16b(size_t offset, uint16_t v) { this->pput<be_uint16_t>(offset, v); }
-  inline void pput_s16b(size_t offset, int16_t v) { this->pput<be_int16_t>(offset, v); }
-  inline void pput_u32b(size_t offset, uint32_t v) { this->pput<be_uint32_t>(offset, v); }
-  inline void pput_s32b(size_t offset, int32_t v) { this->pput<be_int32_t>(offset, v); }
-  inline void pput_u64b(size_t offset, uint64_t v) { this->pput<be_uint64_t>(offset, v); }
-  inline void pput_s64b(size_t offset, int64_t v) { this->pput<be_int64_t>(offset, v); }
-  inline void pput_f32b(size_t offset, float v) { this->pput<be_float>(offset, v); }
-  inline void pput_f64b(size_t offset, double v) { this->pput<be_double>(offset, v); }
-
-  inline void pput_u16l(size_t offset, uint16_t v) { this->pput<le_uint16_t>(offset, v); }
-  inline void pput_s16l(size_t offset, int16_t v) { this->pput<le_int16_t>(offset, v); }
-  inline void pput_u32l(size_t offset, uint32_t v) { this->pput<le_uint32_t>(offset, v); }
-  inline void pput_s32l(size_t offset, int32_t v) { this->pput<le_int32_t>(offset, v); }
-  inline void pput_u64l(size_t offset, uint64_t v) { this->pput<le_uint64_t>(offset, v); }
-  inline void pput_s64l(size_t offset, int64_t v) { this->pput<le_int64_t>(offset, v); }
-  inline void pput_f32l(size_t offset, float v) { this->pput<le_float>(offset, v); }
-  inline void pput_f64l(size_t offset, double v) { this->pput<le_double>(offset, v); }
+  // Writes count values as type T (for example, be_uint32_t). This is faster
+  // than calling put<T> for each value.
+  template <typename T>
+  void write_array(const loaded_type_t<T>* values, size_t count) {
+    size_t offset = this->contents.size();
+    this->contents.resize(offset + count * sizeof(T));
+    store_array<T>(this->contents.data() + offset, values, count);
+  }
+  template <typename T>
+  void write_array(const std::vector<loaded_type_t<T>>& values) {
+    this->write_array<T>(values.data(), values.size());
+  }
 
   inline size_t size() const {
     return this->contents.size();
@@ -757,7 +1111,191 @@ private:
   std::string contents;
 };
 
-class BufferWriter {
+// Like StringWriter, but the data is stored in a list of fixed-size blocks
+// instead of a single string, so writing a large amount of data never
+// reallocates or copies data that was already written. put and pput work
+// across block boundaries. The data can be written to a file descriptor with
+// writev (without copying it into a single buffer), or copied into a single
+// string with linearize().
+//
+// flush() writes the data to a file descriptor and then discards it, so the
+// memory used doesn't depend on the total size of the output. Offsets are
+// still relative to the beginning of all data written (so size() includes
+// flushed data), but data that has already been flushed can't be modified.
+class ChunkedStringWriter : public WriterPutFunctions<ChunkedStringWriter> {
+public:
+  static constexpr size_t DEFAULT_BLOCK_SIZE = 0x10000;
+
+  explicit ChunkedStringWriter(size_t block_size = DEFAULT_BLOCK_SIZE);
+  ChunkedStringWriter(const ChunkedStringWriter&) = delete;
+  ChunkedStringWriter(ChunkedStringWriter&&) = default;
+  ChunkedStringWriter& operator=(const ChunkedStringWriter&) = delete;
+  ChunkedStringWriter& operator=(ChunkedStringWriter&&) = default;
+  ~ChunkedStringWriter() = default;
+
+  void reset();
+
+  // Like StringWriter::extend_to, this can also shrink the data, but not to
+  // less than flushed_size()
+  void extend_to(size_t size, char v = '\0');
+  inline void extend_by(size_t size, char v = '\0') {
+    this->append(nullptr, size, v);
+  }
+
+  inline void write(const void* data, size_t size) {
+    this->append(data, size, 0);
+  }
+  inline void write(const std::string& data) {
+    this->append(data.data(), data.size(), 0);
+  }
+  // Throws std::out_of_range if any of the data has already been flushed.
+  // Extends the data (with zeroes) if needed.
+  void pwrite(size_t offset, const void* data, size_t size);
+
+  template <typename T>
+  void put(const T& v) {
+    if (!this->blocks.empty() && (this->tail_size + sizeof(T) <= this->block_size)) {
+      memcpy(this->blocks.back().get() + this->tail_size, &v, sizeof(T));
+      this->tail_size += sizeof(T);
+      this->total_size += sizeof(T);
+    } else {
+      this->append(&v, sizeof(T), 0);
+    }
+  }
+
+  template <typename T>
+  void pput(size_t offset, const T& v) {
+    if ((offset >= this->flushed_bytes) && (offset + sizeof(T) <= this->total_size)) {
+      size_t block_offset = (offset - this->flushed_bytes) % this->block_size;
+      if (block_offset + sizeof(T) <= this->block_size) {
+        size_t block_index = (offset - this->flushed_bytes) / this->block_size;
+        memcpy(this->blocks[block_index].get() + block_offset, &v, sizeof(T));
+        return;
+      }
+    }
+    this->pwrite(offset, &v, sizeof(T));
+  }
+
+  inline size_t size() const {
+    return this->total_size;
+  }
+  inline size_t flushed_size() const {
+    return this->flushed_bytes;
+  }
+  inline size_t block_count() const {
+    return this->blocks.size();
+  }
+
+  // Returns the unflushed data, one iovec per block
+  std::vector<struct iovec> iovs() const;
+  // Returns a copy of all the unflushed data in a single string
+  std::string linearize() const;
+#ifndef PHOSG_WINDOWS
+  // Writes all the unflushed data to fd (without copying it), then discards it
+  void flush(int fd);
+#endif
+
+private:
+  size_t block_size;
+  std::vector<std::unique_ptr<char[]>> blocks;
+  // Number of bytes used in the last block
+  size_t tail_size;
+  // Number of bytes written to an fd and discarded; the first block begins at
+  // this offset
+  size_t flushed_bytes;
+  size_t total_size;
+
+  // If data is null, writes size copies of fill_v instead
+  void append(const void* data, size_t size, char fill_v);
+};
+
+#ifndef PHOSG_WINDOWS
+// Like StringWriter, but when the buffered data reaches buffer_size bytes, it
+// is written to a file descriptor, so the memory used doesn't depend on the
+// total size of the output. Offsets are relative to the position of the fd
+// when the writer was constructed, and size() includes data that has already
+// been written to the fd. pput and pwrite can modify data that has already
+// been written (this uses pwrite(), so the fd must be seekable in that case).
+//
+// Buffered data is written when the writer is destroyed, but errors are
+// ignored in that case; call flush() before destroying the writer to detect
+// them. The writer doesn't own or close the fd.
+class FileStringWriter : public WriterPutFunctions<FileStringWriter> {
+public:
+  static constexpr size_t DEFAULT_BUFFER_SIZE = 0x100000;
+
+  explicit FileStringWriter(int fd, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+  // Flushes f's buffer, then writes to its underlying fd. f shouldn't be used
+  // for writing until the FileStringWriter is destroyed or flushed.
+  explicit FileStringWriter(FILE* f, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+  FileStringWriter(const FileStringWriter&) = delete;
+  FileStringWriter(FileStringWriter&&) = delete;
+  FileStringWriter& operator=(const FileStringWriter&) = delete;
+  FileStringWriter& operator=(FileStringWriter&&) = delete;
+  ~FileStringWriter();
+
+  inline void extend_by(size_t size, char v = '\0') {
+    this->buffer.resize(this->buffer.size() + size, v);
+    this->flush_if_full();
+  }
+
+  inline void write(const void* data, size_t size) {
+    this->buffer.append(reinterpret_cast<const char*>(data), size);
+    this->flush_if_full();
+  }
+  inline void write(const std::string& data) {
+    this->write(data.data(), data.size());
+  }
+  // Extends the data (with zeroes) if needed
+  void pwrite(size_t offset, const void* data, size_t size);
+
+  template <typename T>
+  void put(const T& v) {
+    this->buffer.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    this->flush_if_full();
+  }
+
+  template <typename T>
+  void pput(size_t offset, const T& v) {
+    if ((offset >= this->flushed_bytes) && (offset + sizeof(T) <= this->size())) {
+      memcpy(this->buffer.data() + (offset - this->flushed_bytes), &v, sizeof(v));
+    } else {
+      this->pwrite(offset, &v, sizeof(v));
+    }
+  }
+
+  inline size_t size() const {
+    return this->flushed_bytes + this->buffer.size();
+  }
+  inline size_t flushed_size() const {
+    return this->flushed_bytes;
+  }
+  inline int get_fd() const {
+    return this->fd;
+  }
+
+  // Writes all buffered data to the fd
+  void flush();
+
+private:
+  int fd;
+  size_t buffer_size;
+  // Position of the fd when the writer was constructed (or -1 if the fd isn't
+  // seekable); data at offset X in the output is at base_offset + X in the
+  // file
+  off_t base_offset;
+  size_t flushed_bytes;
+  std::string buffer;
+
+  inline void flush_if_full() {
+    if (this->buffer.size() >= this->buffer_size) {
+      this->flush();
+    }
+  }
+};
+#endif
+
+class BufferWriter : public WriterPutFunctions<BufferWriter> {
 public:
   BufferWriter(void* buf, size_t buf_size) : buf(reinterpret_cast<uint8_t*>(buf)), buf_size(buf_size), offset(0) {}
   ~BufferWriter() = default;
@@ -789,82 +1327,6 @@ public:
     this->pwrite(offset, &v, sizeof(v));
   }
 
-  inline void put_u8(uint8_t v) { this->put<uint8_t>(v); }
-  inline void put_s8(int8_t v) { this->put<int8_t>(v); }
-  inline void put_u16(uint16_t v) { this->put<uint16_t>(v); }
-  inline void put_s16(int16_t v) { this->put<int16_t>(v); }
-  inline void put_u32(uint32_t v) { this->put<uint32_t>(v); }
-  inline void put_s32(int32_t v) { this->put<int32_t>(v); }
-  inline void put_u64(uint64_t v) { this->put<uint64_t>(v); }
-  inline void put_s64(int64_t v) { this->put<int64_t>(v); }
-  inline void put_f32(float v) { this->put<float>(v); }
-  inline void put_f64(double v) { this->put<double>(v); }
-
-  inline void put_u16r(uint16_t v) { this->put<re_uint16_t>(v); }
-  inline void put_s16r(int16_t v) { this->put<re_int16_t>(v); }
-  inline void put_u32r(uint32_t v) { this->put<re_uint32_t>(v); }
-  inline void put_s32r(int32_t v) { this->put<re_int32_t>(v); }
-  inline void put_u64r(uint64_t v) { this->put<re_uint64_t>(v); }
-  inline void put_s64r(int64_t v) { this->put<re_int64_t>(v); }
-  inline void put_f32r(float v) { this->put<re_float>(v); }
-  inline void put_f64r(double v) { this->put<re_double>(v); }
-
-  inline void put_u16b(uint16_t v) { this->put<be_uint16_t>(v); }
-  inline void put_s16b(int16_t v) { this->put<be_int16_t>(v); }
-  inline void put_u32b(uint32_t v) { this->put<be_uint32_t>(v); }
-  inline void put_s32b(int32_t v) { this->put<be_int32_t>(v); }
-  inline void put_u64b(uint64_t v) { this->put<be_uint64_t>(v); }
-  inline void put_s64b(int64_t v) { this->put<be_int64_t>(v); }
-  inline void put_f32b(float v) { this->put<be_float>(v); }
-  inline void put_f64b(double v) { this->put<be_double>(v); }
-
-  inline void put_u16l(uint16_t v) { this->put<le_uint16_t>(v); }
-  inline void put_s16l(int16_t v) { this->put<le_int16_t>(v); }
-  inline void put_u32l(uint32_t v) { this->put<le_uint32_t>(v); }
-  inline void put_s32l(int32_t v) { this->put<le_int32_t>(v); }
-  inline void put_u64l(uint64_t v) { this->put<le_uint64_t>(v); }
-  inline void put_s64l(int64_t v) { this->put<le_int64_t>(v); }
-  inline void put_f32l(float v) { this->put<le_float>(v); }
-  inline void put_f64l(double v) { this->put<le_double>(v); }
-
-  inline void pput_u8(size_t offset, uint8_t v) { this->pput<uint8_t>(offset, v); }
-  inline void pput_s8(size_t offset, int8_t v) { this->pput<int8_t>(offset, v); }
-  inline void pput_u16(size_t offset, uint16_t v) { this->pput<uint16_t>(offset, v); }
-  inline void pput_s16(size_t offset, int16_t v) { this->pput<int16_t>(offset, v); }
-  inline void pput_u32(size_t offset, uint32_t v) { this->pput<uint32_t>(offset, v); }
-  inline void pput_s32(size_t offset, int32_t v) { this->pput<int32_t>(offset, v); }
-  inline void pput_u64(size_t offset, uint64_t v) { this->pput<uint64_t>(offset, v); }
-  inline void pput_s64(size_t offset, int64_t v) { this->pput<int64_t>(offset, v); }
-  inline void pput_f32(size_t offset, float v) { this->pput<float>(offset, v); }
-  inline void pput_f64(size_t offset, double v) { this->pput<double>(offset, v); }
-
-  inline void pput_u16r(size_t offset, uint16_t v) { this->pput<re_uint16_t>(offset, v); }
-  inline void pput_s16r(size_t offset, int16_t v) { this->pput<re_int16_t>(offset, v); }
-  inline void pput_u32r(size_t offset, uint32_t v) { this->pput<re_uint32_t>(offset, v); }
-  inline void pput_s32r(size_t offset, int32_t v) { this->pput<re_int32_t>(offset, v); }
-  inline void pput_u64r(size_t offset, uint64_t v) { this->pput<re_uint64_t>(offset, v); }
-  inline void pput_s64r(size_t offset, int64_t v) { this->pput<re_int64_t>(offset, v); }
-  inline void pput_f32r(size_t offset, float v) { this->pput<re_float>(offset, v); }
-  inline void pput_f64r(size_t offset, double v) { this->pput<re_double>(offset, v); }
-
-  inline void pput_u16b(size_t offset, uint16_t v) { this->pput<be_uint16_t>(offset, v); }
-  inline void pput_s16b(size_t offset, int16_t v) { this->pput<be_int16_t>(offset, v); }
-  inline void pput_u32b(size_t offset, uint32_t v) { this->pput<be_uint32_t>(offset, v); }
-  inline void pput_s32b(size_t offset, int32_t v) { this->pput<be_int32_t>(offset, v); }
-  inline void pput_u64b(size_t offset, uint64_t v) { this->pput<be_uint64_t>(offset, v); }
-  inline void pput_s64b(size_t offset, int64_t v) { this->pput<be_int64_t>(offset, v); }
-  inline void pput_f32b(size_t offset, float v) { this->pput<be_float>(offset, v); }
-  inline void pput_f64b(size_t offset, double v) { this->pput<be_double>(offset, v); }
-
-  inline void pput_u16l(size_t offset, uint16_t v) { this->pput<le_uint16_t>(offset, v); }
-  inline void pput_s16l(size_t offset, int16_t v) { this->pput<le_int16_t>(offset, v); }
-  inline void pput_u32l(size_t offset, uint32_t v) { this->pput<le_uint32_t>(offset, v); }
-  inline void pput_s32l(size_t offset, int32_t v) { this->pput<le_int32_t>(offset, v); }
-  inline void pput_u64l(size_t offset, uint64_t v) { this->pput<le_uint64_t>(offset, v); }
-  inline void pput_s64l(size_t offset, int64_t v) { this->pput<le_int64_t>(offset, v); }
-  inline void pput_f32l(size_t offset, float v) { this->pput<le_float>(offset, v); }
-  inline void pput_f64l(size_t offset, double v) { this->pput<le_double>(offset, v); }
-
 private:
   uint8_t* buf;
   size_t buf_size;
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "Strings.hh"
+#include "Time.hh"
+
+using namespace std;
+using namespace phosg;
+
+template <typename FnT>
+void run_benchmark(const char* name, size_t input_bytes, size_t iterations, FnT&& fn) {
+  uint64_t start_time = now();
+  for (size_t z = 0; z < iterations; z++) {
+    fn();
+  }
+  uint64_t total_usecs = now() - start_time;
+
+  double usecs_per_iteration = static_cast<double>(total_usecs) / iterations;
+  double mb_per_sec = (usecs_per_iteration > 0) ? (input_bytes / usecs_per_iteration) : 0.0;
+  fwrite_fmt(stdout, "{:<48} {:>12.0f} usecs  {:>10.1f} MB/s\n", name, usecs_per_iteration, mb_per_sec);
+}
+
+// Field sizes for the bit-decoding benchmarks. This is a mix of small and
+// large fields, like the codes and extra bits in a compressed stream. There
+// are 16 sizes so the benchmark loops can use (z & 15) as the index.
+static constexpr array<uint8_t, 16> FIELD_SIZES = {3, 1, 7, 12, 5, 2, 9, 16, 4, 1, 24, 6, 3, 11, 8, 2};
+
+static size_t count_fields(size_t total_bits) {
+  size_t ret = 0;
+  for (size_t offset = 0; offset + FIELD_SIZES[ret & 15] <= total_bits; ret++) {
+    offset += FIELD_SIZES[ret & 15];
+  }
+  return ret;
+}
+
+// Reads fields one bit at a time (this is how BitReader::read used to work)
+static uint64_t read_bits_reference(const string& data, size_t& offset, uint8_t size) {
+  uint64_t ret = 0;
+  for (uint8_t z = 0; z < size; z++, offset++) {
+    ret = (ret << 1) | ((data[offset >> 3] >> (7 - (offset & 7))) & 1);
+  }
+  return ret;
+}
+
+// Appends bits one at a time (this is how BitWriter::write used to work)
+static void write_bit_reference(string& data, uint8_t& last_byte_unset_bits, bool v) {
+  if (last_byte_unset_bits > 0) {
+    last_byte_unset_bits--;
+    if (v) {
+      data[data.size() - 1] |= (1 << last_byte_unset_bits);
+    }
+  } else {
+    data.push_back(v ? 0x80 : 0x00);
+    last_byte_unset_bits = 7;
+  }
+}
+
+int main(int argc, char** argv) {
+  size_t data_size = (argc > 1) ? stoull(argv[1], nullptr, 0) : 0x1000000;
+  size_t iterations = (argc > 2) ? stoull(argv[2], nullptr, 0) : 5;
+
+  string data(data_size, '\0');
+  for (size_t z = 0; z < data.size(); z++) {
+    data[z] = (z * 0x9E3779B1) >> 11;
+  }
+  size_t field_count = count_fields(data.size() * 8);
+  fwrite_fmt(stdout, "Input: {}, {} fields\n", format_size(data.size()), field_count);
+
+  // Each benchmark sums the fields and checks the result against this
+  uint64_t expected_sum = 0;
+  {
+    size_t offset = 0;
+    for (size_t z = 0; z < field_count; z++) {
+      expected_sum += read_bits_reference(data, offset, FIELD_SIZES[z & 15]);
+    }
+  }
+  auto check_sum = [&](uint64_t sum) -> void {
+    if (sum != expected_sum) {
+      throw logic_error("incorrect values read");
+    }
+  };
+
+  fwrite_fmt(stdout, "-- bit reading\n");
+  run_benchmark("bit by bit (reference)", data.size(), iterations, [&]() {
+    size_t offset = 0;
+    uint64_t sum = 0;
+    for (size_t z = 0; z < field_count; z++) {
+      sum += read_bits_reference(data, offset, FIELD_SIZES[z & 15]);
+    }
+    check_sum(sum);
+  });
+  run_benchmark("BitReader::read", data.size(), iterations, [&]() {
+    BitReader r(data);
+    uint64_t sum = 0;
+    for (size_t z = 0; z < field_count; z++) {
+      sum += r.read(FIELD_SIZES[z & 15]);
+    }
+    check_sum(sum);
+  });
+  run_benchmark("BufferedBitReader::read", data.size(), iterations, [&]() {
+    BufferedBitReader r(data);
+    uint64_t sum = 0;
+    for (size_t z = 0; z < field_count; z++) {
+      sum += r.read(FIELD_SIZES[z & 15]);
+    }
+    check_sum(sum);
+  });
+  run_benchmark("BufferedBitReader::peek + consume", data.size(), iterations, [&]() {
+    // Like a table-driven decoder, which looks at more bits than it uses
+    BufferedBitReader r(data);
+    uint64_t sum = 0;
+    for (size_t z = 0; z < field_count; z++) {
+      uint8_t size = FIELD_SIZES[z & 15];
+      uint8_t peek_size = min<size_t>(24, r.remaining());
+      sum += r.peek(peek_size) >> (peek_size - size);
+      r.consume(size);
+    }
+    check_sum(sum);
+  });
+  run_benchmark("BufferedBitReader::read (LSB_FIRST)", data.size(), iterations, [&]() {
+    BufferedBitReader r(data, BitOrder::LSB_FIRST);
+    uint64_t sum = 0;
+    for (size_t z = 0; z < field_count; z++) {
+      sum += r.read(FIELD_SIZES[z & 15]);
+    }
+    if (sum == 0) {
+      throw logic_error("incorrect values read");
+    }
+  });
+
+  // These write the same fields that the reading benchmarks read, so the
+  // results should be equal to the input data (except for the last few bits)
+  vector<uint64_t> field_values;
+  {
+    BitReader r(data);
+    for (size_t z = 0; z < field_count; z++) {
+      field_values.emplace_back(r.read(FIELD_SIZES[z & 15]));
+    }
+  }
+  size_t written_bytes = data.size() - 4;
+  auto check_output = [&](const string& output) -> void {
+    if ((output.size() < written_bytes) || memcmp(output.data(), data.data(), written_bytes)) {
+      throw logic_error("incorrect data written");
+    }
+  };
+
+  fwrite_fmt(stdout, "-- bit writing\n");
+  run_benchmark("bit by bit (reference)", data.size(), iterations, [&]() {
+    string output;
+    uint8_t last_byte_unset_bits = 0;
+    for (size_t z = 0; z < field_count; z++) {
+      uint64_t value = field_values[z];
+      for (uint8_t b = FIELD_SIZES[z & 15]; b > 0; b--) {
+        write_bit_reference(output, last_byte_unset_bits, (value >> (b - 1)) & 1);
+      }
+    }
+    check_output(output);
+  });
+  run_benchmark("BitWriter::write(bool)", data.size(), iterations, [&]() {
+    BitWriter w;
+    for (size_t z = 0; z < field_count; z++) {
+      uint64_t value = field_values[z];
+      for (uint8_t b = FIELD_SIZES[z & 15]; b > 0; b--) {
+        w.write(static_cast<bool>((value >> (b - 1)) & 1));
+      }
+    }
+    check_output(w.str());
+  });
+  run_benchmark("BitWriter::write(value, bits)", data.size(), iterations, [&]() {
+    BitWriter w;
+    for (size_t z = 0; z < field_count; z++) {
+      w.write(field_values[z], FIELD_SIZES[z & 15]);
+    }
+    check_output(w.str());
+  });
+  run_benchmark("BitWriter::write + flush_to every 64KB", data.size(), iterations, [&]() {
+    BitWriter w;
+    StringWriter out_w;
+    for (size_t z = 0; z < field_count; z++) {
+      w.write(field_values[z], FIELD_SIZES[z & 15]);
+      if (!(z & 0xFFFF)) {
+        w.flush_to(out_w);
+      }
+    }
+    w.flush_to(out_w, true);
+    check_output(out_w.str());
+  });
+
+  return 0;
+}
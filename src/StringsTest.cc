@@ -164,6 +164,201 @@ void test_bit_reader() {
   expect_eq(0x00, r.read(7));
   expect_eq(0x03, r.read(2));
   expect(r.eof());
+
+  // pread should match a bit-by-bit reference implementation at all offsets
+  // and sizes
+  string data;
+  for (size_t z = 0; z < 24; z++) {
+    data.push_back(z * 0x35 + 0x1B);
+  }
+  BitReader data_r(data);
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (uint8_t size = 0; size <= 64; size++) {
+      uint64_t expected = 0;
+      for (size_t z = offset; z < offset + size; z++) {
+        expected = (expected << 1) | ((data[z >> 3] >> (7 - (z & 7))) & 1);
+      }
+      expect_eq(expected, data_r.pread(offset, size));
+    }
+  }
+}
+
+void test_buffered_bit_reader() {
+  fwrite_fmt(stderr, "-- BufferedBitReader\n");
+
+  fwrite_fmt(stderr, "---- MSB_FIRST\n");
+  {
+    BufferedBitReader r("\x01\x02\xFF\x80\xC0", 34);
+    expect_eq(r.order(), BitOrder::MSB_FIRST);
+    expect_eq(0x01, r.read(8));
+    expect_eq(0x00, r.peek(4));
+    expect_eq(0x00, r.read(4));
+    expect_eq(0x01, r.read(3));
+    expect_eq(0x01FF, r.read(10));
+    expect_eq(r.where(), 25);
+    expect_eq(r.remaining(), 9);
+    expect_eq(0x00, r.read(7));
+    expect_eq(0x03, r.peek(2));
+    expect_raises(out_of_range, [&]() {
+      r.peek(3);
+    });
+    expect_eq(0x03, r.read(2));
+    expect(r.eof());
+    expect_eq(0, r.read(0));
+    expect_raises(out_of_range, [&]() {
+      r.read(1);
+    });
+  }
+
+  fwrite_fmt(stderr, "---- LSB_FIRST\n");
+  {
+    // Bits (in stream order): 1000 0000, 0100 0000, 1111 1111, 0000 0001
+    BufferedBitReader r("\x01\x02\xFF\x80", 32, BitOrder::LSB_FIRST);
+    expect_eq(0x01, r.read(1));
+    expect_eq(0x00, r.read(8));
+    expect_eq(0x01, r.read(1));
+    expect_eq(0x3FC0, r.read(16));
+    expect_eq(0x20, r.read(6));
+    expect(r.eof());
+  }
+
+  fwrite_fmt(stderr, "---- matches BitReader\n");
+  string data;
+  for (size_t z = 0; z < 200; z++) {
+    data.push_back(z * 0x35 + 0x1B);
+  }
+  // Read values of many sizes, so refills happen at all possible positions
+  BitReader expected_r(data);
+  BufferedBitReader r(data);
+  for (size_t z = 0; !expected_r.eof(); z++) {
+    uint8_t size = min<size_t>((z * 7) % 65, expected_r.remaining());
+    expect_eq(r.where(), expected_r.where());
+    expect_eq(r.read(size), expected_r.read(size));
+  }
+  expect(r.eof());
+
+  r.go(13);
+  expected_r.go(13);
+  expect_eq(r.read(50), expected_r.read(50));
+  r.skip(100);
+  expected_r.skip(100);
+  expect_eq(r.where(), 163);
+  expect_eq(r.read(64), expected_r.read(64));
+  r.go(data.size() * 8);
+  expect(r.eof());
+  expect_raises(out_of_range, [&]() {
+    r.go(data.size() * 8 + 1);
+  });
+
+  // 64-bit reads in LSB_FIRST order should put the first bits read in the low
+  // bits of the result
+  BufferedBitReader lsb_r(data, BitOrder::LSB_FIRST);
+  lsb_r.go(3);
+  uint64_t v64 = lsb_r.read(64);
+  lsb_r.go(3);
+  uint64_t low = lsb_r.read(40);
+  uint64_t high = lsb_r.read(24);
+  expect_eq(v64, low | (high << 40));
+
+  fwrite_fmt(stderr, "---- MAX_PEEK_BITS at byte-aligned offsets\n");
+  // At byte-aligned offsets, a single 8-byte load only fills 56 bits of the
+  // buffer, so reading 57 bits needs one more byte
+  for (BitOrder order : {BitOrder::MSB_FIRST, BitOrder::LSB_FIRST}) {
+    for (size_t offset : {0, 8, 64, 800}) {
+      BufferedBitReader peek_r(data, order);
+      BufferedBitReader expected_r(data, order);
+      peek_r.go(offset);
+      expected_r.go(offset);
+      uint64_t expected = expected_r.read(64) & 0x01FFFFFFFFFFFFFF;
+      if (order == BitOrder::MSB_FIRST) {
+        expected_r.go(offset);
+        expected = expected_r.read(64) >> 7;
+      }
+      expect_eq(expected, peek_r.peek(BufferedBitReader::MAX_PEEK_BITS));
+      expect_eq(expected, peek_r.read(BufferedBitReader::MAX_PEEK_BITS));
+      expect_eq(peek_r.where(), offset + 57);
+      peek_r.go(offset);
+      peek_r.consume(BufferedBitReader::MAX_PEEK_BITS);
+      expect_eq(peek_r.where(), offset + 57);
+    }
+  }
+  {
+    BufferedBitReader peek_r(data);
+    expect_raises(logic_error, [&]() {
+      peek_r.peek(58);
+    });
+    expect_raises(logic_error, [&]() {
+      peek_r.consume(64);
+    });
+  }
+}
+
+void test_bit_writer() {
+  fwrite_fmt(stderr, "-- BitWriter\n");
+  BitWriter w;
+  expect_eq(w.size(), 0);
+  expect_eq(w.str(), "");
+  w.write(true);
+  w.write(0x0ABC, 13);
+  expect_eq(w.size(), 14);
+  expect_eq(w.str(), "\xAA\xF0");
+  // str() can be called before the buffer is full, and writing can continue
+  // afterward
+  w.write(false);
+  w.write(0xFF, 1);
+  expect_eq(w.str(), "\xAA\xF1");
+  w.write(0x123456789ABCDEF0, 64);
+  w.write(0x7F, 7);
+  expect_eq(w.size(), 87);
+  expect_eq(w.str(), "\xAA\xF1\x12\x34\x56\x78\x9A\xBC\xDE\xF0\xFE");
+
+  w.truncate(80);
+  expect_eq(w.str(), "\xAA\xF1\x12\x34\x56\x78\x9A\xBC\xDE\xF0");
+  w.truncate(13);
+  expect_eq(w.size(), 13);
+  expect_eq(w.str(), "\xAA\xF0");
+  expect_raises(logic_error, [&]() {
+    w.truncate(14);
+  });
+  expect_raises(logic_error, [&]() {
+    w.write(0, 65);
+  });
+
+  fwrite_fmt(stderr, "---- flush_to\n");
+  StringWriter out_w;
+  w.flush_to(out_w);
+  expect_eq(out_w.str(), "\xAA");
+  expect_eq(w.size(), 5);
+  w.write(0x2B, 6);
+  w.flush_to(out_w);
+  expect_eq(out_w.str(), "\xAA\xF5");
+  expect_eq(w.size(), 3);
+  w.flush_to(out_w, true);
+  expect_eq(out_w.str(), "\xAA\xF5\x60");
+  expect_eq(w.size(), 0);
+  expect_eq(w.str(), "");
+
+  fwrite_fmt(stderr, "---- matches bit-by-bit writes\n");
+  // Write values of many sizes, so the buffer is written out at all possible
+  // positions, and check that BitReader reads the same values back
+  w.reset();
+  BitWriter expected_w;
+  vector<pair<uint64_t, uint8_t>> values;
+  for (size_t z = 0; z < 200; z++) {
+    uint8_t bits = (z * 7) % 65;
+    uint64_t value = 0x9E3779B97F4A7C15 * (z + 1);
+    w.write(value, bits);
+    for (uint8_t b = bits; b > 0; b--) {
+      expected_w.write(static_cast<bool>((value >> (b - 1)) & 1));
+    }
+    values.emplace_back(value, bits);
+  }
+  expect_eq(w.size(), expected_w.size());
+  expect_eq(w.str(), expected_w.str());
+  BitReader r(w.str());
+  for (const auto& [value, bits] : values) {
+    expect_eq(bits ? (value & (0xFFFFFFFFFFFFFFFF >> (64 - bits))) : 0, r.read(bits));
+  }
 }
 
 void test_string_reader() {
@@ -342,8 +537,249 @@ void test_string_reader() {
   expect_eq(r.get_cstr(), "and this is a cstring");
   expect(r.eof());
   expect_eq(r.pget_cstr(0x3A), "and this is a cstring");
+
+  fwrite_fmt(stderr, "---- get_span/pget_span\n");
+  r.go(0);
+  {
+    auto span = r.get_span(0x20);
+    expect_eq(r.where(), 0x20);
+    expect_eq(span.size(), 0x20);
+    expect_eq(span.get_u8(), 0x00);
+    expect_eq(span.get_u16b(), 0x0102);
+    expect_eq(span.get_u8(), 0x03);
+    expect_eq(span.get_u32l(), 0x07060504);
+    expect_eq(span.get_u64b(), 0x08090A0B0C0D0E0F);
+    expect_eq(span.get_f32b(), 1.0f);
+    expect_eq(span.get_f32l(), 1.0f);
+    expect_eq(span.get_f64b(), 1.0);
+    expect(span.eof());
+  }
+  {
+    auto span = r.pget_span(0x10, 4);
+    expect_eq(span.get_s32b(), 0x3F800000);
+    expect_eq(span.remaining(), 0);
+  }
+  expect_raises(out_of_range, [&]() {
+    r.get_span(data.size() - 0x1F);
+  });
+  expect_eq(r.where(), 0x20);
+  expect_eq(r.get_span(0, false).size(), 0);
+
+  fwrite_fmt(stderr, "---- read_array\n");
+  r.go(0);
+  expect_eq(r.read_array<uint8_t>(3), (vector<uint8_t>{0x00, 0x01, 0x02}));
+  expect_eq(r.read_array<be_uint16_t>(2, false), (vector<uint16_t>{0x0304, 0x0506}));
+  expect_eq(r.read_array<le_uint16_t>(2), (vector<uint16_t>{0x0403, 0x0605}));
+  {
+    uint32_t values[2];
+    r.read_array<be_uint32_t>(values, 2);
+    expect_eq(values[0], 0x0708090A);
+    expect_eq(values[1], 0x0B0C0D0E);
+  }
+  r.go(0x10);
+  expect_eq(r.read_array<be_float>(1), (vector<float>{1.0f}));
+  expect_eq(r.read_array<le_float>(1), (vector<float>{1.0f}));
+  expect_eq(r.read_array<be_double>(1), (vector<double>{1.0}));
+  expect_eq(r.read_array<le_double>(1), (vector<double>{1.0}));
+  {
+    auto span = r.pget_span(0, 8);
+    int16_t values[4];
+    span.read_array<be_int16_t>(values, 4);
+    expect_eq(values[3], 0x0607);
+    expect(span.eof());
+  }
+  expect_raises(out_of_range, [&]() {
+    r.read_array<le_uint64_t>((data.size() - r.where()) / 8 + 1);
+  });
+  expect_raises(out_of_range, [&]() {
+    r.read_array<le_uint64_t>(SIZE_MAX / 4);
+  });
+  expect_eq(r.where(), 0x28);
+
+  fwrite_fmt(stderr, "---- write_array\n");
+  {
+    // Long enough to use the vectorized conversion, with a few values left over
+    vector<uint32_t> values;
+    StringWriter expected_w;
+    for (uint32_t z = 0; z < 37; z++) {
+      values.emplace_back(0x01020304 * z);
+      expected_w.put_u32b(0x01020304 * z);
+    }
+    StringWriter w;
+    w.write_array<be_uint32_t>(values);
+    expect_eq(w.str(), expected_w.str());
+    w.write_array<le_double>(nullptr, 0);
+    expect_eq(w.size(), 37 * 4);
+
+    StringReader array_r(w.str());
+    expect_eq(array_r.read_array<be_uint32_t>(values.size()), values);
+  }
+
+  fwrite_fmt(stderr, "---- sub-readers hold a reference to the data\n");
+  StringReader sub;
+  BitReader sub_bits;
+  {
+    auto owned = make_shared<string>(data);
+    StringReader owner_r(owned);
+    sub = owner_r.sub(0x28).subx(1, 0x10);
+    sub_bits = owner_r.subx_bits(0x10, 1);
+    expect_eq(owned.use_count(), 4);
+  }
+  expect_eq(sub.all(), "this is a pstrin");
+  expect_eq(sub.get_u8(), 't');
+  expect_eq(sub_bits.read(8), 0x3F);
 }
 
+void test_chunked_string_writer() {
+  fwrite_fmt(stderr, "-- ChunkedStringWriter\n");
+
+  // A small block size makes most puts cross block boundaries. The results
+  // should always be the same as StringWriter's.
+  ChunkedStringWriter w(7);
+  StringWriter expected_w;
+  auto check = [&]() -> void {
+    expect_eq(w.size(), expected_w.size());
+    expect_eq(w.linearize(), expected_w.str());
+  };
+  check();
+
+  for (size_t z = 0; z < 10; z++) {
+    w.put_u8(z);
+    expected_w.put_u8(z);
+    w.put_u32b(0x01020304 * z);
+    expected_w.put_u32b(0x01020304 * z);
+    w.put_u16l(0xABCD + z);
+    expected_w.put_u16l(0xABCD + z);
+    w.put_f64b(z * 1.5);
+    expected_w.put_f64b(z * 1.5);
+  }
+  w.write("this string spans multiple blocks");
+  expected_w.write("this string spans multiple blocks");
+  check();
+  expect_eq(w.block_count(), (w.size() + 6) / 7);
+
+  for (size_t offset = 0; offset < w.size() - 8; offset += 3) {
+    w.pput_u64l(offset, offset * 0x0102030405060708);
+    expected_w.pput_u64l(offset, offset * 0x0102030405060708);
+  }
+  w.pput_u32r(w.size() + 5, 0x11223344);
+  expected_w.pput_u32r(expected_w.size() + 5, 0x11223344);
+  check();
+
+  w.extend_by(10, 'x');
+  expected_w.extend_by(10, 'x');
+  check();
+  w.extend_to(22);
+  expected_w.extend_to(22);
+  check();
+  w.extend_to(21);
+  expected_w.extend_to(21);
+  check();
+  expect_eq(w.block_count(), 3);
+  w.put_u16b(0x4142);
+  expected_w.put_u16b(0x4142);
+  check();
+
+  auto iovs = w.iovs();
+  expect_eq(iovs.size(), 4);
+  expect_eq(iovs[0].iov_len, 7);
+  expect_eq(iovs[3].iov_len, 2);
+
+#ifndef PHOSG_WINDOWS
+  fwrite_fmt(stderr, "---- flush\n");
+  {
+    scoped_fd fd("StringsTest-data", O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    w.flush(fd);
+    expect_eq(w.size(), 23);
+    expect_eq(w.flushed_size(), 23);
+    expect_eq(w.block_count(), 0);
+    expect_eq(w.linearize(), "");
+    expect_raises(out_of_range, [&]() {
+      w.pput_u8(22, 0);
+    });
+
+    // Offsets are still relative to the beginning of the output
+    w.write("abcdefghij");
+    w.pput_u8(23, 'A');
+    w.pput_u16b(29, 0x4748);
+    expect_eq(w.linearize(), "AbcdefGHij");
+    w.flush(fd);
+    w.flush(fd);
+    expect_eq(w.size(), 33);
+  }
+  expect_eq(load_file("StringsTest-data"), expected_w.str() + "AbcdefGHij");
+#endif
+
+  w.reset();
+  expect_eq(w.size(), 0);
+  expect_eq(w.flushed_size(), 0);
+  expect_eq(w.linearize(), "");
+}
+
+#ifndef PHOSG_WINDOWS
+void test_file_string_writer() {
+  fwrite_fmt(stderr, "-- FileStringWriter\n");
+
+  // Each write that fills the 16-byte buffer should flush it to the file. The
+  // file starts with a few bytes of existing data; offsets should be relative
+  // to where the writer started, not to the beginning of the file.
+  StringWriter expected_w;
+  {
+    auto f = fopen_unique("StringsTest-data", "w+b");
+    fwritex(f.get(), string("PREFIX"));
+    FileStringWriter w(f.get(), 16);
+    expect_eq(w.size(), 0);
+
+    for (size_t z = 0; z < 10; z++) {
+      w.put_u32b(0x01020304 * z);
+      expected_w.put_u32b(0x01020304 * z);
+      w.put_u16l(0xABCD + z);
+      expected_w.put_u16l(0xABCD + z);
+    }
+    w.write("this string is longer than the buffer");
+    expected_w.write("this string is longer than the buffer");
+    expect_eq(w.size(), expected_w.size());
+    expect_eq(w.flushed_size(), expected_w.size());
+    w.put_u8(0x7F);
+    expected_w.put_u8(0x7F);
+    expect_eq(w.flushed_size(), expected_w.size() - 1);
+
+    // Patch flushed data, buffered data, and a value that spans both
+    w.pput_u32b(0, 0xFFEEDDCC);
+    expected_w.pput_u32b(0, 0xFFEEDDCC);
+    w.pput_u16l(expected_w.size() - 1, 0x4142);
+    expected_w.pput_u16l(expected_w.size() - 1, 0x4142);
+    w.pput_u64b(expected_w.size() - 5, 0x3132333435363738);
+    expected_w.pput_u64b(expected_w.size() - 5, 0x3132333435363738);
+    expect_eq(w.size(), expected_w.size());
+
+    w.extend_by(3, 'x');
+    expected_w.extend_by(3, 'x');
+    w.pput_u8(expected_w.size() + 2, 'z');
+    expected_w.pput_u8(expected_w.size() + 2, 'z');
+    expect_eq(w.size(), expected_w.size());
+  }
+  expect_eq(load_file("StringsTest-data"), "PREFIX" + expected_w.str());
+
+  fwrite_fmt(stderr, "---- non-seekable fd\n");
+  {
+    int fds[2];
+    expect_eq(pipe(fds), 0);
+    scoped_fd read_fd(fds[0]);
+    scoped_fd write_fd(fds[1]);
+    FileStringWriter w(write_fd, 4);
+    w.put_u64b(0x4142434445464748);
+    w.put_u16b(0x494A);
+    expect_raises(out_of_range, [&]() {
+      w.pput_u8(0, 0);
+    });
+    w.pput_u8(8, 'i');
+    w.flush();
+    expect_eq(readx(read_fd, 10), "ABCDEFGHiJ");
+  }
+}
+#endif
+
 int main(int, char**) {
   {
     fwrite_fmt(stderr, "-- str_replace_all\n");
@@ -635,9 +1071,16 @@ int main(int, char**) {
   print_data_test();
 
   test_bit_reader();
+  test_buffered_bit_reader();
+  test_bit_writer();
 
   test_string_reader();
 
+  test_chunked_string_writer();
+#ifndef PHOSG_WINDOWS
+  test_file_string_writer();
+#endif
+
   // TODO: test log_level, set_log_level, log
   // TODO: test get_time_string
   // TODO: test string_for_error